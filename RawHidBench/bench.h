@@ -0,0 +1,20 @@
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <intrin.h>
+
+// Microbenchmarks for the RawHidDriver hot paths. Each benchmark is a subcommand
+// of RawHidBench.exe and prints one result line per configuration.
+
+// Keeps the compiler from discarding work whose result is otherwise unused.
+extern volatile uint64_t benchSink;
+
+// Function prototypes
+int bench_hex(int argc, char** argv);
+int bench_mux(int argc, char** argv);
+int bench_pipeline(int argc, char** argv);
+int bench_publish(int argc, char** argv);
+int bench_datagram(int argc, char** argv);
+bool create_device_pipe(const char* bench, int index, DWORD reportLength, HANDLE* server, HANDLE* client);
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bench.h"
+#include "frame_decoder.h"
+#include "timing.h"
+
+// Datagrams fed to the tracker for the throughput figure
+#define DATAGRAM_BENCH_COUNT 10000000
+
+// Frames per datagram in the throughput run, a typical coalesced batch
+#define DATAGRAM_BENCH_FRAMES 8
+
+// Payload of every frame, like QMK raw HID
+#define DATAGRAM_BENCH_PAYLOAD 64
+
+static uint8_t datagram[DATAGRAM_MAX_SIZE];
+static uint64_t framesSeen;
+
+static void on_bench_frame(const wire_frame* frame, void* context) {
+    (void)context;
+    framesSeen += frame->payload_length;
+}
+
+/**
+ * Builds a datagram of frameCount frames in the static buffer.
+ *
+ * @return The datagram's length.
+ */
+static size_t build_datagram(uint32_t session, uint32_t sequence, int frameCount) {
+    uint8_t* out = datagram;
+
+    wire_put_u32(out, sequence);
+    wire_put_u32(out + 4, session);
+    wire_put_u64(out + 8, 0);
+    out += DATAGRAM_HEADER_SIZE;
+    for (int i = 0; i < frameCount; i++) {
+        wire_put_u16(out, FRAME_HEADER_SIZE - FRAME_LENGTH_FIELD_SIZE + DATAGRAM_BENCH_PAYLOAD);
+        wire_put_u16(out + 2, 0);
+        wire_put_u32(out + 4, sequence * frameCount + i);
+        wire_put_u64(out + 8, 0);
+        memset(out + FRAME_HEADER_SIZE, 0, DATAGRAM_BENCH_PAYLOAD);
+        out += FRAME_HEADER_SIZE + DATAGRAM_BENCH_PAYLOAD;
+    }
+    return (size_t)(out - datagram);
+}
+
+static datagram_status feed(datagram_tracker* tracker, uint32_t session, uint32_t sequence) {
+    size_t length = build_datagram(session, sequence, 1);
+    return datagram_tracker_feed(tracker, datagram, length, on_bench_frame, NULL);
+}
+
+static bool check(const char* name, bool passed) {
+    printf("%-44s %s\n", name, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+/**
+ * Runs the datagram tracker through loss, reordering, duplication, wraparound and a
+ * sender that restarts early, and prints one line per scenario.
+ *
+ * @return true if every scenario gave the expected counts.
+ */
+static bool check_scenarios(void) {
+    datagram_tracker tracker;
+    bool passed = true;
+
+    init_datagram_tracker(&tracker);
+    bool ordered = true;
+    for (uint32_t i = 0; i < 100; i++) {
+        ordered &= feed(&tracker, 1, i) == DATAGRAM_IN_ORDER;
+    }
+    passed &= check("in order", ordered && tracker.received == 100 && tracker.lost == 0);
+
+    init_datagram_tracker(&tracker);
+    feed(&tracker, 1, 0);
+    bool gap = feed(&tracker, 1, 3) == DATAGRAM_AFTER_GAP;
+    passed &= check("gap counts the skipped datagrams lost", gap && tracker.lost == 2);
+    bool late = feed(&tracker, 1, 1) == DATAGRAM_REORDERED;
+    passed &= check("late datagram is reordered, not lost", late && tracker.lost == 1 && tracker.reordered == 1);
+    bool duplicate = feed(&tracker, 1, 1) == DATAGRAM_DUPLICATE && feed(&tracker, 1, 3) == DATAGRAM_DUPLICATE;
+    passed &= check("repeats are duplicates", duplicate && tracker.duplicates == 2 && tracker.received == 3);
+    feed(&tracker, 1, 3 + DATAGRAM_WINDOW);
+    passed &= check("older than the window is too late", feed(&tracker, 1, 2) == DATAGRAM_TOO_LATE);
+
+    // A sender that restarts after 500 datagrams counts from 0 again under a new session;
+    // every datagram of the new run must be delivered
+    init_datagram_tracker(&tracker);
+    for (uint32_t i = 0; i < 500; i++) {
+        feed(&tracker, 1, i);
+    }
+    uint64_t before = tracker.received;
+    bool restarted = true;
+    for (uint32_t i = 0; i < 600; i++) {
+        datagram_status status = feed(&tracker, 2, i);
+        restarted &= status == DATAGRAM_IN_ORDER;
+    }
+    passed &= check("short restart resyncs on the new session",
+        restarted && tracker.received - before == 600 && tracker.resyncs == 1 && tracker.lost == 0);
+
+    init_datagram_tracker(&tracker);
+    feed(&tracker, 1, 0xFFFFFFFEu);
+    bool wrapped = feed(&tracker, 1, 0xFFFFFFFFu) == DATAGRAM_IN_ORDER && feed(&tracker, 1, 0) == DATAGRAM_IN_ORDER;
+    passed &= check("sequence wraps", wrapped && tracker.lost == 0);
+
+    return passed;
+}
+
+/**
+ * Checks the UDP receiver's datagram tracker against scripted sequences, including a
+ * sender that restarts early, and measures its cost per datagram.
+ *
+ * Usage: RawHidBench datagram
+ */
+int bench_datagram(int argc, char** argv) {
+    datagram_tracker tracker;
+
+    (void)argc;
+    (void)argv;
+
+    if (!check_scenarios()) {
+        return 1;
+    }
+
+    init_datagram_tracker(&tracker);
+    framesSeen = 0;
+    size_t length = build_datagram(1, 0, DATAGRAM_BENCH_FRAMES);
+    uint64_t start = monotonic_ns();
+    for (uint32_t i = 0; i < DATAGRAM_BENCH_COUNT; i++) {
+        // Only the sequence changes between datagrams
+        wire_put_u32(datagram, i);
+        datagram_tracker_feed(&tracker, datagram, length, on_bench_frame, NULL);
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    benchSink += framesSeen;
+
+    printf("%d datagrams of %d frames: %.1f ns per datagram, %llu lost\n", DATAGRAM_BENCH_COUNT, DATAGRAM_BENCH_FRAMES,
+        (double)elapsed / DATAGRAM_BENCH_COUNT, (unsigned long long)tracker.lost);
+    return 0;
+}
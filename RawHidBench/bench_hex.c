@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "bench.h"
+#include "hex_encode.h"
+
+// Bytes encoded per configuration; enough to dwarf timer and warm-up noise
+#define HEX_BENCH_TOTAL_BYTES (64u * 1024 * 1024)
+#define HEX_BENCH_MAX_LENGTH 4096
+
+static const size_t lengths[] = { 3, 16, 64, 256, HEX_BENCH_MAX_LENGTH };
+
+/**
+ * The nibble-at-a-time loop logger.c used before hex_encode, kept as the baseline.
+ */
+static size_t baseline_unspaced(const unsigned char* data, size_t data_len, char* out_str, size_t out_str_size) {
+    const char* hex_digits = "0123456789ABCDEF";
+    size_t j = 0;
+    for (size_t i = 0; i < data_len && j < out_str_size - 2; ++i) {
+        out_str[j++] = hex_digits[(data[i] >> 4) & 0x0F];
+        out_str[j++] = hex_digits[(data[i] & 0x0F)];
+    }
+    out_str[j] = '\0';
+    return j;
+}
+
+/**
+ * The snprintf formatting the text wire mode used before hex_encode, kept as the baseline.
+ */
+static size_t baseline_spaced(const unsigned char* data, size_t data_len, char* out_str, size_t out_str_size) {
+    size_t j = 0;
+    for (size_t i = 0; i < data_len && j + 4 <= out_str_size; ++i) {
+        j += snprintf(out_str + j, out_str_size - j, i ? " %02X" : "%02X", data[i]);
+    }
+    return j;
+}
+
+/**
+ * Encodes HEX_BENCH_TOTAL_BYTES in chunks of the given length and reports bytes per cycle.
+ *
+ * @param name Label for the result line.
+ * @param kernel The kernel to select, or -1 to run the baseline.
+ * @param length Bytes per call.
+ * @param spaced Whether to produce "AA BB CC" output.
+ * @param data Input bytes, at least HEX_BENCH_MAX_LENGTH.
+ * @param out Output buffer, at least HEX_ENCODED_SIZE(HEX_BENCH_MAX_LENGTH, true).
+ * @return Bytes per cycle.
+ */
+static double run_config(const char* name, int kernel, size_t length, bool spaced, const unsigned char* data, char* out) {
+    size_t outSize = HEX_ENCODED_SIZE(length, spaced);
+    size_t iterations = HEX_BENCH_TOTAL_BYTES / length;
+    uint64_t sink = 0;
+
+    // Warm up caches and branch predictors before timing
+    for (size_t i = 0; i < 1000; i++) {
+        sink += kernel < 0
+            ? (spaced ? baseline_spaced(data, length, out, outSize) : baseline_unspaced(data, length, out, outSize))
+            : hex_encode(data, length, out, outSize, spaced);
+    }
+
+    uint64_t start = __rdtsc();
+    if (kernel < 0) {
+        for (size_t i = 0; i < iterations; i++) {
+            sink += spaced ? baseline_spaced(data, length, out, outSize) : baseline_unspaced(data, length, out, outSize);
+        }
+    }
+    else {
+        for (size_t i = 0; i < iterations; i++) {
+            sink += hex_encode(data, length, out, outSize, spaced);
+        }
+    }
+    uint64_t cycles = __rdtsc() - start;
+    benchSink += sink + (unsigned char)out[0];
+
+    double bytesPerCycle = (double)(iterations * length) / (double)cycles;
+    printf("%-9s %-8s %6zu  %8.3f bytes/cycle  %8.1f cycles/call\n",
+        name, spaced ? "spaced" : "packed", length, bytesPerCycle, (double)cycles / (double)iterations);
+    return bytesPerCycle;
+}
+
+/**
+ * Compares the hex kernels with the code they replaced, for each call length and
+ * both output formats. Kernels the CPU does not support are skipped.
+ *
+ * Usage: RawHidBench hex
+ */
+int bench_hex(int argc, char** argv) {
+    static const struct {
+        const char* name;
+        int kernel;
+    } kernels[] = {
+        { "baseline", -1 },
+        { "scalar", HEX_KERNEL_SCALAR },
+        { "ssse3", HEX_KERNEL_SSSE3 },
+        { "avx2", HEX_KERNEL_AVX2 },
+    };
+    static unsigned char data[HEX_BENCH_MAX_LENGTH];
+    static char out[HEX_ENCODED_SIZE(HEX_BENCH_MAX_LENGTH, true)];
+
+    (void)argc;
+    (void)argv;
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (unsigned char)rand();
+    }
+
+    printf("kernel    format   length  throughput\n");
+    for (int spaced = 0; spaced <= 1; spaced++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+                if (kernels[k].kernel >= 0 && !hex_encode_select((hex_kernel_id)kernels[k].kernel)) {
+                    continue;
+                }
+                run_config(kernels[k].name, kernels[k].kernel, lengths[l], spaced != 0, data, out);
+            }
+        }
+    }
+
+    hex_encode_select(HEX_KERNEL_AUTO);
+    printf("hex_encode uses %s on this CPU\n", hex_encode_kernel_name());
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+volatile uint64_t benchSink = 0;
+
+typedef struct {
+    const char* name;
+    int (*run)(int argc, char** argv);
+    const char* description;
+} bench_entry;
+
+static const bench_entry benches[] = {
+    { "hex", bench_hex, "Hex encoding kernels, bytes per cycle" },
+    { "mux", bench_mux, "Report latency through the HID multiplexer, 1 to 32 devices" },
+    { "pipeline", bench_pipeline, "Keystroke-to-wire latency and throughput, simulated devices to a loopback sink" },
+    { "publish", bench_publish, "Report fan-out to hundreds of loopback subscribers, delivery latency and cut-offs" },
+    { "datagram", bench_datagram, "UDP datagram tracker: loss, reordering and restart checks, then ns per datagram" },
+};
+
+static void print_usage(const char* program) {
+    printf("Usage: %s <benchmark> [options]\n\nBenchmarks:\n", program);
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        printf("  %-10s %s\n", benches[i].name, benches[i].description);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Keep the measuring thread on one core so rdtsc deltas come from one counter
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (strcmp(argv[1], benches[i].name) == 0) {
+            return benches[i].run(argc - 2, argv + 2);
+        }
+    }
+
+    print_usage(argv[0]);
+    return 1;
+}
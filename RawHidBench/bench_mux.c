@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bench.h"
+#include "hid_mux.h"
+#include "logger.h"
+
+// Reports per second per device, the polling rate of a full-speed keyboard
+#define MUX_BENCH_RATE_HZ 1000
+#define MUX_BENCH_SECONDS 3
+#define MUX_BENCH_MAX_SAMPLES (HID_MUX_MAX_DEVICES * MUX_BENCH_RATE_HZ * MUX_BENCH_SECONDS)
+
+// Input report length of the stand-in devices: report ID plus 64 bytes, like QMK raw HID
+#define MUX_BENCH_REPORT_LENGTH 65
+
+static const int deviceCounts[] = { 1, 2, 4, 8, 16, 32 };
+
+static const hid_mux_engine engines[] = { HID_MUX_ENGINE_IOCP, HID_MUX_ENGINE_THREADS };
+static const char* engineNames[] = { "iocp", "threads" };
+
+// Filled by the reader thread, read by the main thread once the reader is stopped
+typedef struct {
+    uint64_t latencies[MUX_BENCH_MAX_SAMPLES];  // Write-to-callback latency in QPC ticks
+    volatile LONG count;
+} mux_samples;
+
+// Producer thread arguments
+typedef struct {
+    HANDLE* pipes;  // Server ends, one per device
+    int deviceCount;
+    uint64_t ticksPerSecond;
+    volatile LONG running;
+} mux_producer;
+
+static mux_samples samples;
+
+// Frames the stand-in devices read into
+static frame_pool pool;
+
+static uint64_t qpc_now(void) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)counter.QuadPart;
+}
+
+/**
+ * Reader callback: the report carries the QPC value taken just before it was written.
+ */
+static void on_bench_report(const mux_device* device, hid_report* report, void* context) {
+    uint64_t now = qpc_now();
+    uint64_t sent;
+
+    (void)device;
+    (void)context;
+    if (report->length < sizeof(sent)) {
+        frame_pool_release(&pool, report);
+        return;
+    }
+    memcpy(&sent, report->data, sizeof(sent));
+    frame_pool_release(&pool, report);
+
+    LONG index = samples.count;
+    if (index < MUX_BENCH_MAX_SAMPLES) {
+        samples.latencies[index] = now - sent;
+        samples.count = index + 1;
+    }
+}
+
+/**
+ * Writes one timestamped report per device per millisecond, spread evenly so the
+ * devices do not all report at the same instant.
+ */
+static DWORD WINAPI producer_thread(LPVOID param) {
+    mux_producer* producer = (mux_producer*)param;
+    uint64_t interval = producer->ticksPerSecond / MUX_BENCH_RATE_HZ / producer->deviceCount;
+    uint64_t next = qpc_now();
+    unsigned char report[MUX_BENCH_REPORT_LENGTH] = { 0 };
+    int device = 0;
+
+    while (producer->running) {
+        // Spin instead of sleeping; the sleep granularity is coarser than the interval
+        while (qpc_now() < next) {
+            YieldProcessor();
+        }
+        next += interval;
+
+        uint64_t stamp = qpc_now();
+        DWORD written;
+        memcpy(report + 1, &stamp, sizeof(stamp));  // report[0] stays 0, an unnumbered report
+        WriteFile(producer->pipes[device], report, sizeof(report), &written, NULL);
+        device = (device + 1) % producer->deviceCount;
+    }
+    return 0;
+}
+
+/**
+ * Creates a message-mode pipe whose client end reads like a HID device handle:
+ * overlapped, one report per read.
+ *
+ * @param bench Distinguishes the pipe name between benchmarks.
+ * @param index Distinguishes the pipe name between devices.
+ * @param reportLength Bytes per report written to the pipe.
+ * @param server Receives the write end.
+ * @param client Receives the read end, for hid_mux_add_handle.
+ * @return true on success.
+ */
+bool create_device_pipe(const char* bench, int index, DWORD reportLength, HANDLE* server, HANDLE* client) {
+    char name[64];
+    snprintf(name, sizeof(name), "\\\\.\\pipe\\RawHidBench-%s-%lu-%d", bench, GetCurrentProcessId(), index);
+
+    *server = CreateNamedPipeA(name, PIPE_ACCESS_OUTBOUND, PIPE_TYPE_MESSAGE | PIPE_WAIT, 1,
+        reportLength * 512, 0, 0, NULL);
+    if (*server == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    *client = CreateFileA(name, GENERIC_READ | FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    if (*client == INVALID_HANDLE_VALUE || !SetNamedPipeHandleState(*client, &mode, NULL, NULL)) {
+        if (*client != INVALID_HANDLE_VALUE) {
+            CloseHandle(*client);
+        }
+        CloseHandle(*server);
+        return false;
+    }
+    return true;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Runs deviceCount stand-in devices through one multiplexer and prints latency
+ * percentiles and the system calls the multiplexer made per report.
+ *
+ * @return true if the run completed.
+ */
+static bool run_devices(hid_mux_engine engine, int deviceCount, uint64_t ticksPerSecond) {
+    HANDLE servers[HID_MUX_MAX_DEVICES];
+    hid_mux mux;
+    mux_producer producer = { servers, deviceCount, ticksPerSecond, 1 };
+    int created = 0;
+    bool ok = false;
+
+    samples.count = 0;
+    if (!start_hid_mux(&mux, engine, &pool, on_bench_report, NULL, NULL)) {
+        return false;
+    }
+
+    for (; created < deviceCount; created++) {
+        HANDLE client;
+        if (!create_device_pipe("mux", created, MUX_BENCH_REPORT_LENGTH, &servers[created], &client)) {
+            break;
+        }
+        if (hid_mux_add_handle(&mux, client, (uint16_t)created, MUX_BENCH_REPORT_LENGTH, 0) < 0) {
+            CloseHandle(servers[created]);
+            break;
+        }
+    }
+
+    if (created == deviceCount) {
+        HANDLE thread = CreateThread(NULL, 0, producer_thread, &producer, 0, NULL);
+        if (thread) {
+            // Keep the producer off the core the main thread is pinned to
+            SetThreadAffinityMask(thread, 2);
+            Sleep(MUX_BENCH_SECONDS * 1000);
+            producer.running = 0;
+            WaitForSingleObject(thread, INFINITE);
+            CloseHandle(thread);
+            Sleep(100);  // Let the reader drain what is still in the pipes
+            ok = true;
+        }
+    }
+
+    stop_hid_mux(&mux);
+    double syscalls = mux.reports > 0 ? (double)(mux.waits + mux.readsIssued) / (double)mux.reports : 0.0;
+    for (int i = 0; i < created; i++) {
+        CloseHandle(servers[i]);
+    }
+
+    if (!ok || samples.count == 0) {
+        printf("%-8s %7d  setup failed (error %lu)\n", engineNames[engine], deviceCount, GetLastError());
+        return false;
+    }
+
+    qsort(samples.latencies, samples.count, sizeof(samples.latencies[0]), compare_u64);
+    double usPerTick = 1e6 / (double)ticksPerSecond;
+    LONG n = samples.count;
+    printf("%-8s %7d  %8ld  %8.2f  %8.1f  %8.1f  %8.1f  %8.1f\n", engineNames[engine], deviceCount, n, syscalls,
+        samples.latencies[n / 2] * usPerTick,
+        samples.latencies[(LONG)(n * 0.99)] * usPerTick,
+        samples.latencies[(LONG)(n * 0.999)] * usPerTick,
+        samples.latencies[n - 1] * usPerTick);
+    return true;
+}
+
+/**
+ * Measures how report latency through the multiplexer scales with the number of
+ * devices, for the completion port engine and the thread-per-device engine. Named pipes
+ * stand in for the devices so no hardware is needed; each one reports at 1 kHz and
+ * every report carries its send time.
+ *
+ * Usage: RawHidBench mux
+ */
+int bench_mux(int argc, char** argv) {
+    LARGE_INTEGER frequency;
+
+    (void)argc;
+    (void)argv;
+
+    // The multiplexer logs; keep it quiet and out of the console during the runs
+    init_logger_async("RawHidBench.log", 1000);
+    set_log_level(LOGLEVEL_WARN);
+
+    QueryPerformanceFrequency(&frequency);
+    if (!init_frame_pool(&pool, FRAME_POOL_SIZE)) {
+        close_logger();
+        return 1;
+    }
+
+    printf("engine   devices   reports  syscalls   p50 us    p99 us  p99.9 us    max us\n");
+    int result = 0;
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        for (size_t i = 0; i < sizeof(deviceCounts) / sizeof(deviceCounts[0]); i++) {
+            if (!run_devices(engines[e], deviceCounts[i], (uint64_t)frequency.QuadPart)) {
+                result = 1;
+            }
+        }
+    }
+
+    destroy_frame_pool(&pool);
+    close_logger();
+    return result;
+}
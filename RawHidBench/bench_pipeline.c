@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "bench.h"
+#include "hid_mux.h"
+#include "frame_pool.h"
+#include "report_ring.h"
+#include "forwarder.h"
+#include "udp_client.h"
+#include "frame_decoder.h"
+#include "histogram.h"
+#include "stage_latency.h"
+#include "timing.h"
+#include "logger.h"
+#include "config.h"
+
+// Defaults: four keyboards at the full-speed polling rate, one report per poll, for five seconds
+#define PIPELINE_DEFAULT_DEVICES 4
+#define PIPELINE_DEFAULT_RATE_HZ 1000
+#define PIPELINE_DEFAULT_BURST 1
+#define PIPELINE_DEFAULT_SECONDS 5
+
+// Input report length of the stand-in devices: report ID plus 64 bytes, like QMK raw HID
+#define PIPELINE_REPORT_LENGTH 65
+
+// How long the pipeline gets to drain after the last report is injected
+#define PIPELINE_DRAIN_MS 500
+
+// Producer thread settings
+typedef struct {
+    HANDLE* pipes;          // Server ends, one per device
+    int deviceCount;
+    int rateHz;             // Reports per second per device
+    int burst;              // Reports written back to back per tick
+    uint64_t durationNs;    // How long to inject for
+    volatile LONG64 injected;
+} pipeline_producer;
+
+// What the loopback sink measured
+typedef struct {
+    SOCKET listener;                             // Accepts the forwarder's connection
+    SOCKET datagrams;                            // Receives the forwarder's datagrams instead, over UDP
+    frame_decoder decoder;
+    datagram_tracker tracker;                    // Datagram loss and reordering, over UDP
+    histogram endToEnd;                          // Injection to arrival at the sink, ns
+    histogram readToWire;                        // Read by the multiplexer to arrival at the sink, ns
+    uint32_t nextSequence[HID_MUX_MAX_DEVICES];  // Expected sequence per device, indexed by device id
+    bool seen[HID_MUX_MAX_DEVICES];              // Whether a device has sent anything yet
+    uint64_t gaps;                               // Reports missing from the sequences
+    uint64_t firstNs;                            // Arrival of the first frame
+    uint64_t lastNs;                             // Arrival of the latest frame
+} pipeline_sink;
+
+// State the report handler needs, as main.c's forward_context
+typedef struct {
+    report_ring* ring;
+    frame_pool* pool;
+    uint32_t nextSequence[HID_MUX_MAX_DEVICES];
+} pipeline_context;
+
+// Large enough to be allocated once rather than on a thread stack
+static report_ring ring;
+static frame_pool pool;
+static pipeline_sink sink;
+static stage_latency stages;
+
+/**
+ * Does what main.c's on_report does for a report that is not a pong: queue it for the
+ * forwarder and time the handler.
+ */
+static void on_pipeline_report(const mux_device* device, hid_report* report, void* context) {
+    pipeline_context* pipeline = (pipeline_context*)context;
+
+    if (report->length > REPORT_SIZE_BYTES) {
+        report->length = REPORT_SIZE_BYTES;
+    }
+    report->sequence = pipeline->nextSequence[device->slot]++;
+
+    uint64_t readNs = report->timestamp;
+    uint64_t queuedNs = monotonic_ns();
+    report->queuedNs = queuedNs;
+    hid_report* evicted;
+    if (report_ring_push(pipeline->ring, report, &evicted)) {
+        stage_latency_record(&stages, STAGE_READ_TO_QUEUE, readNs, queuedNs);
+    }
+    else {
+        frame_pool_release(pipeline->pool, report);
+    }
+    frame_pool_release(pipeline->pool, evicted);
+}
+
+/**
+ * Called by the decoder for every frame that reaches the sink. The first payload bytes
+ * carry the monotonic_ns at which the report was injected.
+ */
+static void on_sink_frame(const wire_frame* frame, void* context) {
+    pipeline_sink* sink = (pipeline_sink*)context;
+    uint64_t now = monotonic_ns();
+    uint64_t injected;
+
+    if (sink->firstNs == 0) {
+        sink->firstNs = now;
+    }
+    sink->lastNs = now;
+
+    if (frame->payload_length >= sizeof(injected)) {
+        memcpy(&injected, frame->payload, sizeof(injected));
+        histogram_record(&sink->endToEnd, now - injected);
+    }
+    histogram_record(&sink->readToWire, now - frame->timestamp_ns);
+
+    // The benchmark numbers its devices 0..n-1, so the id indexes directly. A frame
+    // behind the expected sequence came in a reordered datagram and fills no gap here.
+    if (frame->device_id < HID_MUX_MAX_DEVICES) {
+        int32_t ahead = (int32_t)(frame->sequence - sink->nextSequence[frame->device_id]);
+        if (!sink->seen[frame->device_id] || ahead >= 0) {
+            if (sink->seen[frame->device_id]) {
+                sink->gaps += (uint64_t)ahead;
+            }
+            sink->seen[frame->device_id] = true;
+            sink->nextSequence[frame->device_id] = frame->sequence + 1;
+        }
+    }
+}
+
+/**
+ * Sink thread: accepts the forwarder's connection and decodes frames until it closes.
+ */
+static DWORD WINAPI sink_thread(LPVOID param) {
+    pipeline_sink* sink = (pipeline_sink*)param;
+    uint8_t buffer[64 * 1024];
+
+    SOCKET connection = accept(sink->listener, NULL, NULL);
+    if (connection == INVALID_SOCKET) {
+        return 1;
+    }
+
+    int received;
+    while ((received = recv(connection, (char*)buffer, sizeof(buffer), 0)) > 0) {
+        frame_decoder_feed(&sink->decoder, buffer, (size_t)received, on_sink_frame, sink);
+    }
+    closesocket(connection);
+    return 0;
+}
+
+/**
+ * Sink thread over UDP: receives datagrams until the socket is closed.
+ */
+static DWORD WINAPI udp_sink_thread(LPVOID param) {
+    pipeline_sink* sink = (pipeline_sink*)param;
+    uint8_t buffer[DATAGRAM_MAX_SIZE];
+
+    int received;
+    while ((received = recv(sink->datagrams, (char*)buffer, sizeof(buffer), 0)) != SOCKET_ERROR) {
+        datagram_tracker_feed(&sink->tracker, buffer, (size_t)received, on_sink_frame, sink);
+    }
+    return 0;
+}
+
+/**
+ * Writes timestamped reports round-robin across the devices. Every tick one device gets
+ * a burst of reports back to back; ticks are spaced so each device averages rateHz.
+ */
+static DWORD WINAPI producer_thread(LPVOID param) {
+    pipeline_producer* producer = (pipeline_producer*)param;
+    uint64_t interval = 1000000000ULL * producer->burst / producer->rateHz / producer->deviceCount;
+    uint64_t start = monotonic_ns();
+    uint64_t next = start;
+    unsigned char report[PIPELINE_REPORT_LENGTH] = { 0 };
+    int device = 0;
+
+    while (next - start < producer->durationNs) {
+        // Spin instead of sleeping; the sleep granularity is coarser than the interval
+        while (monotonic_ns() < next) {
+            YieldProcessor();
+        }
+        next += interval;
+
+        for (int i = 0; i < producer->burst; i++) {
+            uint64_t stamp = monotonic_ns();
+            DWORD written;
+            memcpy(report + 1, &stamp, sizeof(stamp));  // report[0] stays 0, an unnumbered report
+            if (WriteFile(producer->pipes[device], report, sizeof(report), &written, NULL)) {
+                producer->injected++;
+            }
+        }
+        device = (device + 1) % producer->deviceCount;
+    }
+    return 0;
+}
+
+/**
+ * Listens on an ephemeral loopback port for the forwarder to connect to.
+ *
+ * @return The port, or 0 on failure.
+ */
+static uint16_t start_sink_listener(pipeline_sink* sink) {
+    struct sockaddr_in addr = { 0 };
+    int addrLength = sizeof(addr);
+
+    sink->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (sink->listener == INVALID_SOCKET) {
+        return 0;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(sink->listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(sink->listener, 1) == SOCKET_ERROR ||
+        getsockname(sink->listener, (struct sockaddr*)&addr, &addrLength) == SOCKET_ERROR) {
+        closesocket(sink->listener);
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+/**
+ * Binds an ephemeral loopback UDP port for the forwarder to send to.
+ *
+ * @return The port, or 0 on failure.
+ */
+static uint16_t start_udp_sink(pipeline_sink* sink) {
+    tcp_socket_info local = { "127.0.0.1", 0 };
+    struct sockaddr_in addr = { 0 };
+    int addrLength = sizeof(addr);
+
+    sink->datagrams = init_udp_receiver(&local, NULL);
+    if (sink->datagrams == INVALID_SOCKET) {
+        return 0;
+    }
+
+    // Room for bursts, so the socket buffer is not what loses datagrams
+    int size = 4 * 1024 * 1024;
+    setsockopt(sink->datagrams, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+    if (getsockname(sink->datagrams, (struct sockaddr*)&addr, &addrLength) == SOCKET_ERROR) {
+        cleanup_client(sink->datagrams);
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+static void print_percentiles(const char* name, const histogram* hist) {
+    printf("%-14s %9.1f %9.1f %9.1f %9.1f\n", name,
+        histogram_percentile(hist, 50.0) / 1000.0,
+        histogram_percentile(hist, 99.0) / 1000.0,
+        histogram_percentile(hist, 99.9) / 1000.0,
+        histogram_max(hist) / 1000.0);
+}
+
+/**
+ * Runs the whole driver pipeline on one machine: named pipes stand in for the devices,
+ * the multiplexer reads them into pooled frames, the forwarder sends the frames over
+ * loopback TCP or UDP and a sink thread decodes and timestamps them. Reports how fast
+ * reports got through and how long each took from injection to the wire.
+ *
+ * Usage: RawHidBench pipeline [devices] [rate_hz] [burst] [seconds] [policy] [transport]
+ *   devices  Simulated devices, 1 to 32 (default 4)
+ *   rate_hz  Reports per second per device (default 1000)
+ *   burst    Reports written back to back each time a device reports (default 1)
+ *   seconds  How long to inject for (default 5)
+ *   policy   What a full queue does: drop-newest, drop-oldest, block or coalesce
+ *            (default QUEUE_POLICY from config.h)
+ *            Every injected report is unique, so coalesce behaves as drop-newest here.
+ *   transport  tcp or udp (default tcp); over UDP the sink also counts lost,
+ *              reordered and duplicated datagrams
+ */
+int bench_pipeline(int argc, char** argv) {
+    pipeline_producer producer = { 0 };
+    static pipeline_context context;
+    HANDLE servers[HID_MUX_MAX_DEVICES];
+    hid_mux mux;
+    forwarder sender = { 0 };
+    WSADATA wsaData;
+    int created = 0;
+    int result = 1;
+
+    producer.deviceCount = argc > 0 ? atoi(argv[0]) : PIPELINE_DEFAULT_DEVICES;
+    producer.rateHz = argc > 1 ? atoi(argv[1]) : PIPELINE_DEFAULT_RATE_HZ;
+    producer.burst = argc > 2 ? atoi(argv[2]) : PIPELINE_DEFAULT_BURST;
+    int seconds = argc > 3 ? atoi(argv[3]) : PIPELINE_DEFAULT_SECONDS;
+    int policy = argc > 4 ? -1 : QUEUE_POLICY;
+    for (int i = 0; argc > 4 && i <= RING_POLICY_COALESCE; i++) {
+        if (strcmp(argv[4], report_ring_policy_name((report_ring_policy)i)) == 0) {
+            policy = i;
+        }
+    }
+    bool udp = argc > 5 && strcmp(argv[5], "udp") == 0;
+    if (producer.deviceCount < 1 || producer.deviceCount > HID_MUX_MAX_DEVICES ||
+        producer.rateHz < 1 || producer.burst < 1 || seconds < 1 || policy < 0 ||
+        (argc > 5 && !udp && strcmp(argv[5], "tcp") != 0)) {
+        printf("Usage: RawHidBench pipeline [devices 1-%d] [rate_hz] [burst] [seconds] [drop-newest|drop-oldest|block|coalesce] [tcp|udp]\n",
+            HID_MUX_MAX_DEVICES);
+        return 1;
+    }
+    producer.pipes = servers;
+    producer.durationNs = (uint64_t)seconds * 1000000000ULL;
+
+    // The pipeline logs; keep it quiet and out of the console during the run
+    init_logger_async("RawHidBench.log", 1000);
+    set_log_level(LOGLEVEL_WARN);
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0 || !init_report_ring(&ring, (report_ring_policy)policy)) {
+        printf("setup failed\n");
+        close_logger();
+        return 1;
+    }
+    if (!init_frame_pool(&pool, FRAME_POOL_SIZE)) {
+        printf("setup failed\n");
+        destroy_report_ring(&ring);
+        close_logger();
+        return 1;
+    }
+
+    memset(&sink, 0, sizeof(sink));
+    init_frame_decoder(&sink.decoder);
+    init_datagram_tracker(&sink.tracker);
+    histogram_reset(&sink.endToEnd);
+    histogram_reset(&sink.readToWire);
+    init_stage_latency(&stages);
+    context.ring = &ring;
+    context.pool = &pool;
+
+    uint16_t port = udp ? start_udp_sink(&sink) : start_sink_listener(&sink);
+    HANDLE sinkThread = port ? CreateThread(NULL, 0, udp ? udp_sink_thread : sink_thread, &sink, 0, NULL) : NULL;
+    if (sinkThread && start_hid_mux(&mux, HID_IO_ENGINE, &pool, on_pipeline_report, NULL, &context)) {
+        for (; created < producer.deviceCount; created++) {
+            HANDLE client;
+            if (!create_device_pipe("pipeline", created, PIPELINE_REPORT_LENGTH, &servers[created], &client)) {
+                break;
+            }
+            if (hid_mux_add_handle(&mux, client, (uint16_t)created, PIPELINE_REPORT_LENGTH, 0) < 0) {
+                CloseHandle(servers[created]);
+                break;
+            }
+        }
+
+        // The same sender settings as the driver, pointed at the sink
+        forwarder_config config;
+        config.server.ip = "127.0.0.1";
+        config.server.port = port;
+        config.transport = udp ? SINK_TRANSPORT_UDP : SINK_TRANSPORT_TCP;
+        config.multicastTtl = UDP_MULTICAST_TTL;
+        config.serverSocket = created != producer.deviceCount ? INVALID_SOCKET
+            : udp ? init_udp_client(&config.server, config.multicastTtl) : init_client(&config.server);
+        config.format = WIRE_FORMAT_BINARY;
+        config.flushBytes = SEND_FLUSH_BYTES;
+        config.flushDeadlineUs = SEND_FLUSH_DEADLINE_US;
+        config.latency = &stages;
+
+        if (config.serverSocket != INVALID_SOCKET && start_forwarder(&sender, &ring, &pool, &config)) {
+            HANDLE thread = CreateThread(NULL, 0, producer_thread, &producer, 0, NULL);
+            if (thread) {
+                // Keep the producer off the core the main thread is pinned to
+                SetThreadAffinityMask(thread, 2);
+                WaitForSingleObject(thread, INFINITE);
+                CloseHandle(thread);
+                Sleep(PIPELINE_DRAIN_MS);
+                result = 0;
+            }
+            // Closing the connection ends the sink's receive loop
+            stop_forwarder(&sender);
+        }
+        else if (config.serverSocket != INVALID_SOCKET) {
+            cleanup_client(config.serverSocket);
+        }
+
+        stop_hid_mux(&mux);
+        for (int i = 0; i < created; i++) {
+            CloseHandle(servers[i]);
+        }
+    }
+    if (result != 0) {
+        printf("setup failed (error %lu)\n", GetLastError());
+    }
+
+    if (port && udp) {
+        cleanup_client(sink.datagrams);  // Ends the sink's receive loop
+    }
+    else if (port) {
+        closesocket(sink.listener);  // Releases a sink still waiting in accept
+    }
+    if (sinkThread) {
+        WaitForSingleObject(sinkThread, INFINITE);
+        CloseHandle(sinkThread);
+    }
+
+    if (result == 0) {
+        uint64_t received = histogram_count(&sink.readToWire);
+        double spanSeconds = sink.lastNs > sink.firstNs ? (sink.lastNs - sink.firstNs) / 1e9 : 0.0;
+        printf("devices %d, %d Hz each, bursts of %d, %d s, %s when full, over %s\n",
+            producer.deviceCount, producer.rateHz, producer.burst, seconds, report_ring_policy_name(ring.policy),
+            udp ? "udp" : "tcp");
+        printf("injected %lld, received %llu, sequence gaps %llu, ring drops %lld, evicted %lld, pool exhausted %lld\n",
+            producer.injected, (unsigned long long)received, (unsigned long long)sink.gaps,
+            report_ring_dropped(&ring), report_ring_evicted(&ring), frame_pool_exhausted(&pool));
+        printf("reader blocked %.1f ms\n", report_ring_blocked_ns(&ring) / 1e6);
+        if (udp) {
+            printf("datagrams received %llu, lost %llu, reordered %llu, duplicated %llu, too late %llu\n",
+                (unsigned long long)sink.tracker.received, (unsigned long long)sink.tracker.lost,
+                (unsigned long long)sink.tracker.reordered, (unsigned long long)sink.tracker.duplicates,
+                (unsigned long long)sink.tracker.tooLate);
+        }
+        printf("throughput %.0f reports/s, %.2f frames per send\n",
+            spanSeconds > 0 ? received / spanSeconds : 0.0, forwarder_frames_per_send(&sender));
+        printf("stage            p50 us    p99 us  p99.9 us    max us\n");
+        print_percentiles("inject-to-wire", &sink.endToEnd);
+        print_percentiles("read-to-wire", &sink.readToWire);
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            print_percentiles(stage_latency_name((pipeline_stage)i), &stages.stages[i]);
+        }
+    }
+
+    WSACleanup();
+    destroy_frame_pool(&pool);
+    destroy_report_ring(&ring);
+    close_logger();
+    return result;
+}
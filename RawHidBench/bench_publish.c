@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "bench.h"
+#include "publisher.h"
+#include "frame_pool.h"
+#include "report_ring.h"
+#include "frame_decoder.h"
+#include "histogram.h"
+#include "timing.h"
+#include "logger.h"
+#include "config.h"
+
+// Defaults: a few hundred subscribers to one keyboard at the full-speed polling rate for five seconds
+#define PUBLISH_DEFAULT_CLIENTS 256
+#define PUBLISH_DEFAULT_RATE_HZ 1000
+#define PUBLISH_DEFAULT_SECONDS 5
+
+// Payload of every published report, like QMK raw HID
+#define PUBLISH_REPORT_LENGTH REPORT_SIZE_BYTES
+
+// Receive buffer of the clients that never read, so they fall behind quickly
+#define PUBLISH_SLOW_RCVBUF 4096
+
+// How long the subscribers get to connect, and to drain after the last report
+#define PUBLISH_SETTLE_MS 500
+
+// One subscriber that reads everything it is sent
+typedef struct {
+    frame_decoder decoder;
+    uint32_t nextSequence;  // Sequence expected next
+    bool seen;              // Whether a frame has arrived yet
+    uint64_t gaps;          // Reports missing from the sequence
+} publish_client;
+
+// What the client thread measured
+typedef struct {
+    SOCKET sockets[PUBLISHER_MAX_SUBSCRIBERS];  // Clients that read, then the slow ones
+    WSAPOLLFD pollFds[PUBLISHER_MAX_SUBSCRIBERS];
+    publish_client clients[PUBLISHER_MAX_SUBSCRIBERS];
+    int readers;                                // Clients the thread reads from
+    int connected;                              // Sockets connected, readers and slow clients
+    histogram latency;                          // Publish to arrival, ns, over every client
+    uint64_t delivered;                         // Frames decoded, over every client
+    volatile LONG running;
+} publish_clients;
+
+// Large enough to be allocated once rather than on a thread stack
+static report_ring ring;
+static frame_pool pool;
+static publisher pub;
+static publish_clients clients;
+
+/**
+ * Called by a client's decoder for every frame it receives.
+ */
+static void on_client_frame(const wire_frame* frame, void* context) {
+    publish_client* client = (publish_client*)context;
+
+    histogram_record(&clients.latency, monotonic_ns() - frame->timestamp_ns);
+    clients.delivered++;
+    if (client->seen && frame->sequence != client->nextSequence) {
+        client->gaps += frame->sequence - client->nextSequence;
+    }
+    client->seen = true;
+    client->nextSequence = frame->sequence + 1;
+}
+
+/**
+ * Client thread: one WSAPoll over every reading client, the way a consumer multiplexing
+ * many streams would, decoding whatever arrives.
+ */
+static DWORD WINAPI client_thread(LPVOID param) {
+    publish_clients* state = (publish_clients*)param;
+    uint8_t buffer[16 * 1024];
+
+    for (int i = 0; i < state->readers; i++) {
+        state->pollFds[i].fd = state->sockets[i];
+        state->pollFds[i].events = POLLRDNORM;
+    }
+
+    while (state->running) {
+        if (WSAPoll(state->pollFds, (ULONG)state->readers, 10) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < state->readers; i++) {
+            if (!(state->pollFds[i].revents & (POLLRDNORM | POLLHUP | POLLERR))) {
+                continue;
+            }
+            int received = recv(state->sockets[i], (char*)buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                frame_decoder_feed(&state->clients[i].decoder, buffer, (size_t)received, on_client_frame, &state->clients[i]);
+            }
+            else {
+                state->pollFds[i].fd = INVALID_SOCKET;  // Closed; WSAPoll skips negative descriptors
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Connects one subscriber to the publisher.
+ *
+ * @param slow true for a client that never reads, with a small receive buffer.
+ */
+static SOCKET connect_client(uint16_t port, bool slow) {
+    struct sockaddr_in addr = { 0 };
+    SOCKET socket = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, 0);
+    if (socket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    if (slow) {
+        int size = PUBLISH_SLOW_RCVBUF;
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(socket, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(socket);
+        return INVALID_SOCKET;
+    }
+    return socket;
+}
+
+/**
+ * Publishes reports at rateHz for durationNs. Each report is taken from the pool and
+ * pushed straight onto the publisher's ring, as the HID reader would.
+ *
+ * @return Reports pushed.
+ */
+static uint64_t produce_reports(int rateHz, uint64_t durationNs) {
+    uint64_t interval = 1000000000ULL / rateHz;
+    uint64_t start = monotonic_ns();
+    uint64_t next = start;
+    uint64_t pushed = 0;
+    uint32_t sequence = 0;
+
+    while (next - start < durationNs) {
+        // Spin instead of sleeping; the sleep granularity is coarser than the interval
+        while (monotonic_ns() < next) {
+            YieldProcessor();
+        }
+        next += interval;
+
+        hid_report* report = frame_pool_acquire(&pool);
+        if (!report) {
+            continue;
+        }
+        memset(report->data, 0, PUBLISH_REPORT_LENGTH);
+        report->length = PUBLISH_REPORT_LENGTH;
+        report->device_id = 0;
+        report->sequence = sequence++;
+        report->timestamp = monotonic_ns();
+        report->queuedNs = report->timestamp;
+
+        hid_report* evicted;
+        if (report_ring_push(&ring, report, &evicted)) {
+            pushed++;
+        }
+        else {
+            frame_pool_release(&pool, report);
+        }
+        frame_pool_release(&pool, evicted);
+    }
+    return pushed;
+}
+
+static void print_percentiles(const char* name, const histogram* hist) {
+    printf("%-14s %9.1f %9.1f %9.1f %9.1f\n", name,
+        histogram_percentile(hist, 50.0) / 1000.0,
+        histogram_percentile(hist, 99.0) / 1000.0,
+        histogram_percentile(hist, 99.9) / 1000.0,
+        histogram_max(hist) / 1000.0);
+}
+
+/**
+ * Fans one report stream out to many loopback subscribers through the publisher and
+ * measures what each of them sees: delivery latency from the moment a report is
+ * published, frames delivered and sequence gaps. Slow subscribers never read; the
+ * publisher should cut them off without the others noticing.
+ *
+ * Usage: RawHidBench publish [clients] [rate_hz] [seconds] [slow]
+ *   clients  Subscribers that read everything, 1 to 1024 (default 256)
+ *   rate_hz  Reports published per second (default 1000)
+ *   seconds  How long to publish for (default 5)
+ *   slow     Additional subscribers that never read (default 0)
+ */
+int bench_publish(int argc, char** argv) {
+    tcp_socket_info address = { "127.0.0.1", 0 };
+    WSADATA wsaData;
+    int result = 1;
+
+    int readers = argc > 0 ? atoi(argv[0]) : PUBLISH_DEFAULT_CLIENTS;
+    int rateHz = argc > 1 ? atoi(argv[1]) : PUBLISH_DEFAULT_RATE_HZ;
+    int seconds = argc > 2 ? atoi(argv[2]) : PUBLISH_DEFAULT_SECONDS;
+    int slow = argc > 3 ? atoi(argv[3]) : 0;
+    if (readers < 1 || slow < 0 || readers + slow > PUBLISHER_MAX_SUBSCRIBERS || rateHz < 1 || seconds < 1) {
+        printf("Usage: RawHidBench publish [clients] [rate_hz] [seconds] [slow], at most %d clients in all\n",
+            PUBLISHER_MAX_SUBSCRIBERS);
+        return 1;
+    }
+
+    // The publisher logs; keep it quiet and out of the console during the run
+    init_logger_async("RawHidBench.log", 1000);
+    set_log_level(LOGLEVEL_ERROR);
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0 || !init_report_ring(&ring, RING_POLICY_DROP_NEWEST)) {
+        printf("setup failed\n");
+        close_logger();
+        return 1;
+    }
+    if (!init_frame_pool(&pool, FRAME_POOL_SIZE)) {
+        printf("setup failed\n");
+        destroy_report_ring(&ring);
+        close_logger();
+        return 1;
+    }
+
+    memset(&clients, 0, sizeof(clients));
+    histogram_reset(&clients.latency);
+    clients.readers = readers;
+    clients.running = 1;
+    for (int i = 0; i < readers; i++) {
+        init_frame_decoder(&clients.clients[i].decoder);
+    }
+
+    uint64_t pushed = 0;
+    HANDLE thread = NULL;
+    if (start_publisher(&pub, &ring, &pool, WIRE_FORMAT_BINARY, &address)) {
+        for (; clients.connected < readers + slow; clients.connected++) {
+            SOCKET socket = connect_client(pub.port, clients.connected >= readers);
+            if (socket == INVALID_SOCKET) {
+                break;
+            }
+            clients.sockets[clients.connected] = socket;
+        }
+
+        thread = clients.connected == readers + slow ? CreateThread(NULL, 0, client_thread, &clients, 0, NULL) : NULL;
+        if (thread) {
+            // Give the publisher time to accept everyone before the first report
+            Sleep(PUBLISH_SETTLE_MS);
+            LONG subscribed = ReadNoFence(&pub.subscriberCount);
+            pushed = produce_reports(rateHz, (uint64_t)seconds * 1000000000ULL);
+            Sleep(PUBLISH_SETTLE_MS);
+            clients.running = 0;
+            WaitForSingleObject(thread, INFINITE);
+            CloseHandle(thread);
+
+            uint64_t gaps = 0;
+            for (int i = 0; i < readers; i++) {
+                gaps += clients.clients[i].gaps;
+            }
+            uint64_t expected = pushed * (uint64_t)readers;
+            printf("%d clients (%d slow), %ld subscribed, %d Hz, %d s\n", readers + slow, slow, subscribed, rateHz, seconds);
+            printf("published %llu, delivered %llu of %llu, sequence gaps %llu, cut off %lld, ring drops %lld, pool exhausted %lld\n",
+                (unsigned long long)pushed, (unsigned long long)clients.delivered, (unsigned long long)expected,
+                (unsigned long long)gaps, ReadNoFence64(&pub.cutOff), report_ring_dropped(&ring), frame_pool_exhausted(&pool));
+            printf("stage            p50 us    p99 us  p99.9 us    max us\n");
+            print_percentiles("to-subscriber", &clients.latency);
+            result = 0;
+        }
+        stop_publisher(&pub);
+    }
+    if (result != 0) {
+        printf("setup failed (error %lu)\n", GetLastError());
+    }
+
+    for (int i = 0; i < clients.connected; i++) {
+        closesocket(clients.sockets[i]);
+    }
+
+    WSACleanup();
+    destroy_frame_pool(&pool);
+    destroy_report_ring(&ring);
+    close_logger();
+    return result;
+}
@@ -0,0 +1,213 @@
+#include "capture.h"
+#include <string.h>
+#include "logger.h"
+#include "timing.h"
+
+/**
+ * Waits for the write in flight, if any.
+ *
+ * @return false if it failed.
+ */
+static bool finish_write(capture_writer* capture) {
+    DWORD written;
+
+    if (!capture->writing) {
+        return true;
+    }
+    capture->writing = false;
+    if (!GetOverlappedResult(capture->file, &capture->overlapped, &written, TRUE)) {
+        write_log_format(LOGLEVEL_ERROR, "Capture - Write failed. Error Code: %lu", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Starts writing the current buffer and switches to the other one. Waits first if the
+ * other buffer is still being written.
+ */
+static void flush_buffer(capture_writer* capture) {
+    if (capture->used == 0 || !finish_write(capture)) {
+        capture->used = 0;
+        return;
+    }
+
+    memset(&capture->overlapped, 0, sizeof(capture->overlapped));
+    capture->overlapped.Offset = (DWORD)capture->fileOffset;
+    capture->overlapped.OffsetHigh = (DWORD)(capture->fileOffset >> 32);
+    capture->overlapped.hEvent = capture->writeEvent;
+
+    if (!WriteFile(capture->file, capture->buffers[capture->current], capture->used, NULL, &capture->overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        write_log_format(LOGLEVEL_ERROR, "Capture - Write failed. Error Code: %lu", GetLastError());
+    }
+    else {
+        capture->writing = true;
+    }
+
+    capture->fileOffset += capture->used;
+    capture->current ^= 1;
+    capture->used = 0;
+}
+
+/**
+ * Creates a capture file, replacing any file at that path.
+ *
+ * @param capture Pointer to the capture_writer struct to initialize.
+ * @param path Where to write the capture.
+ * @return true on success.
+ */
+bool open_capture(capture_writer* capture, const char* path) {
+    memset(capture, 0, sizeof(*capture));
+
+    capture->file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+    if (capture->file == INVALID_HANDLE_VALUE) {
+        write_log_format(LOGLEVEL_ERROR, "Capture - Failed to create %s. Error Code: %lu", path, GetLastError());
+        return false;
+    }
+    capture->writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (capture->writeEvent == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Capture - Failed to create write event. Error Code: %lu", GetLastError());
+        CloseHandle(capture->file);
+        capture->file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    // The start time anchors the first record's delta
+    capture->previousNs = monotonic_ns();
+
+    memcpy(capture->buffers[0], CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+    memcpy(capture->buffers[0] + CAPTURE_MAGIC_SIZE, &capture->previousNs, sizeof(capture->previousNs));
+    capture->used = CAPTURE_HEADER_SIZE;
+
+    write_log_format(LOGLEVEL_INFO, "Capture - Recording reports to %s", path);
+    return true;
+}
+
+/**
+ * Appends a report to the capture. Reports longer than CAPTURE_MAX_REPORT are truncated.
+ *
+ * @param capture The capture.
+ * @param deviceId The device the report came from.
+ * @param timestampNs monotonic_ns when the report was read.
+ * @param data The report bytes.
+ * @param length The number of bytes.
+ */
+void capture_report(capture_writer* capture, uint16_t deviceId, uint64_t timestampNs, const unsigned char* data, int length) {
+    if (length > CAPTURE_MAX_REPORT) {
+        length = CAPTURE_MAX_REPORT;
+    }
+    if (capture->used + 10 + 3 + length > CAPTURE_BUFFER_BYTES) {
+        flush_buffer(capture);
+    }
+
+    unsigned char* out = capture->buffers[capture->current] + capture->used;
+    uint64_t delta = timestampNs > capture->previousNs ? timestampNs - capture->previousNs : 0;
+    capture->previousNs = timestampNs;
+
+    do {
+        *out++ = (unsigned char)((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+        delta >>= 7;
+    } while (delta != 0);
+
+    memcpy(out, &deviceId, sizeof(deviceId));
+    out += sizeof(deviceId);
+    *out++ = (unsigned char)length;
+    memcpy(out, data, length);
+    out += length;
+
+    capture->used = (DWORD)(out - capture->buffers[capture->current]);
+    capture->records++;
+}
+
+/**
+ * Writes what is still buffered and closes the capture file.
+ */
+void close_capture(capture_writer* capture) {
+    if (!capture->file || capture->file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    flush_buffer(capture);
+    finish_write(capture);
+    CloseHandle(capture->writeEvent);
+    CloseHandle(capture->file);
+    capture->file = INVALID_HANDLE_VALUE;
+
+    write_log_format(LOGLEVEL_INFO, "Capture - Recorded %llu reports, %llu bytes",
+        (unsigned long long)capture->records, (unsigned long long)capture->fileOffset);
+}
+
+/**
+ * Opens a capture file for reading and checks its header.
+ *
+ * @param reader Pointer to the capture_reader struct to initialize.
+ * @param path The capture file.
+ * @return true if the file is a capture.
+ */
+bool open_capture_reader(capture_reader* reader, const char* path) {
+    unsigned char header[CAPTURE_HEADER_SIZE];
+
+    memset(reader, 0, sizeof(*reader));
+    if (fopen_s(&reader->file, path, "rb") != 0 || !reader->file) {
+        write_log_format(LOGLEVEL_ERROR, "Capture - Failed to open %s", path);
+        return false;
+    }
+
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+        memcmp(header, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0) {
+        write_log_format(LOGLEVEL_ERROR, "Capture - %s is not a capture file", path);
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
+    }
+    memcpy(&reader->startNs, header + CAPTURE_MAGIC_SIZE, sizeof(reader->startNs));
+    return true;
+}
+
+/**
+ * Reads the next report.
+ *
+ * @param reader The reader.
+ * @param record Receives the report.
+ * @return true if a report was read, false at the end of the file or if it is truncated.
+ */
+bool capture_read_next(capture_reader* reader, capture_record* record) {
+    uint64_t delta = 0;
+    int c;
+
+    for (int shift = 0; ; shift += 7) {
+        if (shift > 63 || (c = fgetc(reader->file)) == EOF) {
+            return false;
+        }
+        delta |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+    }
+
+    unsigned char fixed[3];
+    if (fread(fixed, 1, sizeof(fixed), reader->file) != sizeof(fixed)) {
+        return false;
+    }
+    memcpy(&record->deviceId, fixed, sizeof(record->deviceId));
+    record->length = fixed[2];
+    if (fread(record->data, 1, record->length, reader->file) != record->length) {
+        return false;
+    }
+
+    reader->timestampNs += delta;
+    record->timestampNs = reader->timestampNs;
+    return true;
+}
+
+/**
+ * Closes a capture file opened for reading.
+ */
+void close_capture_reader(capture_reader* reader) {
+    if (reader->file) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Capture file layout. All integers are little-endian.
+//
+//   header  8 bytes   CAPTURE_MAGIC
+//           8 bytes   monotonic_ns when the capture started
+//   record  1-10      nanoseconds since the previous record (or the start), LEB128
+//           2         device id
+//           1         n, the report length
+//           n         report bytes, with report ID 0 stripped as hid_read does
+//
+// A keyboard report at 1 kHz costs about 4 bytes of framing on top of its payload.
+#define CAPTURE_MAGIC "RHCAP01\n"
+#define CAPTURE_MAGIC_SIZE 8
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_MAX_REPORT 255
+
+// Records are collected in one buffer while the other is being written
+#define CAPTURE_BUFFER_BYTES (64 * 1024)
+
+// Writes every report to a capture file. Reports are appended to a memory buffer; a full
+// buffer is written with overlapped I/O while the next one fills, so the reader thread
+// only waits on the disk if it falls a whole buffer behind. Single writer thread.
+typedef struct {
+    HANDLE file;                                           // Opened for overlapped writes
+    HANDLE writeEvent;                                     // Completes the write in flight
+    OVERLAPPED overlapped;                                 // Write in flight
+    bool writing;                                          // A write is in flight
+    unsigned char buffers[2][CAPTURE_BUFFER_BYTES];        // Filling and being written
+    int current;                                           // Buffer being filled
+    DWORD used;                                            // Bytes in the current buffer
+    uint64_t fileOffset;                                   // Where the next write goes
+    uint64_t previousNs;                                   // Timestamp of the previous record
+    uint64_t records;                                      // Reports captured
+} capture_writer;
+
+// One report read back from a capture file
+typedef struct {
+    uint64_t timestampNs;                      // Nanoseconds since the capture started
+    uint16_t deviceId;                         // Device the report came from
+    uint8_t length;                            // Bytes in data
+    unsigned char data[CAPTURE_MAX_REPORT];    // Report bytes
+} capture_record;
+
+// Reads a capture file front to back
+typedef struct {
+    FILE* file;
+    uint64_t timestampNs;  // Timestamp of the previous record
+    uint64_t startNs;      // monotonic_ns when the capture started
+} capture_reader;
+
+// Function prototypes
+bool open_capture(capture_writer* capture, const char* path);
+void capture_report(capture_writer* capture, uint16_t deviceId, uint64_t timestampNs, const unsigned char* data, int length);
+void close_capture(capture_writer* capture);
+bool open_capture_reader(capture_reader* reader, const char* path);
+bool capture_read_next(capture_reader* reader, capture_record* record);
+void close_capture_reader(capture_reader* reader);
@@ -7,4 +7,81 @@
 #define SERVER_IP "10.6.220.21"
 #define SERVER_PORT 4000
 
+// Servers every report is sent to; the first is the primary, which also sends commands.
+// Each gets a queue and a sender thread of its own, so a slow or unreachable one only
+// drops from its own queue. Up to FORWARDER_MAX_SINKS, e.g. to add an analytics consumer:
+// { { SERVER_IP, SERVER_PORT }, { "10.6.220.22", 4001 } }
+#define SINK_SERVERS { { SERVER_IP, SERVER_PORT } }
+
+// With PUBLISH_PORT set, local tools can also connect to PUBLISH_IP:PUBLISH_PORT and receive
+// the frames the servers get. Each subscriber has its own send queue and is cut off once it
+// falls PUBLISHER_SUBSCRIBER_BUFFER_BYTES behind. 0 turns publishing off.
+#define PUBLISH_IP "127.0.0.1"
+#define PUBLISH_PORT 0
+
+// With UDP_SERVER_PORT set, every report is also sent to UDP_SERVER_IP:UDP_SERVER_PORT as UDP
+// datagrams with sequence numbers (see wire_format.h). Nothing is resent, so a lost datagram
+// never delays the next; for consumers that only want the latest state. A multicast group
+// address, e.g. "239.255.0.1", reaches every receiver that joins it, crossing at most
+// UDP_MULTICAST_TTL routers. Needs WIRE_FORMAT_BINARY. 0 turns the UDP sink off.
+#define UDP_SERVER_IP "127.0.0.1"
+#define UDP_SERVER_PORT 0
+#define UDP_MULTICAST_TTL 1
+
+// WIRE_FORMAT_BINARY sends full length-prefixed frames; WIRE_FORMAT_HEX is the legacy text format
+#define WIRE_FORMAT WIRE_FORMAT_BINARY
+
+// Send coalescing: queued reports are gathered into one send call that is flushed once it
+// holds SEND_FLUSH_BYTES or its oldest report is SEND_FLUSH_DEADLINE_US old, whichever is first.
+// A deadline of 0 sends whatever has queued up as soon as the queue runs dry.
+#define SEND_FLUSH_BYTES 1400
+#define SEND_FLUSH_DEADLINE_US 200
+
+// What happens to a report when a sink's queue is full (see report_ring_policy):
+// RING_POLICY_DROP_NEWEST keeps latency bounded and loses the newest reports,
+// RING_POLICY_DROP_OLDEST keeps the freshest state, RING_POLICY_BLOCK loses nothing here
+// but stalls reading (and with it every sink) until the slowest sink catches up, and
+// RING_POLICY_COALESCE also skips repeats of a device's previous report while backlogged.
+#define QUEUE_POLICY RING_POLICY_DROP_NEWEST
+
+// Commands from the server are written to a device at most once per DOWNSTREAM_WRITE_INTERVAL_US,
+// the USB polling interval of the keyboard. Commands whose first byte is listed in
+// DOWNSTREAM_STATE_COMMANDS set state (LEDs, layers), so only the newest queued one is written
+// and one identical to what the device was last sent is skipped.
+#define DOWNSTREAM_WRITE_INTERVAL_US 1000
+#define DOWNSTREAM_STATE_COMMANDS { 0x03 }
+
+// LOG_ASYNC hands messages to a background writer thread instead of writing them inline.
+// LOG_FSYNC_INTERVAL_MS bounds how much logged data a power loss can take with it.
+#define LOG_ASYNC 1
+#define LOG_FSYNC_INTERVAL_MS 1000
+
+// HID_MUX_ENGINE_IOCP reads every device from one thread through a completion port.
+// HID_MUX_ENGINE_THREADS gives each device a blocking reader thread, like hidapi; it is
+// kept to compare against (RawHidBench mux) and as a fallback.
+#define HID_IO_ENGINE HID_MUX_ENGINE_IOCP
+
+// Device arrival is normally reported by the configuration manager; set to 1 to poll instead
+#define HOTPLUG_FORCE_POLLING 0
+
+// Metrics are served in the Prometheus text format at http://METRICS_IP:METRICS_PORT/metrics.
+// METRICS_PORT 0 turns the endpoint off.
+#define METRICS_IP "127.0.0.1"
+#define METRICS_PORT 9464
+
+// Paths of devices opened before, tried at startup and on reconnect before enumerating
+#define DEVICE_CACHE_FILE "C:\\Users\\avons\\Code\\C\\RawHidDriver\\RawHidDriver.devices"
+
+// LOG_BINARY writes compact binary records to LOG_BINARY_FILE instead of text to LOG_FILE.
+// Formatting is deferred to RawHidLogDecoder; only warnings and errors reach the console.
+#define LOG_BINARY 0
+#define LOG_BINARY_FILE "C:\\Users\\avons\\Code\\C\\RawHidDriver\\log\\RawHidDriver.rhlog"
+
+// Log rotation: the log is rotated once it reaches LOG_SEGMENT_BYTES, keeping LOG_SEGMENT_COUNT
+// finished segments (<log>.1 is the newest). LOG_SEGMENT_COMPRESS enables NTFS compression
+// of finished segments. LOG_SEGMENT_BYTES 0 appends to a single file without rotating.
+#define LOG_SEGMENT_BYTES (16 * 1024 * 1024)
+#define LOG_SEGMENT_COUNT 8
+#define LOG_SEGMENT_COMPRESS 1
+
 #define LOG_FILE "C:\\Users\\avons\\Code\\C\\RawHidDriver\\log\\RawHidDriver.log"
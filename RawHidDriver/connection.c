@@ -0,0 +1,163 @@
+#include "connection.h"
+#include "logger.h"
+#include "timing.h"
+
+/**
+ * @return A pseudo-random number; only used to spread reconnect attempts.
+ */
+static uint32_t next_jitter(connection* conn) {
+    uint32_t x = conn->jitterState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    conn->jitterState = x;
+    return x;
+}
+
+/**
+ * Initializes a connection.
+ *
+ * @param conn Pointer to the connection struct to initialize.
+ * @param name Name used in log messages.
+ * @param baseDelayMs Delay after the first failed attempt; doubles with each further failure.
+ * @param maxDelayMs Cap on the delay between attempts.
+ * @param up true if the connection starts established, false to attempt immediately.
+ */
+void init_connection(connection* conn, const char* name, DWORD baseDelayMs, DWORD maxDelayMs, bool up) {
+    uint64_t now = monotonic_ns();
+
+    conn->name = name;
+    conn->baseDelayMs = baseDelayMs;
+    conn->maxDelayMs = maxDelayMs;
+    conn->failedAttempts = 0;
+    conn->nextAttemptNs = now;
+    conn->downSinceNs = now;
+    conn->jitterState = (uint32_t)now | 1;  // Differs per process, so restarted peers don't retry in step
+    conn->outages = 0;
+    histogram_reset(&conn->recovery);
+    WriteRelease(&conn->state, up ? CONNECTION_UP : CONNECTION_DOWN);
+}
+
+/**
+ * Reports that a working connection broke. The first reconnect attempt is due at once.
+ *
+ * @param conn The connection.
+ * @param now The current monotonic_ns.
+ */
+void connection_lost(connection* conn, uint64_t now) {
+    if (ReadAcquire(&conn->state) != CONNECTION_UP) {
+        return;
+    }
+    conn->failedAttempts = 0;
+    conn->nextAttemptNs = now;
+    conn->downSinceNs = now;
+    InterlockedIncrement64(&conn->outages);
+    WriteRelease(&conn->state, CONNECTION_DOWN);
+
+    write_log_format(LOGLEVEL_WARN, "%s - Connection lost; reconnecting", conn->name);
+}
+
+/**
+ * Checks whether a reconnect attempt should be made now, and if so moves to
+ * CONNECTION_CONNECTING. Report the outcome with connection_established or
+ * connection_attempt_failed.
+ *
+ * @param conn The connection.
+ * @param now The current monotonic_ns.
+ * @return true if the caller should attempt to reconnect.
+ */
+bool connection_attempt_due(connection* conn, uint64_t now) {
+    if (ReadAcquire(&conn->state) != CONNECTION_DOWN || now < conn->nextAttemptNs) {
+        return false;
+    }
+    WriteRelease(&conn->state, CONNECTION_CONNECTING);
+    return true;
+}
+
+/**
+ * Reports a failed attempt and schedules the next one. The delay doubles with each
+ * failure up to maxDelayMs; the wait is a random point in its upper half, so many
+ * clients that lost the same server don't all come back at the same instant.
+ *
+ * @param conn The connection.
+ * @param now The current monotonic_ns.
+ */
+void connection_attempt_failed(connection* conn, uint64_t now) {
+    uint64_t delayMs = conn->baseDelayMs;
+    for (uint32_t i = 0; i < conn->failedAttempts && delayMs < conn->maxDelayMs; i++) {
+        delayMs *= 2;
+    }
+    if (delayMs > conn->maxDelayMs) {
+        delayMs = conn->maxDelayMs;
+    }
+    uint64_t waitMs = delayMs / 2 + next_jitter(conn) % (delayMs / 2 + 1);
+
+    conn->failedAttempts++;
+    conn->nextAttemptNs = now + waitMs * 1000000ULL;
+    WriteRelease(&conn->state, CONNECTION_DOWN);
+
+    write_log_format(LOGLEVEL_DEBUG, "%s - Reconnect attempt %lu failed; next in %llu ms",
+        conn->name, conn->failedAttempts, (unsigned long long)waitMs);
+}
+
+/**
+ * Reports that the connection works, either after an attempt or because the other
+ * side came back on its own. Records the length of the outage.
+ *
+ * @param conn The connection.
+ * @param now The current monotonic_ns.
+ */
+void connection_established(connection* conn, uint64_t now) {
+    if (ReadAcquire(&conn->state) == CONNECTION_UP) {
+        return;
+    }
+
+    uint64_t outage = now - conn->downSinceNs;
+    WriteRelease(&conn->state, CONNECTION_UP);
+
+    // Only a connection that was up before counts as recovering
+    if (ReadNoFence64(&conn->outages) > 0) {
+        histogram_record(&conn->recovery, outage);
+        write_log_format(LOGLEVEL_INFO, "%s - Connection recovered after %llu ms and %lu failed attempts",
+            conn->name, (unsigned long long)(outage / 1000000), conn->failedAttempts);
+    }
+    else {
+        write_log_format(LOGLEVEL_INFO, "%s - Connected after %lu failed attempts", conn->name, conn->failedAttempts);
+    }
+    conn->failedAttempts = 0;
+}
+
+/**
+ * @return true if the connection is up.
+ */
+bool connection_is_up(connection* conn) {
+    return ReadAcquire(&conn->state) == CONNECTION_UP;
+}
+
+/**
+ * @return Milliseconds until the next attempt is due, 0 if it is due now, INFINITE if
+ *         the connection is up.
+ */
+DWORD connection_wait_ms(connection* conn, uint64_t now) {
+    if (ReadAcquire(&conn->state) == CONNECTION_UP) {
+        return INFINITE;
+    }
+    if (now >= conn->nextAttemptNs) {
+        return 0;
+    }
+    return (DWORD)((conn->nextAttemptNs - now + 999999) / 1000000);
+}
+
+/**
+ * Logs the number of outages and the time-to-recover distribution.
+ *
+ * @param conn The connection.
+ */
+void connection_log_summary(connection* conn) {
+    const histogram* recovery = &conn->recovery;
+    write_log_format(LOGLEVEL_INFO, "%s - %lld outages, %llu recovered; time to recover ms p50 %llu p99 %llu max %llu",
+        conn->name, ReadNoFence64(&conn->outages), (unsigned long long)histogram_count(recovery),
+        (unsigned long long)(histogram_percentile(recovery, 50.0) / 1000000),
+        (unsigned long long)(histogram_percentile(recovery, 99.0) / 1000000),
+        (unsigned long long)(histogram_max(recovery) / 1000000));
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "histogram.h"
+
+typedef enum {
+    CONNECTION_UP = 0,    // Working
+    CONNECTION_DOWN,      // Lost; waiting for the next attempt to come due
+    CONNECTION_CONNECTING // An attempt is in progress
+} connection_state;
+
+// Reconnect state machine for one side of the pipeline (the devices or the server).
+// The owner reports what happens; the connection decides when the next attempt is due,
+// backing off exponentially with jitter, and measures how long each outage lasted.
+// Driven by a single thread; the statistics may be read from any thread.
+typedef struct {
+    const char* name;            // Used in log messages, e.g. "TCP"
+    volatile LONG state;         // connection_state
+    DWORD baseDelayMs;           // Delay before the second attempt; the first is immediate
+    DWORD maxDelayMs;            // Cap on the delay between attempts
+    uint32_t failedAttempts;     // Attempts that failed since the outage began
+    uint64_t nextAttemptNs;      // monotonic_ns when the next attempt is due
+    uint64_t downSinceNs;        // monotonic_ns when the current outage began
+    uint32_t jitterState;        // xorshift state for the jitter
+    histogram recovery;          // Outage durations in ns, from loss to recovery
+    volatile LONG64 outages;     // Outages that began
+} connection;
+
+// Function prototypes
+void init_connection(connection* conn, const char* name, DWORD baseDelayMs, DWORD maxDelayMs, bool up);
+void connection_lost(connection* conn, uint64_t now);
+bool connection_attempt_due(connection* conn, uint64_t now);
+void connection_attempt_failed(connection* conn, uint64_t now);
+void connection_established(connection* conn, uint64_t now);
+bool connection_is_up(connection* conn);
+DWORD connection_wait_ms(connection* conn, uint64_t now);
+void connection_log_summary(connection* conn);
@@ -0,0 +1,185 @@
+#include "device_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest line the cache file holds: four hex fields and a device path
+#define DEVICE_CACHE_LINE 640
+
+static bool same_usage(const hid_usage_info* a, const hid_usage_info* b) {
+    return a->vendor_id == b->vendor_id && a->product_id == b->product_id &&
+        a->usage_page == b->usage_page && a->usage == b->usage;
+}
+
+static int find_entry(device_cache* cache, const hid_usage_info* usage, const char* path) {
+    for (int i = 0; i < cache->count; i++) {
+        if (same_usage(&cache->entries[i].usage, usage) && _stricmp(cache->entries[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Loads the paths saved by an earlier run. A missing or unreadable file leaves the
+ * cache empty but usable; it is created on the first save.
+ *
+ * @param cache The cache to fill.
+ * @param file Path of the cache file.
+ * @return true if the file was read.
+ */
+bool load_device_cache(device_cache* cache, const char* file) {
+    FILE* in = NULL;
+    char line[DEVICE_CACHE_LINE];
+
+    memset(cache, 0, sizeof(*cache));
+    strncpy_s(cache->file, sizeof(cache->file), file, _TRUNCATE);
+
+    if (fopen_s(&in, file, "r") != 0 || !in) {
+        write_log_format(LOGLEVEL_INFO, "Device Cache - No cached paths in %s", file);
+        return false;
+    }
+
+    // Each line is "vendor product usage_page usage path", the numbers in hex
+    while (cache->count < DEVICE_CACHE_MAX_ENTRIES && fgets(line, sizeof(line), in)) {
+        unsigned int vendor, product, usagePage, usage;
+        int pathStart = 0;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || sscanf_s(line, "%x %x %x %x %n", &vendor, &product, &usagePage, &usage, &pathStart) != 4 ||
+            line[pathStart] == '\0') {
+            continue;
+        }
+
+        device_cache_entry* entry = &cache->entries[cache->count];
+        entry->usage.vendor_id = (uint16_t)vendor;
+        entry->usage.product_id = (uint16_t)product;
+        entry->usage.usage_page = (uint16_t)usagePage;
+        entry->usage.usage = (uint8_t)usage;
+        entry->path = _strdup(line + pathStart);
+        if (entry->path) {
+            cache->count++;
+        }
+    }
+    fclose(in);
+
+    write_log_format(LOGLEVEL_INFO, "Device Cache - Loaded %d cached path(s) from %s", cache->count, file);
+    return true;
+}
+
+/**
+ * Lists the cached paths for a usage, most recently remembered last.
+ *
+ * @param cache The cache.
+ * @param usage The vendor, product, usage page and usage to match.
+ * @param paths Receives up to maxPaths paths, owned by the cache.
+ * @param maxPaths The capacity of paths.
+ * @return The number of paths stored.
+ */
+int device_cache_paths(device_cache* cache, const hid_usage_info* usage, const char** paths, int maxPaths) {
+    int count = 0;
+
+    for (int i = 0; i < cache->count && count < maxPaths; i++) {
+        if (same_usage(&cache->entries[i].usage, usage)) {
+            paths[count++] = cache->entries[i].path;
+        }
+    }
+    return count;
+}
+
+/**
+ * Remembers a path that opened. When the cache is full the oldest entry makes room.
+ *
+ * @param cache The cache.
+ * @param usage The usage the path was opened for.
+ * @param path The device path.
+ */
+void device_cache_remember(device_cache* cache, const hid_usage_info* usage, const char* path) {
+    if (find_entry(cache, usage, path) >= 0) {
+        return;
+    }
+
+    char* copy = _strdup(path);
+    if (!copy) {
+        return;
+    }
+    if (cache->count == DEVICE_CACHE_MAX_ENTRIES) {
+        free(cache->entries[0].path);
+        memmove(&cache->entries[0], &cache->entries[1], (DEVICE_CACHE_MAX_ENTRIES - 1) * sizeof(cache->entries[0]));
+        cache->count--;
+    }
+
+    cache->entries[cache->count].usage = *usage;
+    cache->entries[cache->count].path = copy;
+    cache->count++;
+    cache->dirty = true;
+}
+
+/**
+ * Forgets a path that no longer opens, so the next start does not try it again.
+ *
+ * @param cache The cache.
+ * @param usage The usage the path was cached for.
+ * @param path The device path.
+ */
+void device_cache_forget(device_cache* cache, const hid_usage_info* usage, const char* path) {
+    int index = find_entry(cache, usage, path);
+    if (index < 0) {
+        return;
+    }
+
+    free(cache->entries[index].path);
+    memmove(&cache->entries[index], &cache->entries[index + 1], (cache->count - index - 1) * sizeof(cache->entries[0]));
+    cache->count--;
+    cache->dirty = true;
+}
+
+/**
+ * Writes the cache back to its file if it changed. The file is written under a
+ * temporary name and moved into place, so a crash never leaves a truncated cache.
+ *
+ * @param cache The cache.
+ * @return true if the file is up to date.
+ */
+bool save_device_cache(device_cache* cache) {
+    char temp[MAX_PATH + 4];
+    FILE* out = NULL;
+
+    if (!cache->dirty) {
+        return true;
+    }
+
+    snprintf(temp, sizeof(temp), "%s.tmp", cache->file);
+    if (fopen_s(&out, temp, "w") != 0 || !out) {
+        write_log_format(LOGLEVEL_WARN, "Device Cache - Failed to write %s", temp);
+        return false;
+    }
+
+    fprintf(out, "# Device paths cached by RawHidDriver: vendor product usage_page usage path\n");
+    for (int i = 0; i < cache->count; i++) {
+        const device_cache_entry* entry = &cache->entries[i];
+        fprintf(out, "%04x %04x %04x %02x %s\n", entry->usage.vendor_id, entry->usage.product_id,
+            entry->usage.usage_page, entry->usage.usage, entry->path);
+    }
+    bool written = fclose(out) == 0;
+
+    if (!written || !MoveFileExA(temp, cache->file, MOVEFILE_REPLACE_EXISTING)) {
+        write_log_format(LOGLEVEL_WARN, "Device Cache - Failed to replace %s. Error Code: %lu", cache->file, GetLastError());
+        DeleteFileA(temp);
+        return false;
+    }
+
+    cache->dirty = false;
+    write_log_format(LOGLEVEL_DEBUG, "Device Cache - Saved %d path(s) to %s", cache->count, cache->file);
+    return true;
+}
+
+/**
+ * Frees the cached paths. Does not save.
+ */
+void free_device_cache(device_cache* cache) {
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->entries[i].path);
+    }
+    cache->count = 0;
+}
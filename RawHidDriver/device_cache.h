@@ -0,0 +1,34 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "rawhid.h"
+
+// Most paths the cache holds, across every vendor, product and usage it has seen
+#define DEVICE_CACHE_MAX_ENTRIES 64
+
+// One remembered device: the usage it was enumerated for and the path it had
+typedef struct {
+    hid_usage_info usage;  // Vendor, product, usage page and usage the path matched
+    char* path;            // Device path, as returned by hid_enumerate
+} device_cache_entry;
+
+// Device paths resolved on earlier runs, so the next run can open them directly instead
+// of waiting on hid_enumerate. Paths can go stale when a device moves to another port;
+// callers try them first and fall back to enumeration when one fails to open.
+// Used from the main thread only.
+typedef struct {
+    char file[MAX_PATH];                                  // Where the cache is persisted
+    device_cache_entry entries[DEVICE_CACHE_MAX_ENTRIES];
+    int count;                                            // Entries in use
+    bool dirty;                                           // Changed since it was loaded or saved
+} device_cache;
+
+// Function prototypes
+bool load_device_cache(device_cache* cache, const char* file);
+int device_cache_paths(device_cache* cache, const hid_usage_info* usage, const char** paths, int maxPaths);
+void device_cache_remember(device_cache* cache, const hid_usage_info* usage, const char* path);
+void device_cache_forget(device_cache* cache, const hid_usage_info* usage, const char* path);
+bool save_device_cache(device_cache* cache);
+void free_device_cache(device_cache* cache);
@@ -0,0 +1,407 @@
+#include "downstream.h"
+#include "timing.h"
+#include <string.h>
+
+// Passed through the frame decoder to on_server_frame
+typedef struct {
+    downstream* ds;
+    uint64_t receivedNs;
+} frame_context;
+
+/**
+ * Queues a command for one device, or overwrites a queued state command for the same
+ * device. Caller holds queueLock.
+ */
+static bool enqueue_locked(downstream* ds, uint16_t deviceId, const unsigned char* data, int length, uint64_t receivedNs) {
+    if (ds->isStateCommand[data[0]]) {
+        for (int i = 0; i < ds->queueCount; i++) {
+            downstream_command* queued = &ds->queue[(ds->queueHead + i) % DOWNSTREAM_QUEUE_CAPACITY];
+            if (queued->deviceId == deviceId && queued->data[0] == data[0]) {
+                // Only the newest state matters; it keeps the older command's place in line
+                memcpy(queued->data, data, length);
+                queued->length = (uint16_t)length;
+                queued->receivedNs = receivedNs;
+                InterlockedIncrement64(&ds->coalesced);
+                return true;
+            }
+        }
+    }
+
+    if (ds->queueCount == DOWNSTREAM_QUEUE_CAPACITY) {
+        InterlockedIncrement64(&ds->dropped);
+        return false;
+    }
+
+    downstream_command* command = &ds->queue[(ds->queueHead + ds->queueCount) % DOWNSTREAM_QUEUE_CAPACITY];
+    command->receivedNs = receivedNs;
+    command->deviceId = deviceId;
+    command->length = (uint16_t)length;
+    memcpy(command->data, data, length);
+    ds->queueCount++;
+    return true;
+}
+
+/**
+ * Queues a command for the writer thread. Commands addressed to DOWNSTREAM_BROADCAST_ID
+ * are queued once for every open device.
+ *
+ * @param ds The downstream path.
+ * @param deviceId The target device, or DOWNSTREAM_BROADCAST_ID.
+ * @param data The report bytes, without the report ID.
+ * @param length The number of bytes; longer commands are truncated to REPORT_SIZE_BYTES.
+ * @param receivedNs monotonic_ns when the command was read from the server.
+ * @return true if the command was queued for every target, false if the queue was full.
+ */
+bool downstream_enqueue(downstream* ds, uint16_t deviceId, const unsigned char* data, int length, uint64_t receivedNs) {
+    bool queued = true;
+
+    if (length <= 0) {
+        return false;
+    }
+    if (length > REPORT_SIZE_BYTES) {
+        length = REPORT_SIZE_BYTES;
+    }
+
+    AcquireSRWLockExclusive(&ds->queueLock);
+    if (deviceId == DOWNSTREAM_BROADCAST_ID) {
+        for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+            if (ReadAcquire(&ds->mux->devices[i].state) == MUX_DEVICE_OPEN) {
+                InterlockedIncrement64(&ds->received);
+                queued = enqueue_locked(ds, ds->mux->devices[i].deviceId, data, length, receivedNs) && queued;
+            }
+        }
+    }
+    else {
+        InterlockedIncrement64(&ds->received);
+        queued = enqueue_locked(ds, deviceId, data, length, receivedNs);
+    }
+    ReleaseSRWLockExclusive(&ds->queueLock);
+
+    SetEvent(ds->queueEvent);
+    return queued;
+}
+
+/**
+ * Frame decoder callback: queues one binary command frame.
+ */
+static void on_server_frame(const wire_frame* frame, void* context) {
+    frame_context* ctx = (frame_context*)context;
+    downstream_enqueue(ctx->ds, frame->device_id, frame->payload, frame->payload_length, ctx->receivedNs);
+}
+
+/**
+ * Reader thread entry point. Blocks in recv on the forwarder's connection and queues
+ * every decoded command. A failed receive is reported to the forwarder, which
+ * reconnects; the reader then waits for the new connection.
+ *
+ * @param param Pointer to the owning downstream.
+ * @return Always 0.
+ */
+static DWORD WINAPI reader_thread(LPVOID param) {
+    downstream* ds = (downstream*)param;
+    static uint8_t buffer[DOWNSTREAM_RECV_BUFFER_SIZE];
+    frame_decoder decoder;
+    LONG currentGeneration = 0;
+    LONG failedGeneration = 0;
+
+    write_log(LOGLEVEL_DEBUG, "Downstream - Reader thread started");
+
+    while (WaitForSingleObject(ds->stopEvent, 0) == WAIT_TIMEOUT) {
+        LONG generation;
+        SOCKET socket = forwarder_socket(ds->fwd, &generation);
+        if (socket == INVALID_SOCKET || generation == failedGeneration) {
+            WaitForSingleObject(ds->stopEvent, DOWNSTREAM_IDLE_WAIT_MS);
+            continue;
+        }
+        if (generation != currentGeneration) {
+            // A frame cut off by the old connection must not prefix the new one
+            init_frame_decoder(&decoder);
+            currentGeneration = generation;
+        }
+
+        frame_context ctx;
+        ctx.ds = ds;
+        int received;
+        int decoded = 0;
+        if (ds->format == WIRE_FORMAT_HEX) {
+            // Legacy servers send fixed-size messages meant for every device
+            received = read_message_from_server(socket, (char*)buffer);
+            ctx.receivedNs = monotonic_ns();
+            if (received == MESSAGE_SIZE_BYTES) {
+                downstream_enqueue(ds, DOWNSTREAM_BROADCAST_ID, buffer, received, ctx.receivedNs);
+            }
+            else {
+                received = -1;
+            }
+        }
+        else {
+            received = recv(socket, (char*)buffer, sizeof(buffer), 0);
+            ctx.receivedNs = monotonic_ns();
+            if (received > 0) {
+                decoded = frame_decoder_feed(&decoder, buffer, (size_t)received, on_server_frame, &ctx);
+            }
+        }
+
+        if (received <= 0 || decoded == FRAME_INVALID) {
+            if (WaitForSingleObject(ds->stopEvent, 0) == WAIT_TIMEOUT) {
+                write_log_format(LOGLEVEL_WARN, "Downstream - Connection to server lost while reading. Error Code: %d",
+                    received < 0 ? WSAGetLastError() : 0);
+                forwarder_connection_broken(ds->fwd, generation);
+            }
+            failedGeneration = generation;
+        }
+    }
+
+    write_log(LOGLEVEL_DEBUG, "Downstream - Reader thread exiting");
+    return 0;
+}
+
+/**
+ * Returns the pacing state of a device, claiming an entry for it if it has none.
+ * When every entry is taken, the one idle the longest is reused.
+ */
+static downstream_device* pacing_for(downstream* ds, uint16_t deviceId) {
+    downstream_device* oldest = &ds->devices[0];
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        downstream_device* device = &ds->devices[i];
+        if (device->inUse && device->deviceId == deviceId) {
+            return device;
+        }
+        if (!device->inUse || (oldest->inUse && device->nextWriteNs < oldest->nextWriteNs)) {
+            oldest = device;
+        }
+    }
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->inUse = true;
+    oldest->deviceId = deviceId;
+    return oldest;
+}
+
+/**
+ * Takes the oldest queued command whose device may be written to now. Commands for one
+ * device keep their order, because they all wait for the same pacing deadline.
+ *
+ * @param ds The downstream path.
+ * @param now The current monotonic_ns.
+ * @param command Receives the command.
+ * @param nextDue Receives the earliest pacing deadline among the commands left waiting,
+ *                or UINT64_MAX if none.
+ * @return true if a command was taken.
+ */
+static bool take_ready_command(downstream* ds, uint64_t now, downstream_command* command, uint64_t* nextDue) {
+    bool taken = false;
+    *nextDue = UINT64_MAX;
+
+    AcquireSRWLockExclusive(&ds->queueLock);
+    for (int i = 0; i < ds->queueCount; i++) {
+        int index = (ds->queueHead + i) % DOWNSTREAM_QUEUE_CAPACITY;
+        uint64_t due = pacing_for(ds, ds->queue[index].deviceId)->nextWriteNs;
+        if (due > now) {
+            if (due < *nextDue) {
+                *nextDue = due;
+            }
+            continue;
+        }
+
+        *command = ds->queue[index];
+        // Close the gap, keeping the rest of the queue in order
+        for (int j = i; j < ds->queueCount - 1; j++) {
+            ds->queue[(ds->queueHead + j) % DOWNSTREAM_QUEUE_CAPACITY] =
+                ds->queue[(ds->queueHead + j + 1) % DOWNSTREAM_QUEUE_CAPACITY];
+        }
+        ds->queueCount--;
+        taken = true;
+        break;
+    }
+    ReleaseSRWLockExclusive(&ds->queueLock);
+    return taken;
+}
+
+/**
+ * Writes one command to its device, unless it is a state command the device already has.
+ */
+static void write_command(downstream* ds, const downstream_command* command) {
+    downstream_device* device = pacing_for(ds, command->deviceId);
+    bool isState = ds->isStateCommand[command->data[0]];
+
+    // A device closed or reopened since, e.g. unplugged and plugged back in, has lost the
+    // state it was sent, even though it keeps its id
+    LONG generation = hid_mux_generation(ds->mux, command->deviceId);
+    if (generation != device->generation) {
+        device->generation = generation;
+        device->lastLength = 0;
+    }
+
+    if (isState && device->lastLength == command->length &&
+        memcmp(device->lastWritten, command->data, command->length) == 0) {
+        InterlockedIncrement64(&ds->redundant);
+        return;
+    }
+
+    unsigned char report[REPORT_SIZE_BYTES + 1];
+    report[0] = 0x00;  // Report ID; the devices use unnumbered reports
+    memcpy(report + 1, command->data, command->length);
+
+    if (hid_mux_write_id(ds->mux, command->deviceId, report, (size_t)command->length + 1) < 0) {
+        InterlockedIncrement64(&ds->failed);
+        // Whatever state the device had may be gone with it
+        device->lastLength = 0;
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    histogram_record(&ds->latency, now - command->receivedNs);
+    InterlockedIncrement64(&ds->written);
+    device->nextWriteNs = now + ds->writeIntervalNs;
+    if (isState) {
+        memcpy(device->lastWritten, command->data, command->length);
+        device->lastLength = command->length;
+    }
+}
+
+/**
+ * Writer thread entry point. Writes queued commands as their devices' pacing allows and
+ * parks when nothing is ready.
+ *
+ * @param param Pointer to the owning downstream.
+ * @return Always 0.
+ */
+static DWORD WINAPI writer_thread(LPVOID param) {
+    downstream* ds = (downstream*)param;
+    HANDLE waitHandles[3] = { ds->stopEvent, ds->queueEvent, ds->pacingTimer };
+
+    write_log(LOGLEVEL_DEBUG, "Downstream - Writer thread started");
+
+    while (WaitForSingleObject(ds->stopEvent, 0) == WAIT_TIMEOUT) {
+        downstream_command command;
+        uint64_t nextDue;
+        uint64_t now = monotonic_ns();
+
+        if (take_ready_command(ds, now, &command, &nextDue)) {
+            write_command(ds, &command);
+            continue;
+        }
+
+        if (nextDue == UINT64_MAX) {
+            WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE);
+        }
+        else if (arm_deadline_timer(ds->pacingTimer, nextDue)) {
+            // Sleep until just before the command is due unless a new one is queued first
+            WaitForMultipleObjects(3, waitHandles, FALSE, INFINITE);
+        }
+        else {
+            // Closer to the due time than a timer can be trusted with
+            YieldProcessor();
+        }
+    }
+
+    write_log(LOGLEVEL_DEBUG, "Downstream - Writer thread exiting");
+    return 0;
+}
+
+/**
+ * Starts the reader and writer threads of the server-to-device path.
+ *
+ * @param ds Pointer to the downstream struct to initialize.
+ * @param mux The devices to write to.
+ * @param fwd The forwarder whose server connection carries the commands.
+ * @param config The encoding, pacing and coalescing settings to use.
+ * @return true if both threads were started, false otherwise.
+ */
+bool start_downstream(downstream* ds, hid_mux* mux, forwarder* fwd, const downstream_config* config) {
+    // Check for invalid arguments
+    if (!ds || !mux || !fwd || !config) {
+        write_log(LOGLEVEL_ERROR, "Downstream - Invalid arguments");
+        return false;
+    }
+
+    memset(ds, 0, sizeof(*ds));
+    ds->mux = mux;
+    ds->fwd = fwd;
+    ds->format = config->format;
+    ds->writeIntervalNs = (uint64_t)config->writeIntervalUs * 1000;
+    for (int i = 0; i < config->stateCommandCount; i++) {
+        ds->isStateCommand[config->stateCommands[i]] = true;
+    }
+    InitializeSRWLock(&ds->queueLock);
+    histogram_reset(&ds->latency);
+
+    ds->queueEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    ds->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    ds->pacingTimer = create_deadline_timer();
+    if (ds->queueEvent == NULL || ds->stopEvent == NULL || ds->pacingTimer == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Downstream - Failed to create events. Error Code: %lu", GetLastError());
+        stop_downstream(ds);
+        return false;
+    }
+
+    ds->writerThread = CreateThread(NULL, 0, writer_thread, ds, 0, NULL);
+    ds->readerThread = ds->writerThread ? CreateThread(NULL, 0, reader_thread, ds, 0, NULL) : NULL;
+    if (ds->readerThread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Downstream - Failed to create threads. Error Code: %lu", GetLastError());
+        stop_downstream(ds);
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Downstream - Started. At most one write per device every %lu us",
+        config->writeIntervalUs);
+    return true;
+}
+
+/**
+ * Stops both threads and waits for them to exit. Stop the forwarder first: closing the
+ * connection is what releases a reader blocked in recv. Queued commands are discarded.
+ *
+ * @param ds Pointer to the downstream to stop.
+ */
+void stop_downstream(downstream* ds) {
+    if (!ds) {
+        return;
+    }
+
+    if (ds->stopEvent) {
+        SetEvent(ds->stopEvent);
+    }
+    if (ds->readerThread) {
+        WaitForSingleObject(ds->readerThread, INFINITE);
+        CloseHandle(ds->readerThread);
+        ds->readerThread = NULL;
+    }
+    if (ds->writerThread) {
+        WaitForSingleObject(ds->writerThread, INFINITE);
+        CloseHandle(ds->writerThread);
+        ds->writerThread = NULL;
+    }
+    if (ds->queueEvent) {
+        CloseHandle(ds->queueEvent);
+        ds->queueEvent = NULL;
+    }
+    if (ds->stopEvent) {
+        CloseHandle(ds->stopEvent);
+        ds->stopEvent = NULL;
+    }
+    if (ds->pacingTimer) {
+        CloseHandle(ds->pacingTimer);
+        ds->pacingTimer = NULL;
+    }
+}
+
+/**
+ * Logs command counts and the server-to-device latency distribution.
+ *
+ * @param ds The downstream path.
+ */
+void downstream_log_summary(downstream* ds) {
+    const histogram* latency = &ds->latency;
+    write_log_format(LOGLEVEL_INFO,
+        "Downstream - %lld received, %lld written, %lld coalesced, %lld redundant, %lld dropped, %lld failed",
+        ReadNoFence64(&ds->received), ReadNoFence64(&ds->written), ReadNoFence64(&ds->coalesced),
+        ReadNoFence64(&ds->redundant), ReadNoFence64(&ds->dropped), ReadNoFence64(&ds->failed));
+    if (histogram_count(latency) > 0) {
+        write_log_format(LOGLEVEL_INFO, "Downstream - Server to device us p50 %llu p99 %llu max %llu",
+            (unsigned long long)(histogram_percentile(latency, 50.0) / 1000),
+            (unsigned long long)(histogram_percentile(latency, 99.0) / 1000),
+            (unsigned long long)(histogram_max(latency) / 1000));
+    }
+}
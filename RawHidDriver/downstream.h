@@ -0,0 +1,89 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "hid_mux.h"
+#include "forwarder.h"
+#include "frame_decoder.h"
+#include "histogram.h"
+#include "report.h"
+
+// Commands waiting for the HID writer. Server commands are rare next to reports, so a
+// small locked queue is plenty; a full queue drops the newest command.
+#define DOWNSTREAM_QUEUE_CAPACITY 256
+
+// device_id in a server frame that addresses every open device
+#define DOWNSTREAM_BROADCAST_ID 0xFFFF
+
+// Bytes requested per recv call
+#define DOWNSTREAM_RECV_BUFFER_SIZE 4096
+
+// How long the reader waits before looking for a new connection while the server is down
+#define DOWNSTREAM_IDLE_WAIT_MS 100
+
+// Structure to hold the settings the downstream path is started with.
+typedef struct {
+    wire_format_mode format;      // How the server encodes commands, the same as upstream
+    DWORD writeIntervalUs;        // Minimum time between writes to one device, e.g. the USB polling interval
+    const uint8_t* stateCommands; // First bytes of commands that set state, where only the latest matters
+    int stateCommandCount;        // Entries in stateCommands
+} downstream_config;
+
+// A command from the server on its way to one device.
+typedef struct {
+    uint64_t receivedNs;                   // monotonic_ns when the command was read from the socket
+    uint16_t deviceId;                     // Target device
+    uint16_t length;                       // Number of valid bytes in data
+    unsigned char data[REPORT_SIZE_BYTES]; // Report bytes, without the report ID
+} downstream_command;
+
+// Pacing and redundancy state for one device. Only touched by the writer thread.
+typedef struct {
+    bool inUse;                                   // Entry describes a device
+    uint16_t deviceId;                            // The device
+    uint64_t nextWriteNs;                         // Earliest monotonic_ns for the next write
+    LONG generation;                              // Opening of the device lastWritten went to (see hid_mux_generation)
+    uint16_t lastLength;                          // Length of lastWritten
+    unsigned char lastWritten[REPORT_SIZE_BYTES]; // Last state command written, to skip repeats
+} downstream_device;
+
+// Server-to-device path. A reader thread decodes commands from the server connection
+// and queues them; a writer thread writes them to the devices, at most one per device
+// per write interval. A state command (see downstream_config) that is still queued is
+// overwritten by a newer one for the same device, and one that repeats what the device
+// was last sent is skipped.
+typedef struct {
+    hid_mux* mux;                       // Devices to write to
+    forwarder* fwd;                     // Owner of the server connection
+    wire_format_mode format;            // How the server encodes commands
+    uint64_t writeIntervalNs;           // Minimum time between writes to one device
+    bool isStateCommand[256];           // Indexed by the first byte of a command
+
+    SRWLOCK queueLock;                  // Protects the queue
+    downstream_command queue[DOWNSTREAM_QUEUE_CAPACITY];
+    int queueHead;                      // Index of the oldest command
+    int queueCount;                     // Commands in the queue
+    HANDLE queueEvent;                  // Auto-reset; signalled when a command is queued
+    HANDLE stopEvent;                   // Manual-reset; signalled to stop both threads
+    HANDLE pacingTimer;                 // Wakes the writer shortly before the next command is due
+
+    HANDLE readerThread;                // Reads commands from the server
+    HANDLE writerThread;                // Writes commands to the devices
+    downstream_device devices[HID_MUX_MAX_DEVICES];
+
+    histogram latency;                  // Receive-to-written latency in ns
+    volatile LONG64 received;           // Commands decoded, broadcasts counted once per device
+    volatile LONG64 written;            // Commands written to a device
+    volatile LONG64 coalesced;          // Queued state commands replaced by a newer one
+    volatile LONG64 redundant;          // State commands skipped because the device already had them
+    volatile LONG64 dropped;            // Commands dropped because the queue was full
+    volatile LONG64 failed;             // Writes that failed, e.g. because the device was gone
+} downstream;
+
+// Function prototypes
+bool start_downstream(downstream* ds, hid_mux* mux, forwarder* fwd, const downstream_config* config);
+void stop_downstream(downstream* ds);
+bool downstream_enqueue(downstream* ds, uint16_t deviceId, const unsigned char* data, int length, uint64_t receivedNs);
+void downstream_log_summary(downstream* ds);
@@ -0,0 +1,427 @@
+#include "forwarder.h"
+#include "timing.h"
+
+// Frames gathered for one send call. Each report is framed where it lies in its pooled
+// buffer and gets its own WSABUF, so the kernel copies them all out in a single
+// scatter/gather call and the report bytes are never copied in user space.
+typedef struct {
+    hid_report* reports[SEND_BATCH_MAX_FRAMES];  // Returned to the pool once sent
+    WSABUF buffers[SEND_BATCH_MAX_FRAMES];
+    DWORD count;         // Frames currently in the batch
+    int bytes;           // Total bytes currently in the batch
+    uint64_t deadline;   // monotonic_ns() by which the batch must be sent
+} send_batch;
+
+/**
+ * Encodes a report where it lies in its frame: a binary frame header in the headroom
+ * in front of the data, or the legacy hex string at the start of the headroom.
+ *
+ * @param format The wire format.
+ * @param report The report to encode.
+ * @param message Receives the start of the encoded message.
+ * @return The length of the message, or -1 if it could not be encoded.
+ */
+static int encode_in_place(wire_format_mode format, hid_report* report, char** message) {
+    if (format == WIRE_FORMAT_HEX) {
+        // Legacy mode: the first three bytes as a hex string, written into the headroom
+        *message = (char*)report->buffer;
+        int messageLength = encode_report_hex(report, *message, REPORT_HEADROOM);
+        write_log(LOGLEVEL_DEBUG, *message);
+        return messageLength;
+    }
+    return encode_report_frame_in_place(report, message);
+}
+
+/**
+ * Encodes a report once before it is queued to several sinks, so the forwarders only
+ * ever read a shared frame. Call on the thread that holds the report alone.
+ *
+ * @param report The report to encode.
+ * @param format The wire format every sink uses.
+ * @return true if the report was encoded.
+ */
+bool forwarder_encode_shared(hid_report* report, wire_format_mode format) {
+    report->wireLength = encode_in_place(format, report, &report->wire);
+    if (report->wireLength <= 0) {
+        report->wire = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Encodes a report in place and adds it to the batch, which owns it from then on.
+ *
+ * @param fwd Pointer to the forwarder.
+ * @param batch The batch to append to. Must not be full.
+ * @param report The report to encode.
+ */
+static void append_report(forwarder* fwd, send_batch* batch, hid_report* report) {
+    char* message;
+    int messageLength;
+
+    // A shared report is only stamped by the one sink that records latency
+    if (fwd->config.latency) {
+        report->dequeuedNs = monotonic_ns();
+        stage_latency_record(fwd->config.latency, STAGE_QUEUED, report->queuedNs, report->dequeuedNs);
+    }
+
+    if (report->wire) {
+        // Shared with other sinks and encoded before it was queued
+        message = report->wire;
+        messageLength = report->wireLength;
+    }
+    else {
+        messageLength = encode_in_place(fwd->config.format, report, &message);
+    }
+
+    if (messageLength <= 0) {
+        frame_pool_release(fwd->pool, report);
+        return;
+    }
+
+    if (batch->count == 0) {
+        // The deadline runs from when the oldest report was read, so time spent
+        // queued in the ring counts against it
+        batch->deadline = report->timestamp + (uint64_t)fwd->config.flushDeadlineUs * 1000;
+    }
+
+    batch->reports[batch->count] = report;
+    batch->buffers[batch->count].buf = message;
+    batch->buffers[batch->count].len = (ULONG)messageLength;
+    batch->count++;
+    batch->bytes += messageLength;
+}
+
+/**
+ * Returns every report in the batch to the pool and empties it.
+ */
+static void release_batch(forwarder* fwd, send_batch* batch) {
+    for (DWORD i = 0; i < batch->count; i++) {
+        frame_pool_release(fwd->pool, batch->reports[i]);
+    }
+    batch->count = 0;
+    batch->bytes = 0;
+}
+
+/**
+ * Closes the connection and marks it lost; the sender thread reconnects with backoff.
+ *
+ * @param fwd Pointer to the forwarder.
+ */
+static void drop_connection(forwarder* fwd) {
+    AcquireSRWLockExclusive(&fwd->socketLock);
+    cleanup_client(fwd->socket);
+    fwd->socket = INVALID_SOCKET;
+    ReleaseSRWLockExclusive(&fwd->socketLock);
+
+    connection_lost(&fwd->link, monotonic_ns());
+}
+
+/**
+ * Sends every frame in the batch with a single call and empties it. If the send fails
+ * the connection is marked lost and the batch is kept, to be sent again once the
+ * connection is back. Frames the server had already received before the failure are
+ * then sent twice; receivers drop them by device id and sequence number.
+ * Over UDP the batch goes as one datagram and is discarded if the send fails; by the
+ * time the socket is back, newer reports carry the state it held.
+ *
+ * @param fwd Pointer to the forwarder.
+ * @param batch The batch to send.
+ * @return true if the batch was sent or empty, false if the connection broke.
+ */
+static bool flush_batch(forwarder* fwd, send_batch* batch) {
+    if (batch->count == 0) {
+        return true;
+    }
+
+    int sent = fwd->config.transport == SINK_TRANSPORT_UDP
+        ? send_datagram_to_server(fwd->socket, fwd->datagramSession, fwd->datagramSequence++, batch->buffers, batch->count)
+        : send_frames_to_server(fwd->socket, batch->buffers, batch->count);
+    if (sent < 0) {
+        // Handle error in sending
+        write_log(LOGLEVEL_ERROR, "Forwarder - Failed to send reports to server.");
+        if (fwd->config.transport == SINK_TRANSPORT_UDP) {
+            WriteNoFence64(&fwd->batchesLost, fwd->batchesLost + 1);
+            release_batch(fwd, batch);
+        }
+        drop_connection(fwd);
+        return false;
+    }
+
+    if (fwd->config.latency) {
+        uint64_t sentNs = monotonic_ns();
+        for (DWORD i = 0; i < batch->count; i++) {
+            stage_latency_record(fwd->config.latency, STAGE_BATCH_TO_SENT, batch->reports[i]->dequeuedNs, sentNs);
+            stage_latency_record(fwd->config.latency, STAGE_READ_TO_SENT, batch->reports[i]->timestamp, sentNs);
+        }
+    }
+
+    WriteNoFence64(&fwd->sendCalls, fwd->sendCalls + 1);
+    WriteNoFence64(&fwd->framesSent, fwd->framesSent + batch->count);
+    WriteNoFence64(&fwd->bytesSent, fwd->bytesSent + batch->bytes);
+    if ((LONG)batch->count > fwd->maxBatchFrames) {
+        WriteNoFence(&fwd->maxBatchFrames, (LONG)batch->count);
+    }
+
+    release_batch(fwd, batch);
+    return true;
+}
+
+/**
+ * Makes a connection attempt if one is due.
+ *
+ * @param fwd Pointer to the forwarder.
+ * @return true if the forwarder is connected afterwards.
+ */
+static bool try_reconnect(forwarder* fwd) {
+    if (!connection_attempt_due(&fwd->link, monotonic_ns())) {
+        return false;
+    }
+
+    SOCKET socket = fwd->config.transport == SINK_TRANSPORT_UDP
+        ? init_udp_client(&fwd->config.server, fwd->config.multicastTtl)
+        : init_client(&fwd->config.server);
+    if (socket == INVALID_SOCKET) {
+        connection_attempt_failed(&fwd->link, monotonic_ns());
+        return false;
+    }
+
+    AcquireSRWLockExclusive(&fwd->socketLock);
+    fwd->socket = socket;
+    InterlockedIncrement(&fwd->generation);
+    ReleaseSRWLockExclusive(&fwd->socketLock);
+
+    connection_established(&fwd->link, monotonic_ns());
+    return true;
+}
+
+/**
+ * Sender thread entry point. Drains the report ring into batches and flushes a batch
+ * when it reaches the byte threshold or its deadline, whichever comes first.
+ * Parks only when the ring is empty and nothing is waiting to be sent.
+ *
+ * @param param Pointer to the owning forwarder.
+ * @return Always 0.
+ */
+static DWORD WINAPI forwarder_thread(LPVOID param) {
+    forwarder* fwd = (forwarder*)param;
+    send_batch batch;
+
+    write_log(LOGLEVEL_DEBUG, "Forwarder - Thread started");
+
+    batch.count = 0;
+    batch.bytes = 0;
+
+    while (ReadAcquire(&fwd->running)) {
+        if (!connection_is_up(&fwd->link)) {
+            // Reports wait in the ring while the server is unreachable. The ring is the bound
+            // on buffering: once it is full the reader drops new reports and counts them.
+            if (!try_reconnect(fwd)) {
+                DWORD wait = connection_wait_ms(&fwd->link, monotonic_ns());
+                WaitForSingleObject(fwd->stopEvent, wait < FORWARDER_WAIT_MS ? wait : FORWARDER_WAIT_MS);
+                continue;
+            }
+            // Resend whatever the failed send left behind before taking new reports
+            flush_batch(fwd, &batch);
+            continue;
+        }
+        if (ReadAcquire(&fwd->brokenGeneration) == ReadNoFence(&fwd->generation)) {
+            // A receiver saw the server close the connection before we tried to send
+            write_log(LOGLEVEL_ERROR, "Forwarder - Server closed the connection.");
+            drop_connection(fwd);
+            continue;
+        }
+
+        hid_report* report = report_ring_pop(fwd->ring);
+        if (!report) {
+            if (batch.count == 0) {
+                report_ring_wait(fwd->ring, FORWARDER_WAIT_MS);
+            }
+            else if (monotonic_ns() >= batch.deadline) {
+                flush_batch(fwd, &batch);
+            }
+            else if (arm_deadline_timer(fwd->flushTimer, batch.deadline)) {
+                // Sleep until just before the deadline unless a report arrives first
+                report_ring_wait_handle(fwd->ring, fwd->flushTimer, FORWARDER_WAIT_MS);
+            }
+            else {
+                // Closer to the deadline than a timer can be trusted with
+                YieldProcessor();
+            }
+            continue;
+        }
+
+        append_report(fwd, &batch, report);
+
+        if (batch.bytes >= fwd->config.flushBytes || batch.count == SEND_BATCH_MAX_FRAMES) {
+            flush_batch(fwd, &batch);
+        }
+    }
+
+    if (connection_is_up(&fwd->link)) {
+        flush_batch(fwd, &batch);
+    }
+    release_batch(fwd, &batch);
+
+    write_log(LOGLEVEL_DEBUG, "Forwarder - Thread exiting");
+    return 0;
+}
+
+/**
+ * Starts the thread that sends queued reports to the server.
+ *
+ * @param fwd Pointer to the forwarder struct to initialize.
+ * @param ring The ring the HID reader pushes reports into.
+ * @param pool The pool the reports come from; they are returned to it once sent.
+ * @param config The socket, encoding and coalescing settings to use.
+ * @return true if the thread was started, false otherwise.
+ */
+bool start_forwarder(forwarder* fwd, report_ring* ring, frame_pool* pool, const forwarder_config* config) {
+    // Check for invalid arguments
+    if (!fwd || !ring || !pool || !config) {
+        write_log(LOGLEVEL_ERROR, "Forwarder - Invalid arguments");
+        return false;
+    }
+
+    if (config->transport == SINK_TRANSPORT_UDP && config->format != WIRE_FORMAT_BINARY) {
+        write_log(LOGLEVEL_ERROR, "Forwarder - UDP needs the binary wire format");
+        return false;
+    }
+
+    fwd->ring = ring;
+    fwd->pool = pool;
+    fwd->config = *config;
+    if (config->transport == SINK_TRANSPORT_UDP && config->flushBytes > FORWARDER_UDP_FLUSH_BYTES) {
+        // Every batch must go out as a single unfragmented datagram
+        fwd->config.flushBytes = FORWARDER_UDP_FLUSH_BYTES;
+    }
+    fwd->running = 1;
+    fwd->sendCalls = 0;
+    fwd->framesSent = 0;
+    fwd->bytesSent = 0;
+    fwd->maxBatchFrames = 0;
+    // Differs between runs, and between forwarders started in one run
+    fwd->datagramSession = (uint32_t)monotonic_ns() ^ (GetCurrentProcessId() << 16);
+    fwd->datagramSequence = 0;
+    fwd->batchesLost = 0;
+    fwd->socket = config->serverSocket;
+    InitializeSRWLock(&fwd->socketLock);
+    fwd->generation = 1;
+    fwd->brokenGeneration = 0;
+
+    // Without a connected socket the sender thread connects first, with the usual backoff
+    init_connection(&fwd->link, config->transport == SINK_TRANSPORT_UDP ? "UDP" : "TCP", FORWARDER_RECONNECT_BASE_MS, FORWARDER_RECONNECT_MAX_MS,
+        config->serverSocket != INVALID_SOCKET);
+
+    fwd->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (fwd->stopEvent == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Forwarder - Failed to create stop event. Error Code: %lu", GetLastError());
+        return false;
+    }
+
+    fwd->flushTimer = create_deadline_timer();
+    if (fwd->flushTimer == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Forwarder - Failed to create flush timer. Error Code: %lu", GetLastError());
+        CloseHandle(fwd->stopEvent);
+        fwd->stopEvent = NULL;
+        return false;
+    }
+
+    fwd->thread = CreateThread(NULL, 0, forwarder_thread, fwd, 0, NULL);
+    if (fwd->thread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Forwarder - Failed to create thread. Error Code: %lu", GetLastError());
+        CloseHandle(fwd->flushTimer);
+        CloseHandle(fwd->stopEvent);
+        fwd->flushTimer = NULL;
+        fwd->stopEvent = NULL;
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Forwarder - Sender thread started (%s). Flush at %d bytes or %d us",
+        config->transport == SINK_TRANSPORT_UDP ? "UDP" : "TCP", fwd->config.flushBytes, config->flushDeadlineUs);
+    return true;
+}
+
+/**
+ * Stops the sender thread, waits for it to exit and closes the connection. Reports still
+ * queued in the ring are discarded; their frames go when the pool is destroyed.
+ *
+ * @param fwd Pointer to the forwarder to stop.
+ */
+void stop_forwarder(forwarder* fwd) {
+    if (!fwd || fwd->thread == NULL) {
+        return;
+    }
+
+    WriteRelease(&fwd->running, 0);
+    SetEvent(fwd->stopEvent);
+    report_ring_wake(fwd->ring);
+    report_ring_close(fwd->ring);  // Nothing drains the ring from here on; a blocked reader must not wait
+
+    WaitForSingleObject(fwd->thread, INFINITE);
+    CloseHandle(fwd->thread);
+    CloseHandle(fwd->flushTimer);
+    CloseHandle(fwd->stopEvent);
+    fwd->thread = NULL;
+    fwd->flushTimer = NULL;
+    fwd->stopEvent = NULL;
+
+    if (fwd->socket != INVALID_SOCKET) {
+        AcquireSRWLockExclusive(&fwd->socketLock);
+        cleanup_client(fwd->socket);
+        fwd->socket = INVALID_SOCKET;
+        ReleaseSRWLockExclusive(&fwd->socketLock);
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Forwarder - Sender thread stopped. Queue high water: %ld, dropped: %lld, evicted: %lld, coalesced: %lld, reader blocked %llu ms",
+        report_ring_high_water(fwd->ring), report_ring_dropped(fwd->ring), report_ring_evicted(fwd->ring),
+        report_ring_coalesced(fwd->ring), (unsigned long long)(report_ring_blocked_ns(fwd->ring) / 1000000));
+    write_log_format(LOGLEVEL_INFO, "Forwarder - %lld frames in %lld sends (%.2f per send, max %ld)",
+        fwd->framesSent, fwd->sendCalls, forwarder_frames_per_send(fwd), fwd->maxBatchFrames);
+    if (fwd->config.transport == SINK_TRANSPORT_UDP) {
+        write_log_format(LOGLEVEL_INFO, "Forwarder - %lu datagrams sent, %lld batches lost to failed sends",
+            (unsigned long)fwd->datagramSequence, fwd->batchesLost);
+    }
+    connection_log_summary(&fwd->link);
+}
+
+/**
+ * @param fwd Pointer to the forwarder.
+ * @return The average number of frames carried by each send syscall so far.
+ */
+double forwarder_frames_per_send(forwarder* fwd) {
+    LONG64 calls = ReadNoFence64(&fwd->sendCalls);
+    if (calls == 0) {
+        return 0.0;
+    }
+    return (double)ReadNoFence64(&fwd->framesSent) / (double)calls;
+}
+
+/**
+ * Returns the current connection for a thread that reads from it. The socket may be
+ * closed at any time by the sender thread, which makes a blocking recv on it fail.
+ *
+ * @param fwd Pointer to the forwarder.
+ * @param generation Receives the connection's generation, for forwarder_connection_broken.
+ * @return The connected socket, or INVALID_SOCKET while disconnected.
+ */
+SOCKET forwarder_socket(forwarder* fwd, LONG* generation) {
+    AcquireSRWLockShared(&fwd->socketLock);
+    SOCKET socket = fwd->socket;
+    *generation = fwd->generation;
+    ReleaseSRWLockShared(&fwd->socketLock);
+    return socket;
+}
+
+/**
+ * Tells the sender thread that a receive on the connection failed, so it reconnects
+ * without waiting for a send to fail. Ignored if that connection was already replaced.
+ *
+ * @param fwd Pointer to the forwarder.
+ * @param generation The generation returned with the socket by forwarder_socket.
+ */
+void forwarder_connection_broken(forwarder* fwd, LONG generation) {
+    WriteRelease(&fwd->brokenGeneration, generation);
+    report_ring_wake(fwd->ring);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdbool.h>
+#include "report_ring.h"
+#include "frame_pool.h"
+#include "tcp_client.h"
+#include "udp_client.h"
+#include "connection.h"
+#include "stage_latency.h"
+#include "logger.h"
+
+// How long the forwarder parks on an empty ring before re-checking its stop flag.
+#define FORWARDER_WAIT_MS 250
+
+// Most frames gathered into a single send call.
+#define SEND_BATCH_MAX_FRAMES 64
+
+// Most servers the reports are sent to, each by a forwarder of its own
+#define FORWARDER_MAX_SINKS 4
+
+// Reconnect backoff: the first retry comes after about this long, doubling up to the cap
+#define FORWARDER_RECONNECT_BASE_MS 100
+#define FORWARDER_RECONNECT_MAX_MS 10000
+
+// How a forwarder reaches its server
+typedef enum {
+    SINK_TRANSPORT_TCP = 0,  // One stream; lost segments are resent and hold up what follows
+    SINK_TRANSPORT_UDP       // Datagrams with sequence numbers; lost ones stay lost
+} sink_transport;
+
+// Largest batch a UDP forwarder gathers: a full batch plus one more frame still fits a datagram
+#define FORWARDER_UDP_FLUSH_BYTES (DATAGRAM_MAX_SIZE - DATAGRAM_HEADER_SIZE - FRAME_MAX_SIZE)
+
+// Structure to hold the settings the forwarder is started with.
+typedef struct {
+    SOCKET serverSocket;      // Connected socket, or INVALID_SOCKET to connect on the sender thread.
+                              // The forwarder owns it from then on and closes it when stopped.
+    tcp_socket_info server;   // Where to reconnect to when the connection breaks
+    sink_transport transport; // TCP, or UDP datagrams; UDP needs WIRE_FORMAT_BINARY
+    int multicastTtl;         // Routers a UDP datagram to a multicast group may cross
+    wire_format_mode format;  // How reports are encoded on the wire
+    int flushBytes;           // Send as soon as a batch holds this many bytes
+    int flushDeadlineUs;      // ...or once its oldest report is this old, whichever comes first
+    stage_latency* latency;   // Where the sender records the stages it owns, NULL for none
+} forwarder_config;
+
+// Structure to hold the state of the TCP sender thread that drains the report ring.
+typedef struct {
+    report_ring* ring;        // Ring filled by the HID reader
+    frame_pool* pool;         // Where sent reports are returned
+    forwarder_config config;  // Settings the thread was started with
+    HANDLE thread;            // Sender thread handle
+    volatile LONG running;    // Cleared to ask the thread to exit
+    HANDLE stopEvent;         // Interrupts reconnect backoff when stopping
+    HANDLE flushTimer;        // Wakes the thread shortly before a pending batch's deadline
+    SOCKET socket;            // Current connection, INVALID_SOCKET while down; replaced under socketLock
+    SRWLOCK socketLock;       // Held exclusively while the socket is replaced or closed
+    volatile LONG generation; // Incremented with every new connection
+    volatile LONG brokenGeneration; // Set by a receiver that found the connection dead
+    connection link;          // Reconnect state and outage statistics
+
+    // Coalescing statistics, written by the sender thread only
+    volatile LONG64 sendCalls;    // Number of send syscalls made
+    volatile LONG64 framesSent;   // Number of frames those calls carried
+    volatile LONG64 bytesSent;    // Number of bytes those calls carried
+    volatile LONG maxBatchFrames; // Largest number of frames sent in one call
+    uint32_t datagramSession;     // Identifies this run of the sender in every UDP datagram
+    uint32_t datagramSequence;    // Sequence of the next UDP datagram
+    volatile LONG64 batchesLost;  // UDP batches discarded because a send failed
+} forwarder;
+
+// Function prototypes
+bool start_forwarder(forwarder* fwd, report_ring* ring, frame_pool* pool, const forwarder_config* config);
+void stop_forwarder(forwarder* fwd);
+double forwarder_frames_per_send(forwarder* fwd);
+SOCKET forwarder_socket(forwarder* fwd, LONG* generation);
+void forwarder_connection_broken(forwarder* fwd, LONG generation);
+bool forwarder_encode_shared(hid_report* report, wire_format_mode format);
@@ -0,0 +1,228 @@
+#include <string.h>
+#include "frame_decoder.h"
+
+/**
+ * Decodes a single frame from the start of a buffer without copying the payload.
+ *
+ * @param data The buffer to decode from.
+ * @param length The number of valid bytes in data.
+ * @param frame Receives the decoded fields; payload points into data.
+ * @return The number of bytes the frame occupies, FRAME_INCOMPLETE if more bytes are
+ *         needed, or FRAME_INVALID if the length field is out of range.
+ */
+int decode_frame(const uint8_t* data, size_t length, wire_frame* frame) {
+    if (length < FRAME_LENGTH_FIELD_SIZE) {
+        return FRAME_INCOMPLETE;
+    }
+
+    size_t frameSize = FRAME_LENGTH_FIELD_SIZE + wire_get_u16(data);
+    if (frameSize < FRAME_HEADER_SIZE || frameSize > FRAME_MAX_SIZE) {
+        return FRAME_INVALID;
+    }
+
+    if (length < frameSize) {
+        return FRAME_INCOMPLETE;
+    }
+
+    frame->device_id = wire_get_u16(data + 2);
+    frame->sequence = wire_get_u32(data + 4);
+    frame->timestamp_ns = wire_get_u64(data + 8);
+    frame->payload_length = (uint16_t)(frameSize - FRAME_HEADER_SIZE);
+    frame->payload = data + FRAME_HEADER_SIZE;
+    return (int)frameSize;
+}
+
+/**
+ * Initializes a streaming decoder.
+ *
+ * @param decoder Pointer to the frame_decoder struct to initialize.
+ */
+void init_frame_decoder(frame_decoder* decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+/**
+ * Feeds bytes received from the stream to the decoder. Complete frames are decoded
+ * straight out of data; only a frame cut off at the end of data is copied aside
+ * until the next call completes it.
+ *
+ * @param decoder Pointer to the decoder.
+ * @param data The received bytes.
+ * @param length The number of bytes in data.
+ * @param on_frame Called once per complete frame.
+ * @param context Pointer passed through to on_frame.
+ * @return The number of frames decoded, or FRAME_INVALID if the stream is corrupt.
+ *         After FRAME_INVALID the connection should be dropped.
+ */
+int frame_decoder_feed(frame_decoder* decoder, const uint8_t* data, size_t length, frame_callback on_frame, void* context) {
+    wire_frame frame;
+    int frames = 0;
+
+    // Finish a frame that straddled the previous feed
+    while (decoder->pendingLength > 0 && length > 0) {
+        size_t want = FRAME_LENGTH_FIELD_SIZE;
+        if (decoder->pendingLength >= FRAME_LENGTH_FIELD_SIZE) {
+            want += wire_get_u16(decoder->pending);
+            if (want < FRAME_HEADER_SIZE || want > FRAME_MAX_SIZE) {
+                decoder->invalidFrames++;
+                decoder->pendingLength = 0;
+                return FRAME_INVALID;
+            }
+        }
+
+        size_t take = want - decoder->pendingLength;
+        if (take > length) {
+            take = length;
+        }
+        memcpy(decoder->pending + decoder->pendingLength, data, take);
+        decoder->pendingLength += take;
+        data += take;
+        length -= take;
+
+        if (decoder->pendingLength < want || want == FRAME_LENGTH_FIELD_SIZE) {
+            continue; // Need more input, or only the length field is complete so far
+        }
+
+        decode_frame(decoder->pending, decoder->pendingLength, &frame);
+        decoder->pendingLength = 0;
+        decoder->framesDecoded++;
+        frames++;
+        on_frame(&frame, context);
+    }
+
+    // Decode whole frames in place
+    while (length > 0) {
+        int used = decode_frame(data, length, &frame);
+        if (used == FRAME_INVALID) {
+            decoder->invalidFrames++;
+            return FRAME_INVALID;
+        }
+        if (used == FRAME_INCOMPLETE) {
+            memcpy(decoder->pending, data, length);
+            decoder->pendingLength = length;
+            break;
+        }
+
+        decoder->framesDecoded++;
+        frames++;
+        on_frame(&frame, context);
+        data += used;
+        length -= used;
+    }
+
+    return frames;
+}
+
+/**
+ * Initializes a datagram tracker.
+ *
+ * @param tracker Pointer to the datagram_tracker struct to initialize.
+ */
+void init_datagram_tracker(datagram_tracker* tracker) {
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+/**
+ * Checks a datagram's sequence against those seen before and counts it.
+ *
+ * @param tracker Pointer to the tracker.
+ * @param header The datagram's header.
+ * @return How the datagram fits in the sequence; never DATAGRAM_INVALID.
+ */
+static datagram_status track_sequence(datagram_tracker* tracker, const wire_datagram* header) {
+    uint32_t sequence = header->sequence;
+
+    if (tracker->started && header->session != tracker->session) {
+        // The sender restarted and counts from 0 again, however far it had got before
+        tracker->resyncs++;
+        tracker->started = false;
+    }
+
+    // Signed distance from the newest, so the sequence may wrap
+    int32_t ahead = (int32_t)(sequence - tracker->highest);
+
+    if (!tracker->started) {
+        tracker->started = true;
+        tracker->session = header->session;
+        tracker->highest = sequence;
+        tracker->window = 1;
+        return DATAGRAM_IN_ORDER;
+    }
+
+    if (ahead > 0) {
+        tracker->lost += (uint64_t)(ahead - 1);
+        tracker->window = ahead < DATAGRAM_WINDOW ? (tracker->window << ahead) | 1 : 1;
+        tracker->highest = sequence;
+        return ahead == 1 ? DATAGRAM_IN_ORDER : DATAGRAM_AFTER_GAP;
+    }
+
+    int32_t behind = -ahead;
+    if (behind >= DATAGRAM_WINDOW) {
+        tracker->tooLate++;
+        return DATAGRAM_TOO_LATE;
+    }
+
+    uint64_t bit = 1ULL << behind;
+    if (tracker->window & bit) {
+        tracker->duplicates++;
+        return DATAGRAM_DUPLICATE;
+    }
+    tracker->window |= bit;
+    tracker->reordered++;
+    if (tracker->lost > 0) {
+        tracker->lost--;  // Counted lost when the newer one arrived first
+    }
+    return DATAGRAM_REORDERED;
+}
+
+/**
+ * Handles one received datagram: checks its sequence and delivers the frames it holds,
+ * unless it is a duplicate or too late to place. Frames of a reordered datagram are
+ * delivered but are older than ones delivered before them; a receiver that only wants
+ * the latest state can skip them by the returned status.
+ *
+ * @param tracker Pointer to the tracker.
+ * @param data The datagram, header first.
+ * @param length The number of bytes in data.
+ * @param on_frame Called once per frame; tracker->last holds the datagram header.
+ * @param context Pointer passed through to on_frame.
+ * @return What the datagram was. Frames before a corrupt one are still delivered.
+ */
+datagram_status datagram_tracker_feed(datagram_tracker* tracker, const uint8_t* data, size_t length, frame_callback on_frame, void* context) {
+    wire_frame frame;
+
+    if (length < DATAGRAM_HEADER_SIZE) {
+        tracker->invalid++;
+        return DATAGRAM_INVALID;
+    }
+
+    wire_datagram header;
+    header.sequence = wire_get_u32(data);
+    header.session = wire_get_u32(data + 4);
+    header.sent_ns = wire_get_u64(data + 8);
+    datagram_status status = track_sequence(tracker, &header);
+    if (status == DATAGRAM_DUPLICATE || status == DATAGRAM_TOO_LATE) {
+        return status;
+    }
+
+    tracker->received++;
+    tracker->last = header;
+    data += DATAGRAM_HEADER_SIZE;
+    length -= DATAGRAM_HEADER_SIZE;
+
+    // A datagram only ever holds whole frames
+    while (length > 0) {
+        int used = decode_frame(data, length, &frame);
+        if (used <= 0) {
+            tracker->invalid++;
+            return DATAGRAM_INVALID;
+        }
+
+        tracker->framesDecoded++;
+        on_frame(&frame, context);
+        data += used;
+        length -= used;
+    }
+
+    return status;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// Streaming decoder for the binary wire format in wire_format.h.
+// Portable C with no platform dependencies; a server can compile
+// wire_format.h, frame_decoder.h and frame_decoder.c on their own.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "wire_format.h"
+
+// Result of decode_frame when the buffer does not yet hold a whole frame.
+#define FRAME_INCOMPLETE 0
+// Result of decode_frame when the length field is impossible; the stream is corrupt.
+#define FRAME_INVALID (-1)
+
+// Called once per complete frame. The frame is only valid for the duration of the call.
+typedef void (*frame_callback)(const wire_frame* frame, void* context);
+
+// Reassembles frames that are split across reads.
+typedef struct {
+    uint8_t pending[FRAME_MAX_SIZE];  // Bytes of a frame that straddled the previous feed
+    size_t pendingLength;             // Number of valid bytes in pending
+    uint64_t framesDecoded;           // Total frames delivered to the callback
+    uint64_t invalidFrames;           // Total corrupt length fields seen
+} frame_decoder;
+
+// Sequence numbers remembered behind the newest datagram, to tell late ones from duplicates
+#define DATAGRAM_WINDOW 64
+
+// What datagram_tracker_feed made of a datagram
+typedef enum {
+    DATAGRAM_IN_ORDER = 0,  // The next one expected
+    DATAGRAM_AFTER_GAP,     // Newer than expected; the ones skipped are counted lost for now
+    DATAGRAM_REORDERED,     // Older than the newest, arriving late; its frames are stale
+    DATAGRAM_DUPLICATE,     // Already received; its frames are not delivered again
+    DATAGRAM_TOO_LATE,      // Older than the window; its frames are not delivered
+    DATAGRAM_INVALID        // Too short, or a frame in it is corrupt
+} datagram_status;
+
+// Detects lost, reordered and duplicated datagrams from their sequence numbers and
+// decodes the frames they carry. Unlike a stream, every datagram stands alone.
+typedef struct {
+    bool started;             // Whether a datagram has been received yet
+    uint32_t session;         // Session of the sender being tracked
+    uint32_t highest;         // Newest sequence received
+    uint64_t window;          // Bit n set if highest - n has been received
+    wire_datagram last;       // Header of the datagram being delivered, valid in the frame callback
+    uint64_t received;        // Datagrams whose frames were delivered
+    uint64_t lost;            // Sequences skipped and not (yet) received late
+    uint64_t reordered;       // Datagrams that arrived after a newer one
+    uint64_t duplicates;      // Datagrams received twice
+    uint64_t tooLate;         // Datagrams older than the window
+    uint64_t invalid;         // Datagrams that could not be decoded
+    uint64_t resyncs;         // Times the sender restarted with a new session
+    uint64_t framesDecoded;   // Total frames delivered to the callback
+} datagram_tracker;
+
+// Function prototypes
+int decode_frame(const uint8_t* data, size_t length, wire_frame* frame);
+void init_frame_decoder(frame_decoder* decoder);
+int frame_decoder_feed(frame_decoder* decoder, const uint8_t* data, size_t length, frame_callback on_frame, void* context);
+void init_datagram_tracker(datagram_tracker* tracker);
+datagram_status datagram_tracker_feed(datagram_tracker* tracker, const uint8_t* data, size_t length, frame_callback on_frame, void* context);
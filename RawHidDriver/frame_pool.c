@@ -0,0 +1,129 @@
+#include "frame_pool.h"
+#include <malloc.h>
+#include <string.h>
+#include "logger.h"
+
+/**
+ * Allocates every frame up front and puts them all in the free list.
+ *
+ * @param pool Pointer to the frame_pool struct to initialize.
+ * @param size Number of frames.
+ * @return true on success, false if the frames could not be allocated.
+ */
+bool init_frame_pool(frame_pool* pool, LONG size) {
+    if (!pool || size <= 0) {
+        write_log(LOGLEVEL_ERROR, "Frame Pool - Invalid arguments");
+        return false;
+    }
+
+    pool->frames = (pool_frame*)_aligned_malloc((size_t)size * sizeof(pool_frame), CACHE_LINE_SIZE);
+    if (!pool->frames) {
+        write_log_format(LOGLEVEL_ERROR, "Frame Pool - Failed to allocate %ld frames", size);
+        return false;
+    }
+    memset(pool->frames, 0, (size_t)size * sizeof(pool_frame));
+
+    InitializeSListHead(&pool->freeList);
+    pool->size = size;
+    pool->inUse = 0;
+    pool->highWater = 0;
+    pool->exhausted = 0;
+
+    // Pushed in reverse so the first frames handed out are the first in memory
+    for (LONG i = size - 1; i >= 0; i--) {
+        InterlockedPushEntrySList(&pool->freeList, &pool->frames[i].link);
+    }
+
+    write_log_format(LOGLEVEL_DEBUG, "Frame Pool - Initialized with %ld frames of %zu bytes", size, sizeof(pool_frame));
+    return true;
+}
+
+/**
+ * Frees every frame. Frames still handed out become invalid, so stop the threads that
+ * use the pool first.
+ *
+ * @param pool Pointer to the frame_pool to destroy.
+ */
+void destroy_frame_pool(frame_pool* pool) {
+    if (pool && pool->frames) {
+        _aligned_free(pool->frames);
+        pool->frames = NULL;
+    }
+}
+
+/**
+ * Takes a frame out of the pool. Never blocks and never allocates.
+ *
+ * @param pool Pointer to the frame pool.
+ * @return A frame with its data pointing at the start of the read area, or NULL if every
+ *         frame is in use. Empty pools are counted, see frame_pool_exhausted.
+ */
+hid_report* frame_pool_acquire(frame_pool* pool) {
+    PSLIST_ENTRY entry = InterlockedPopEntrySList(&pool->freeList);
+    if (!entry) {
+        InterlockedIncrement64(&pool->exhausted);
+        return NULL;
+    }
+
+    LONG inUse = InterlockedIncrement(&pool->inUse);
+    if (inUse > ReadNoFence(&pool->highWater)) {
+        // Racy, but only ever low by a frame or two
+        WriteNoFence(&pool->highWater, inUse);
+    }
+
+    pool_frame* frame = CONTAINING_RECORD(entry, pool_frame, link);
+    frame->refs = 1;
+    frame->report.data = frame->report.buffer + REPORT_HEADROOM;
+    frame->report.length = 0;
+    frame->report.wire = NULL;
+    return &frame->report;
+}
+
+/**
+ * Hands a frame to more holders. Each of them releases it once; the frame goes back to
+ * the pool with the last release. Call before passing the frame on, while the caller
+ * still holds it.
+ *
+ * @param pool Pointer to the frame pool.
+ * @param report A frame the caller holds.
+ * @param holders How many holders to add.
+ */
+void frame_pool_share(frame_pool* pool, hid_report* report, LONG holders) {
+    (void)pool;
+    InterlockedAdd(&CONTAINING_RECORD(report, pool_frame, report)->refs, holders);
+}
+
+/**
+ * Drops the caller's hold on a frame and returns it to the pool if it was the last.
+ * Safe from any thread.
+ *
+ * @param pool Pointer to the frame pool.
+ * @param report A frame from frame_pool_acquire; NULL is ignored.
+ */
+void frame_pool_release(frame_pool* pool, hid_report* report) {
+    if (!report) {
+        return;
+    }
+    pool_frame* frame = CONTAINING_RECORD(report, pool_frame, report);
+    if (InterlockedDecrement(&frame->refs) != 0) {
+        return;
+    }
+    InterlockedDecrement(&pool->inUse);
+    InterlockedPushEntrySList(&pool->freeList, &frame->link);
+}
+
+/**
+ * @param pool Pointer to the frame pool.
+ * @return The number of times a frame was wanted and none was free.
+ */
+LONG64 frame_pool_exhausted(frame_pool* pool) {
+    return ReadNoFence64(&pool->exhausted);
+}
+
+/**
+ * Logs how many frames are in use and how often the pool ran dry.
+ */
+void frame_pool_log_summary(frame_pool* pool) {
+    write_log_format(LOGLEVEL_INFO, "Frame Pool - %ld of %ld frames in use, high water %ld, exhausted %lld times",
+        ReadNoFence(&pool->inUse), pool->size, ReadNoFence(&pool->highWater), frame_pool_exhausted(pool));
+}
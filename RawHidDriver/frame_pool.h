@@ -0,0 +1,40 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include "report.h"
+#include "report_ring.h"
+
+// Frames preallocated for a pipeline with a single sink ring. Enough for a full report
+// ring, every read the multiplexer keeps outstanding and a send batch, with room to spare.
+// With several sinks the pool must cover every ring at once; see main.c.
+#define FRAME_POOL_SIZE 2048
+
+// One pooled report. Frames are cache-line aligned so two threads never share a line.
+typedef __declspec(align(CACHE_LINE_SIZE)) struct {
+    SLIST_ENTRY link;      // Free-list link while the frame is in the pool
+    volatile LONG refs;    // Holders of the frame; it goes back to the pool when the last releases it
+    hid_report report;     // What the pool hands out
+} pool_frame;
+
+// Fixed set of report frames shared by the HID reader, which fills them, and the
+// forwarder, which returns them once sent. A frame sent to several sinks is shared rather
+// than copied: each sink holds a reference and releases it once sent. Acquire, share and
+// release are lock-free and never allocate, so they are safe on any thread.
+typedef struct {
+    SLIST_HEADER freeList;       // Frames not in use
+    pool_frame* frames;          // One allocation holding every frame
+    LONG size;                   // Number of frames
+    volatile LONG inUse;         // Frames handed out and not yet returned
+    volatile LONG highWater;     // Most frames in use at once
+    volatile LONG64 exhausted;   // Acquires that found the pool empty
+} frame_pool;
+
+// Function prototypes
+bool init_frame_pool(frame_pool* pool, LONG size);
+void destroy_frame_pool(frame_pool* pool);
+hid_report* frame_pool_acquire(frame_pool* pool);
+void frame_pool_share(frame_pool* pool, hid_report* report, LONG holders);
+void frame_pool_release(frame_pool* pool, hid_report* report);
+LONG64 frame_pool_exhausted(frame_pool* pool);
+void frame_pool_log_summary(frame_pool* pool);
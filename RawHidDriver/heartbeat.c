@@ -0,0 +1,113 @@
+#include "heartbeat.h"
+#include "logger.h"
+
+/**
+ * Initializes a heartbeat with no pings outstanding.
+ *
+ * @param beat Pointer to the heartbeat struct to initialize.
+ */
+void init_heartbeat(heartbeat* beat) {
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        WriteRelease64(&beat->sentNs[i], 0);
+    }
+    histogram_reset(&beat->roundTrip);
+    beat->answered = 0;
+    beat->missed = 0;
+}
+
+/**
+ * Arms a slot. Call before writing the ping so a fast pong always finds it armed.
+ *
+ * @param beat The heartbeat.
+ * @param slot The mux slot of the device.
+ * @param now monotonic_ns when the ping is sent.
+ */
+void heartbeat_sent(heartbeat* beat, int slot, uint64_t now) {
+    WriteRelease64(&beat->sentNs[slot], (LONG64)now);
+}
+
+/**
+ * Called on the reader thread when a device answers. Records the round trip.
+ *
+ * @param beat The heartbeat.
+ * @param slot The mux slot of the device.
+ * @param now monotonic_ns when the pong was read.
+ * @return true if it answered an outstanding ping, false for a late or unsolicited pong.
+ */
+bool heartbeat_pong(heartbeat* beat, int slot, uint64_t now) {
+    uint64_t sent = (uint64_t)InterlockedExchange64(&beat->sentNs[slot], 0);
+    if (sent == 0) {
+        return false;
+    }
+    histogram_record(&beat->roundTrip, now - sent);
+    InterlockedIncrement64(&beat->answered);
+    return true;
+}
+
+/**
+ * Checks whether a slot's ping went unanswered for longer than the timeout, and disarms
+ * it if so, so each missed ping is reported once.
+ *
+ * @param beat The heartbeat.
+ * @param slot The mux slot of the device.
+ * @param now The current monotonic_ns.
+ * @param timeoutNs How long a device has to answer.
+ * @return true if the ping timed out.
+ */
+bool heartbeat_expired(heartbeat* beat, int slot, uint64_t now, uint64_t timeoutNs) {
+    LONG64 sent = ReadAcquire64(&beat->sentNs[slot]);
+    if (sent == 0 || now - (uint64_t)sent < timeoutNs) {
+        return false;
+    }
+    // The pong may land while we look; whoever swaps the slot to 0 first decides
+    if (InterlockedCompareExchange64(&beat->sentNs[slot], 0, sent) != sent) {
+        return false;
+    }
+    InterlockedIncrement64(&beat->missed);
+    return true;
+}
+
+/**
+ * Disarms a slot, e.g. because its device was closed.
+ *
+ * @param beat The heartbeat.
+ * @param slot The mux slot.
+ */
+void heartbeat_clear(heartbeat* beat, int slot) {
+    WriteRelease64(&beat->sentNs[slot], 0);
+}
+
+/**
+ * @return The monotonic_ns at which the oldest outstanding ping times out, 0 if none is outstanding.
+ */
+uint64_t heartbeat_next_deadline(heartbeat* beat, uint64_t timeoutNs) {
+    uint64_t deadline = 0;
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        uint64_t sent = (uint64_t)ReadAcquire64(&beat->sentNs[i]);
+        if (sent != 0 && (deadline == 0 || sent + timeoutNs < deadline)) {
+            deadline = sent + timeoutNs;
+        }
+    }
+    return deadline;
+}
+
+/**
+ * Logs the pings answered and missed since startup, and their round-trip distribution if
+ * any was answered. A server that never answers still shows up as all missed.
+ *
+ * @param beat The heartbeat.
+ */
+void heartbeat_log_summary(heartbeat* beat) {
+    const histogram* rtt = &beat->roundTrip;
+    if (histogram_count(rtt) == 0) {
+        write_log_format(LOGLEVEL_INFO, "Heartbeat - %lld answered, %lld missed",
+            ReadNoFence64(&beat->answered), ReadNoFence64(&beat->missed));
+        return;
+    }
+    write_log_format(LOGLEVEL_INFO, "Heartbeat - %lld answered, %lld missed; RTT us p50 %llu p99 %llu p99.9 %llu max %llu",
+        ReadNoFence64(&beat->answered), ReadNoFence64(&beat->missed),
+        (unsigned long long)(histogram_percentile(rtt, 50.0) / 1000),
+        (unsigned long long)(histogram_percentile(rtt, 99.0) / 1000),
+        (unsigned long long)(histogram_percentile(rtt, 99.9) / 1000),
+        (unsigned long long)(histogram_max(rtt) / 1000));
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "histogram.h"
+#include "hid_mux.h"
+
+// Tracks outstanding pings without waiting for them. The main thread arms a slot when it
+// sends a ping; the reader thread disarms it when the pong arrives and records the round
+// trip; the main thread later finds slots that stayed armed past the timeout.
+typedef struct {
+    volatile LONG64 sentNs[HID_MUX_MAX_DEVICES];  // monotonic_ns of the outstanding ping per slot, 0 if none
+    histogram roundTrip;                          // Round-trip times of answered pings, in ns
+    volatile LONG64 answered;                     // Pongs that matched an outstanding ping
+    volatile LONG64 missed;                       // Pings that timed out
+} heartbeat;
+
+// Function prototypes
+void init_heartbeat(heartbeat* beat);
+void heartbeat_sent(heartbeat* beat, int slot, uint64_t now);
+bool heartbeat_pong(heartbeat* beat, int slot, uint64_t now);
+bool heartbeat_expired(heartbeat* beat, int slot, uint64_t now, uint64_t timeoutNs);
+void heartbeat_clear(heartbeat* beat, int slot);
+uint64_t heartbeat_next_deadline(heartbeat* beat, uint64_t timeoutNs);
+void heartbeat_log_summary(heartbeat* beat);
@@ -0,0 +1,253 @@
+#include "hex_encode.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define HEX_ENCODE_X86 1
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Writes length bytes as hex to out. Spaced kernels write three characters per byte,
+// including a space after the last one; hex_encode overwrites it with the terminator.
+typedef void (*hex_kernel)(const unsigned char* data, size_t length, char* out, bool spaced);
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+// Both digits of every byte value, so the scalar loop does one lookup per byte
+static char hexPairs[256][2];
+
+/**
+ * Table-driven fallback, also used for the tail the vector kernels leave over.
+ */
+static void hex_encode_scalar(const unsigned char* data, size_t length, char* out, bool spaced) {
+    for (size_t i = 0; i < length; i++) {
+        out[0] = hexPairs[data[i]][0];
+        out[1] = hexPairs[data[i]][1];
+        if (spaced) {
+            out[2] = ' ';
+            out += 3;
+        }
+        else {
+            out += 2;
+        }
+    }
+}
+
+#ifdef HEX_ENCODE_X86
+
+/**
+ * Spreads 32 unspaced hex digits (16 bytes) over 48 characters, a space after each pair.
+ *
+ * @param digitsLow Digits of bytes 0 to 7.
+ * @param digitsHigh Digits of bytes 8 to 15.
+ * @param out Receives 48 characters.
+ */
+static void store_spaced_16(__m128i digitsLow, __m128i digitsHigh, char* out) {
+    const __m128i block0 = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+    const __m128i block1Low = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i block1High = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, -1, 2, 3, -1, 4, 5);
+    const __m128i block2 = _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13, -1, 14, 15, -1);
+    const __m128i spaces0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+    const __m128i spaces1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0);
+    const __m128i spaces2 = _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ');
+
+    __m128i out0 = _mm_or_si128(_mm_shuffle_epi8(digitsLow, block0), spaces0);
+    __m128i out1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(digitsLow, block1Low), _mm_shuffle_epi8(digitsHigh, block1High)), spaces1);
+    __m128i out2 = _mm_or_si128(_mm_shuffle_epi8(digitsHigh, block2), spaces2);
+
+    _mm_storeu_si128((__m128i*)out, out0);
+    _mm_storeu_si128((__m128i*)(out + 16), out1);
+    _mm_storeu_si128((__m128i*)(out + 32), out2);
+}
+
+/**
+ * SSSE3 kernel: 16 bytes per iteration. Nibbles index a 16-entry digit table with
+ * pshufb, then high and low digits are interleaved into output order.
+ */
+static void hex_encode_ssse3(const unsigned char* data, size_t length, char* out, bool spaced) {
+    const __m128i digits = _mm_loadu_si128((const __m128i*)hexDigits);
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask));
+        __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibbleMask));
+        __m128i first = _mm_unpacklo_epi8(high, low);
+        __m128i second = _mm_unpackhi_epi8(high, low);
+
+        if (spaced) {
+            store_spaced_16(first, second, out);
+            out += 48;
+        }
+        else {
+            _mm_storeu_si128((__m128i*)out, first);
+            _mm_storeu_si128((__m128i*)(out + 16), second);
+            out += 32;
+        }
+    }
+
+    hex_encode_scalar(data + i, length - i, out, spaced);
+}
+
+/**
+ * AVX2 kernel: 32 bytes per iteration. The unpacks work within 128-bit lanes, so the
+ * halves are put back in order with a cross-lane permute before storing.
+ */
+static void hex_encode_avx2(const unsigned char* data, size_t length, char* out, bool spaced) {
+    const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hexDigits));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i high = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask));
+        __m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(bytes, nibbleMask));
+        __m256i unpackedLow = _mm256_unpacklo_epi8(high, low);   // Bytes 0-7 | 16-23
+        __m256i unpackedHigh = _mm256_unpackhi_epi8(high, low);  // Bytes 8-15 | 24-31
+        __m256i first = _mm256_permute2x128_si256(unpackedLow, unpackedHigh, 0x20);
+        __m256i second = _mm256_permute2x128_si256(unpackedLow, unpackedHigh, 0x31);
+
+        if (spaced) {
+            store_spaced_16(_mm256_castsi256_si128(first), _mm256_extracti128_si256(first, 1), out);
+            store_spaced_16(_mm256_castsi256_si128(second), _mm256_extracti128_si256(second, 1), out + 48);
+            out += 96;
+        }
+        else {
+            _mm256_storeu_si256((__m256i*)out, first);
+            _mm256_storeu_si256((__m256i*)(out + 32), second);
+            out += 64;
+        }
+    }
+
+    hex_encode_ssse3(data + i, length - i, out, spaced);
+}
+
+/**
+ * @return true if the CPU and the OS support AVX2 (the OS must save the YMM registers).
+ */
+static bool cpu_has_avx2(void) {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+/**
+ * @return true if the CPU supports SSSE3.
+ */
+static bool cpu_has_ssse3(void) {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+}
+
+#endif
+
+static hex_kernel selectedKernel = NULL;
+static const char* selectedName = "none";
+
+/**
+ * Selects the kernel used by hex_encode. Called automatically on first use; the
+ * benchmark calls it to compare kernels.
+ *
+ * @param kernel The kernel to use, or HEX_KERNEL_AUTO for the best one available.
+ * @return true if the kernel was selected, false if the CPU does not support it.
+ */
+bool hex_encode_select(hex_kernel_id kernel) {
+    for (int i = 0; i < 256; i++) {
+        hexPairs[i][0] = hexDigits[i >> 4];
+        hexPairs[i][1] = hexDigits[i & 0x0F];
+    }
+
+#ifdef HEX_ENCODE_X86
+    bool avx2 = cpu_has_avx2();
+    bool ssse3 = cpu_has_ssse3();
+
+    if (kernel == HEX_KERNEL_AUTO) {
+        kernel = avx2 ? HEX_KERNEL_AVX2 : ssse3 ? HEX_KERNEL_SSSE3 : HEX_KERNEL_SCALAR;
+    }
+    if (kernel == HEX_KERNEL_AVX2 && avx2) {
+        selectedKernel = hex_encode_avx2;
+        selectedName = "avx2";
+        return true;
+    }
+    if (kernel == HEX_KERNEL_SSSE3 && ssse3) {
+        selectedKernel = hex_encode_ssse3;
+        selectedName = "ssse3";
+        return true;
+    }
+#else
+    if (kernel == HEX_KERNEL_AUTO) {
+        kernel = HEX_KERNEL_SCALAR;
+    }
+#endif
+
+    if (kernel == HEX_KERNEL_SCALAR) {
+        selectedKernel = hex_encode_scalar;
+        selectedName = "scalar";
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @return The name of the kernel in use, e.g. "avx2".
+ */
+const char* hex_encode_kernel_name(void) {
+    if (!selectedKernel) {
+        hex_encode_select(HEX_KERNEL_AUTO);
+    }
+    return selectedName;
+}
+
+/**
+ * Encodes bytes as upper-case hex. Encodes as many whole bytes as fit and always
+ * null-terminates the output.
+ *
+ * @param data The bytes to encode.
+ * @param length The number of bytes.
+ * @param out The output buffer; HEX_ENCODED_SIZE(length, spaced) bytes for the full array.
+ * @param outSize The size of the output buffer.
+ * @param spaced true for "AA BB CC", false for "AABBCC".
+ * @return The number of characters written, not counting the terminator.
+ */
+size_t hex_encode(const unsigned char* data, size_t length, char* out, size_t outSize, bool spaced) {
+    if (outSize == 0) {
+        return 0;
+    }
+    if (!selectedKernel) {
+        // Selection is idempotent, so threads racing here all pick the same kernel
+        hex_encode_select(HEX_KERNEL_AUTO);
+    }
+
+    size_t fits = spaced ? outSize / 3 : (outSize - 1) / 2;
+    if (length > fits) {
+        length = fits;
+    }
+    if (length == 0) {
+        out[0] = '\0';
+        return 0;
+    }
+
+    // Below one vector the kernels would only run their scalar tail anyway
+    if (length < 16) {
+        hex_encode_scalar(data, length, out, spaced);
+    }
+    else {
+        selectedKernel(data, length, out, spaced);
+    }
+
+    // The spaced kernels leave a space after the last byte; it becomes the terminator
+    size_t written = spaced ? length * 3 - 1 : length * 2;
+    out[written] = '\0';
+    return written;
+}
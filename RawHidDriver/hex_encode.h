@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Upper-case hex encoding of byte arrays, for byte-array logging and the text wire mode.
+// The kernel is picked at first use from what the CPU supports: AVX2, SSSE3, or a
+// table-driven scalar loop.
+
+// Characters needed to encode length bytes, including the terminator.
+// Spaced output separates bytes with one space: "AA BB CC".
+#define HEX_ENCODED_SIZE(length, spaced) ((spaced) ? ((length) ? (length) * 3 : 1) : (length) * 2 + 1)
+
+typedef enum {
+    HEX_KERNEL_AUTO = 0,  // Best kernel the CPU supports
+    HEX_KERNEL_SCALAR,
+    HEX_KERNEL_SSSE3,
+    HEX_KERNEL_AVX2
+} hex_kernel_id;
+
+// Function prototypes
+size_t hex_encode(const unsigned char* data, size_t length, char* out, size_t outSize, bool spaced);
+bool hex_encode_select(hex_kernel_id kernel);
+const char* hex_encode_kernel_name(void);
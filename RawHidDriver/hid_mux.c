@@ -0,0 +1,638 @@
+#include "hid_mux.h"
+#include <hidsdi.h>
+#include <string.h>
+#include "timing.h"
+
+// Completions dequeued per wake-up
+#define MUX_BATCH_SIZE 64
+
+// Input reports the HID class driver buffers per handle (its default is 32). A deeper
+// buffer rides out a stalled reader instead of silently dropping the oldest reports.
+#define MUX_INPUT_BUFFERS 512
+
+// Completion key posted by stop_hid_mux to wake the reader
+#define MUX_WAKE_KEY ((ULONG_PTR)-1)
+
+/**
+ * Starts an overlapped read of the next input report. The caller must already hold a
+ * pending count on the device, so the count cannot drop to zero while reads are issued.
+ *
+ * @param mux The multiplexer.
+ * @param device The device to read from.
+ * @param read The read slot to reuse.
+ * @return ERROR_SUCCESS if the read is outstanding, the error code otherwise.
+ */
+static DWORD issue_read(hid_mux* mux, mux_device* device, mux_read* read) {
+    memset(&read->overlapped, 0, sizeof(read->overlapped));
+    if (mux->engine == HID_MUX_ENGINE_THREADS) {
+        read->overlapped.hEvent = device->readEvent;
+    }
+
+    InterlockedIncrement(&device->pending);
+    InterlockedIncrement64(&mux->readsIssued);
+    if (!ReadFile(device->file, read->report->buffer + REPORT_HEADROOM, device->inputLength, NULL, &read->overlapped)) {
+        DWORD error = GetLastError();
+        if (error != ERROR_IO_PENDING) {
+            InterlockedDecrement(&device->pending);
+            return error;
+        }
+    }
+    return ERROR_SUCCESS;
+}
+
+/**
+ * Drops one pending count. The last one sets idleEvent, which hid_mux_remove waits for.
+ */
+static void release_pending(mux_device* device) {
+    if (InterlockedDecrement(&device->pending) == 0) {
+        SetEvent(device->idleEvent);
+    }
+}
+
+/**
+ * Returns the frames of a device's reads to the pool. No read may be outstanding.
+ */
+static void release_frames(hid_mux* mux, mux_device* device) {
+    for (int i = 0; i < HID_MUX_READS_IN_FLIGHT; i++) {
+        frame_pool_release(mux->pool, device->reads[i].report);
+        device->reads[i].report = NULL;
+    }
+}
+
+/**
+ * Marks a device as failed and reports it. A device being removed is left alone.
+ *
+ * @param mux The multiplexer.
+ * @param device The device that failed.
+ * @param error The Win32 error code.
+ */
+static void fail_device(hid_mux* mux, mux_device* device, DWORD error) {
+    if (InterlockedCompareExchange(&device->state, MUX_DEVICE_FAILED, MUX_DEVICE_OPEN) != MUX_DEVICE_OPEN) {
+        return;
+    }
+
+    write_log_format(LOGLEVEL_ERROR, "HID Mux - Device 0x%04x failed. Error Code: %lu", device->deviceId, error);
+    if (mux->on_error) {
+        if (mux->engine == HID_MUX_ENGINE_THREADS) {
+            AcquireSRWLockExclusive(&mux->deliverLock);
+        }
+        mux->on_error(device, error, mux->context);
+        if (mux->engine == HID_MUX_ENGINE_THREADS) {
+            ReleaseSRWLockExclusive(&mux->deliverLock);
+        }
+    }
+}
+
+/**
+ * Handles one completed read: delivers the report and reissues the read. With the
+ * threads engine this is also where the device thread blocks until the read completes.
+ *
+ * @param mux The multiplexer.
+ * @param device The device whose read completed.
+ * @param read The read that completed.
+ * @return true if the read was reissued.
+ */
+static bool complete_read(hid_mux* mux, mux_device* device, mux_read* read) {
+    DWORD bytes = 0;
+    BOOL ok = GetOverlappedResult(device->file, &read->overlapped, &bytes, mux->engine == HID_MUX_ENGINE_THREADS);
+    DWORD error = ok ? ERROR_SUCCESS : GetLastError();
+
+    if (ReadAcquire(&device->state) != MUX_DEVICE_OPEN) {
+        // Cancelled by hid_mux_remove, or another read already failed
+        release_pending(device);
+        return false;
+    }
+    if (!ok) {
+        fail_device(mux, device, error);
+        release_pending(device);
+        return false;
+    }
+
+    hid_report* report = read->report;
+    int length = (int)bytes;
+    report->timestamp = monotonic_ns();
+    report->data = report->buffer + REPORT_HEADROOM;
+    if (length > 0 && report->data[0] == 0) {
+        // Unnumbered report; drop the placeholder report ID like hid_read does
+        report->data++;
+        length--;
+    }
+    if (length > 0) {
+        // The handler keeps the frame, so the next read needs a fresh one. Without one
+        // the report is dropped and its frame read into again.
+        hid_report* next = frame_pool_acquire(mux->pool);
+        if (next) {
+            read->report = next;
+            report->length = (uint16_t)length;
+            report->device_id = device->deviceId;
+            if (mux->engine == HID_MUX_ENGINE_THREADS) {
+                // Handlers never run concurrently, whichever engine calls them
+                AcquireSRWLockExclusive(&mux->deliverLock);
+                mux->on_report(device, report, mux->context);
+                ReleaseSRWLockExclusive(&mux->deliverLock);
+            }
+            else {
+                mux->on_report(device, report, mux->context);
+            }
+            InterlockedIncrement64(&mux->reports);
+        }
+        else {
+            InterlockedIncrement64(&mux->dropped);
+        }
+    }
+
+    // Reissue before releasing the completed read, so the count only reaches zero once
+    // the device has stopped
+    error = issue_read(mux, device, read);
+    if (error != ERROR_SUCCESS) {
+        fail_device(mux, device, error);
+    }
+    release_pending(device);
+    return error == ERROR_SUCCESS;
+}
+
+/**
+ * Reader thread entry point for the completion port engine. Sleeps on the port until
+ * any device has a report, then handles every completion already queued before
+ * sleeping again.
+ *
+ * @param param Pointer to the owning hid_mux.
+ * @return Always 0.
+ */
+static DWORD WINAPI mux_thread(LPVOID param) {
+    hid_mux* mux = (hid_mux*)param;
+    OVERLAPPED_ENTRY entries[MUX_BATCH_SIZE];
+
+    write_log(LOGLEVEL_DEBUG, "HID Mux - Thread started");
+
+    while (ReadAcquire(&mux->running)) {
+        ULONG count = 0;
+        InterlockedIncrement64(&mux->waits);
+        if (!GetQueuedCompletionStatusEx(mux->port, entries, MUX_BATCH_SIZE, &count, HID_MUX_WAIT_MS, FALSE)) {
+            continue;  // Timed out
+        }
+
+        for (ULONG i = 0; i < count; i++) {
+            if (entries[i].lpCompletionKey == MUX_WAKE_KEY) {
+                continue;
+            }
+            // The key is the slot; the OVERLAPPED is the first member of its mux_read
+            complete_read(mux, &mux->devices[entries[i].lpCompletionKey], (mux_read*)entries[i].lpOverlapped);
+        }
+    }
+
+    write_log(LOGLEVEL_DEBUG, "HID Mux - Thread exiting");
+    return 0;
+}
+
+/**
+ * Device thread entry point for the threads engine: one blocking read at a time, the
+ * way hid_read works. Exits once the device fails or is removed.
+ *
+ * @param param Pointer to the mux_device to read.
+ * @return Always 0.
+ */
+static DWORD WINAPI device_thread(LPVOID param) {
+    mux_device* device = (mux_device*)param;
+    hid_mux* mux = CONTAINING_RECORD(device - device->slot, hid_mux, devices);
+
+    do {
+        InterlockedIncrement64(&mux->waits);
+    } while (complete_read(mux, device, &device->reads[0]));
+    return 0;
+}
+
+/**
+ * Starts the multiplexer. Devices can be added before or after it starts.
+ *
+ * @param mux Pointer to the hid_mux struct to initialize.
+ * @param engine How reads are waited for; HID_MUX_ENGINE_IOCP unless comparing.
+ * @param pool Frames the devices read into; reports are handed to on_report in them.
+ * @param on_report Callback invoked on a reader thread for each report.
+ * @param on_error Callback invoked on a reader thread when a device fails; may be NULL.
+ * @param context Pointer passed through to the callbacks.
+ * @return true if the multiplexer was started, false otherwise.
+ */
+bool start_hid_mux(hid_mux* mux, hid_mux_engine engine, frame_pool* pool, mux_report_handler on_report, mux_error_handler on_error, void* context) {
+    // Check for invalid arguments
+    if (!mux || !pool || !on_report) {
+        write_log(LOGLEVEL_ERROR, "HID Mux - Invalid arguments");
+        return false;
+    }
+
+    memset(mux, 0, sizeof(*mux));
+    mux->engine = engine;
+    mux->pool = pool;
+    mux->on_report = on_report;
+    mux->on_error = on_error;
+    mux->context = context;
+    InitializeSRWLock(&mux->deliverLock);
+
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        mux->devices[i].slot = i;
+    }
+
+    if (engine == HID_MUX_ENGINE_THREADS) {
+        // Each device gets its own thread when it is added
+        mux->running = 1;
+        write_log(LOGLEVEL_INFO, "HID Mux - Started with one thread per device");
+        return true;
+    }
+
+    // One concurrent thread: every completion is handled by the reader, in order
+    mux->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (mux->port == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to create completion port. Error Code: %lu", GetLastError());
+        return false;
+    }
+
+    mux->running = 1;
+    mux->thread = CreateThread(NULL, 0, mux_thread, mux, 0, NULL);
+    if (mux->thread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to create thread. Error Code: %lu", GetLastError());
+        mux->running = 0;
+        CloseHandle(mux->port);
+        mux->port = NULL;
+        return false;
+    }
+
+    // Keystrokes should never wait behind background work for a time slice
+    SetThreadPriority(mux->thread, THREAD_PRIORITY_HIGHEST);
+
+    write_log(LOGLEVEL_INFO, "HID Mux - Reader thread started");
+    return true;
+}
+
+/**
+ * Removes every device, then stops the reader thread and waits for it to exit.
+ *
+ * @param mux Pointer to the hid_mux to stop.
+ */
+void stop_hid_mux(hid_mux* mux) {
+    if (!mux || !ReadAcquire(&mux->running)) {
+        return;
+    }
+
+    // Removal needs the reader to see the cancelled reads, so it goes first
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        hid_mux_remove(mux, i);
+    }
+
+    WriteRelease(&mux->running, 0);
+    if (mux->thread) {
+        PostQueuedCompletionStatus(mux->port, 0, MUX_WAKE_KEY, NULL);
+        WaitForSingleObject(mux->thread, INFINITE);
+        CloseHandle(mux->thread);
+        mux->thread = NULL;
+    }
+
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        if (mux->devices[i].idleEvent) {
+            CloseHandle(mux->devices[i].idleEvent);
+            CloseHandle(mux->devices[i].readEvent);
+            CloseHandle(mux->devices[i].writeEvent);
+        }
+    }
+    if (mux->port) {
+        CloseHandle(mux->port);
+        mux->port = NULL;
+    }
+
+    write_log(LOGLEVEL_INFO, "HID Mux - Reader thread stopped");
+}
+
+/**
+ * Adds an already open handle to the multiplexer and starts reading from it. The handle
+ * must have been opened with FILE_FLAG_OVERLAPPED; the multiplexer closes it on removal.
+ * Add and remove devices from one thread only.
+ *
+ * @param mux The multiplexer.
+ * @param file The handle to read from.
+ * @param deviceId The id to stamp on reports from this device.
+ * @param inputLength Bytes per input report, report ID included.
+ * @param outputLength Bytes per output report, report ID included; 0 if it is never written.
+ * @return The slot of the device, or -1 if it could not be added.
+ */
+int hid_mux_add_handle(hid_mux* mux, HANDLE file, uint16_t deviceId, DWORD inputLength, DWORD outputLength) {
+    if (inputLength == 0 || inputLength > HID_MUX_MAX_REPORT || outputLength > HID_MUX_MAX_REPORT) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Unsupported report length: input %lu, output %lu", inputLength, outputLength);
+        return -1;
+    }
+
+    mux_device* device = NULL;
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        if (ReadAcquire(&mux->devices[i].state) == MUX_DEVICE_FREE) {
+            device = &mux->devices[i];
+            break;
+        }
+    }
+    if (!device) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - All %d device slots are in use", HID_MUX_MAX_DEVICES);
+        return -1;
+    }
+
+    if (!device->idleEvent) {
+        device->idleEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+        device->readEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        device->writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (!device->idleEvent || !device->readEvent || !device->writeEvent) {
+            write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to create device events. Error Code: %lu", GetLastError());
+            return -1;
+        }
+    }
+
+    // The threads engine waits on one read at a time, as hid_read does
+    int reads = mux->engine == HID_MUX_ENGINE_THREADS ? 1 : HID_MUX_READS_IN_FLIGHT;
+    for (int i = 0; i < reads; i++) {
+        device->reads[i].report = frame_pool_acquire(mux->pool);
+        if (!device->reads[i].report) {
+            write_log(LOGLEVEL_ERROR, "HID Mux - No free frames to read into");
+            release_frames(mux, device);
+            return -1;
+        }
+    }
+    if (mux->engine == HID_MUX_ENGINE_IOCP &&
+        CreateIoCompletionPort(file, mux->port, (ULONG_PTR)device->slot, 0) == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to bind device to the completion port. Error Code: %lu", GetLastError());
+        release_frames(mux, device);
+        return -1;
+    }
+
+    device->file = file;
+    device->deviceId = deviceId;
+    device->inputLength = inputLength;
+    device->outputLength = outputLength;
+    device->generation = InterlockedIncrement(&mux->opens);
+    WriteRelease(&device->state, MUX_DEVICE_OPEN);
+
+    // Hold a count of our own while issuing, so a read completing straight away cannot
+    // make the device look idle before the rest are outstanding
+    ResetEvent(device->idleEvent);
+    device->pending = 1;
+    DWORD error = ERROR_SUCCESS;
+    for (int i = 0; i < reads && error == ERROR_SUCCESS; i++) {
+        error = issue_read(mux, device, &device->reads[i]);
+    }
+    if (error == ERROR_SUCCESS && mux->engine == HID_MUX_ENGINE_THREADS) {
+        device->thread = CreateThread(NULL, 0, device_thread, device, 0, NULL);
+        if (device->thread == NULL) {
+            error = GetLastError();
+        }
+        else {
+            SetThreadPriority(device->thread, THREAD_PRIORITY_HIGHEST);
+        }
+    }
+
+    if (error != ERROR_SUCCESS) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to start reading device 0x%04x. Error Code: %lu", deviceId, error);
+        InterlockedExchange(&device->state, MUX_DEVICE_CLOSING);
+        CancelIoEx(device->file, NULL);
+        if (mux->engine == HID_MUX_ENGINE_THREADS && ReadAcquire(&device->pending) > 1) {
+            // No device thread to see the cancelled read; finish it here
+            DWORD bytes;
+            GetOverlappedResult(device->file, &device->reads[0].overlapped, &bytes, TRUE);
+            release_pending(device);
+        }
+    }
+    release_pending(device);
+
+    if (error != ERROR_SUCCESS) {
+        // The reader releases the reads that did start; wait so the caller can close the handle
+        WaitForSingleObject(device->idleEvent, INFINITE);
+        release_frames(mux, device);
+        device->file = NULL;
+        WriteRelease(&device->state, MUX_DEVICE_FREE);
+        return -1;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "HID Mux - Device 0x%04x added in slot %d", deviceId, device->slot);
+    return device->slot;
+}
+
+/**
+ * Opens a HID device by path for overlapped I/O and adds it to the multiplexer.
+ *
+ * @param mux The multiplexer.
+ * @param path The device path, as returned by hid_enumerate.
+ * @param deviceId The id to stamp on reports from this device.
+ * @param usagePage The usage page the device must report, or 0 to accept any.
+ * @param usage The usage the device must report, or 0 to accept any.
+ * @return The slot of the device, or -1 if it could not be opened or is not the expected collection.
+ */
+int hid_mux_open_path(hid_mux* mux, const char* path, uint16_t deviceId, uint16_t usagePage, uint16_t usage) {
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to open %s. Error Code: %lu", path, GetLastError());
+        return -1;
+    }
+
+    // Report lengths come from the device's report descriptor
+    PHIDP_PREPARSED_DATA preparsed;
+    HIDP_CAPS caps;
+    if (!HidD_GetPreparsedData(file, &preparsed)) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to read the report descriptor of %s", path);
+        CloseHandle(file);
+        return -1;
+    }
+    NTSTATUS status = HidP_GetCaps(preparsed, &caps);
+    HidD_FreePreparsedData(preparsed);
+    if (status != HIDP_STATUS_SUCCESS) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Failed to get the capabilities of %s", path);
+        CloseHandle(file);
+        return -1;
+    }
+
+    // A path remembered from an earlier run may now belong to another collection
+    if ((usagePage != 0 && caps.UsagePage != usagePage) || (usage != 0 && caps.Usage != usage)) {
+        write_log_format(LOGLEVEL_WARN, "HID Mux - %s is usage 0x%x:0x%x, expected 0x%x:0x%x",
+            path, caps.UsagePage, caps.Usage, usagePage, usage);
+        CloseHandle(file);
+        return -1;
+    }
+
+    HidD_SetNumInputBuffers(file, MUX_INPUT_BUFFERS);
+
+    int slot = hid_mux_add_handle(mux, file, deviceId, caps.InputReportByteLength, caps.OutputReportByteLength);
+    if (slot < 0) {
+        CloseHandle(file);
+    }
+    return slot;
+}
+
+/**
+ * Stops reading from a device and closes it. Safe on free and failed slots.
+ *
+ * @param mux The multiplexer.
+ * @param slot The slot returned when the device was added.
+ */
+void hid_mux_remove(hid_mux* mux, int slot) {
+    if (slot < 0 || slot >= HID_MUX_MAX_DEVICES) {
+        return;
+    }
+
+    mux_device* device = &mux->devices[slot];
+    if (ReadAcquire(&device->state) == MUX_DEVICE_FREE) {
+        return;
+    }
+
+    // The reader may be about to reissue a read it already dequeued, so keep cancelling
+    // until it has acknowledged the removal
+    InterlockedExchange(&device->state, MUX_DEVICE_CLOSING);
+    do {
+        CancelIoEx(device->file, NULL);
+    } while (WaitForSingleObject(device->idleEvent, 10) == WAIT_TIMEOUT);
+    if (device->thread) {
+        WaitForSingleObject(device->thread, INFINITE);
+        CloseHandle(device->thread);
+        device->thread = NULL;
+    }
+    release_frames(mux, device);
+
+    // A write in progress keeps using the handle until it completes
+    AcquireSRWLockExclusive(&device->writeLock);
+    CloseHandle(device->file);
+    device->file = NULL;
+    WriteRelease(&device->state, MUX_DEVICE_FREE);
+    ReleaseSRWLockExclusive(&device->writeLock);
+
+    write_log_format(LOGLEVEL_INFO, "HID Mux - Device 0x%04x removed from slot %d", device->deviceId, slot);
+}
+
+/**
+ * Writes an output report to a device whose write lock is held and whose state was
+ * checked under it.
+ */
+static int write_report(mux_device* device, const unsigned char* data, size_t length) {
+    if (length > device->outputLength) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Cannot write %zu bytes to device 0x%04x", length, device->deviceId);
+        return -1;
+    }
+
+    unsigned char report[HID_MUX_MAX_REPORT] = { 0 };
+    memcpy(report, data, length);
+
+    // The low bit on the event keeps this completion off the completion port, which
+    // only carries reads
+    OVERLAPPED overlapped = { 0 };
+    overlapped.hEvent = (HANDLE)((ULONG_PTR)device->writeEvent | 1);
+
+    DWORD written = 0;
+    if (!WriteFile(device->file, report, device->outputLength, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Write to device 0x%04x failed. Error Code: %lu", device->deviceId, GetLastError());
+        return -1;
+    }
+    if (WaitForSingleObject(device->writeEvent, HID_MUX_WRITE_TIMEOUT_MS) != WAIT_OBJECT_0) {
+        CancelIoEx(device->file, &overlapped);
+        WaitForSingleObject(device->writeEvent, INFINITE);
+    }
+    if (!GetOverlappedResult(device->file, &overlapped, &written, FALSE)) {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Write to device 0x%04x failed. Error Code: %lu", device->deviceId, GetLastError());
+        return -1;
+    }
+    return (int)written;
+}
+
+/**
+ * Writes an output report, padded with zeros to the device's output report length.
+ * Safe from any thread; writes to one device are serialized.
+ *
+ * @param mux The multiplexer.
+ * @param slot The slot of the device.
+ * @param data The report, starting with the report ID (0 if the device has none).
+ * @param length The number of bytes in data.
+ * @return The number of bytes written, or -1 if an error occurs.
+ */
+int hid_mux_write(hid_mux* mux, int slot, const unsigned char* data, size_t length) {
+    if (slot < 0 || slot >= HID_MUX_MAX_DEVICES) {
+        return -1;
+    }
+
+    mux_device* device = &mux->devices[slot];
+    int result = -1;
+
+    AcquireSRWLockExclusive(&device->writeLock);
+    if (ReadAcquire(&device->state) == MUX_DEVICE_OPEN) {
+        result = write_report(device, data, length);
+    }
+    else {
+        write_log_format(LOGLEVEL_ERROR, "HID Mux - Cannot write to slot %d; no device open", slot);
+    }
+    ReleaseSRWLockExclusive(&device->writeLock);
+    return result;
+}
+
+/**
+ * Writes an output report to the device with the given id, wherever its slot is.
+ * The id is checked under the write lock, so a slot reused by another device in the
+ * meantime is never written to by mistake.
+ *
+ * @param mux The multiplexer.
+ * @param deviceId The stable id of the device.
+ * @param data The report, starting with the report ID (0 if the device has none).
+ * @param length The number of bytes in data.
+ * @return The number of bytes written, or -1 if no such device is open or an error occurs.
+ */
+int hid_mux_write_id(hid_mux* mux, uint16_t deviceId, const unsigned char* data, size_t length) {
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        mux_device* device = &mux->devices[i];
+        if (ReadAcquire(&device->state) != MUX_DEVICE_OPEN || device->deviceId != deviceId) {
+            continue;
+        }
+
+        int result = -1;
+        AcquireSRWLockExclusive(&device->writeLock);
+        if (ReadAcquire(&device->state) == MUX_DEVICE_OPEN && device->deviceId == deviceId) {
+            result = write_report(device, data, length);
+        }
+        ReleaseSRWLockExclusive(&device->writeLock);
+        return result;
+    }
+    return -1;
+}
+
+/**
+ * Tells whether the device with an id is still the one seen before: the generation
+ * changes whenever the device is removed and added again, e.g. when it is replugged.
+ *
+ * @param mux The multiplexer.
+ * @param deviceId The stable id of the device.
+ * @return The generation of the open device with that id, or 0 if none is open.
+ */
+LONG hid_mux_generation(hid_mux* mux, uint16_t deviceId) {
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        mux_device* device = &mux->devices[i];
+        if (ReadAcquire(&device->state) == MUX_DEVICE_OPEN && device->deviceId == deviceId) {
+            return ReadNoFence(&device->generation);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @param mux The multiplexer.
+ * @return The number of slots in use, including failed devices not yet removed.
+ */
+int hid_mux_count(hid_mux* mux) {
+    int count = 0;
+    for (int i = 0; i < HID_MUX_MAX_DEVICES; i++) {
+        if (ReadAcquire(&mux->devices[i].state) != MUX_DEVICE_FREE) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Logs how many reports the multiplexer delivered and the system calls it made per
+ * report: one per wait for a completion plus one per read issued.
+ */
+void hid_mux_log_summary(hid_mux* mux) {
+    LONG64 reports = ReadAcquire64(&mux->reports);
+    LONG64 waits = ReadAcquire64(&mux->waits);
+    LONG64 readsIssued = ReadAcquire64(&mux->readsIssued);
+
+    write_log_format(LOGLEVEL_INFO, "HID Mux - %lld reports, %.2f syscalls per report (%lld waits, %lld reads), %lld dropped for want of a frame",
+        reports, reports > 0 ? (double)(waits + readsIssued) / (double)reports : 0.0, waits, readsIssued,
+        ReadAcquire64(&mux->dropped));
+}
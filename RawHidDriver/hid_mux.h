@@ -0,0 +1,104 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "logger.h"
+#include "frame_pool.h"
+
+// Most devices one multiplexer serves, and the largest report it reads, report ID included
+#define HID_MUX_MAX_DEVICES 32
+#define HID_MUX_MAX_REPORT REPORT_READ_BYTES
+
+// Upper bound on how long the reader blocks on the completion port before it re-checks
+// its stop flag. Completions wake it immediately; this only bounds shutdown time.
+#define HID_MUX_WAIT_MS 250
+
+// How long hid_mux_write waits for a device to accept an output report
+#define HID_MUX_WRITE_TIMEOUT_MS 1000
+
+// Reads kept outstanding per device. While the reader handles one report the next ones
+// complete into the other buffers, so a burst is dequeued in one wake-up.
+#define HID_MUX_READS_IN_FLIGHT 4
+
+typedef enum {
+    HID_MUX_ENGINE_IOCP = 0,  // One thread serves every device through a completion port
+    HID_MUX_ENGINE_THREADS    // One thread per device blocks on one read at a time, as hid_read does
+} hid_mux_engine;
+
+typedef enum {
+    MUX_DEVICE_FREE = 0,  // Slot unused
+    MUX_DEVICE_OPEN,      // A read is outstanding, or about to be reissued
+    MUX_DEVICE_FAILED,    // The device returned an error; no read outstanding
+    MUX_DEVICE_CLOSING    // hid_mux_remove is cancelling the outstanding read
+} mux_device_state;
+
+// One overlapped read. The OVERLAPPED comes first so a completion maps straight back
+// to its frame; the completion key gives the device.
+typedef struct {
+    OVERLAPPED overlapped;                     // Outstanding read
+    hid_report* report;                        // Pooled frame the read lands in
+} mux_read;
+
+// One device served by the multiplexer
+typedef struct {
+    mux_read reads[HID_MUX_READS_IN_FLIGHT];   // Outstanding reads, reissued as each completes
+    HANDLE file;                               // Device handle, opened for overlapped I/O
+    HANDLE idleEvent;                          // Set while no read is outstanding
+    HANDLE readEvent;                          // Completes reads with the threads engine
+    HANDLE writeEvent;                         // Completes writes made by hid_mux_write
+    HANDLE thread;                             // Device thread with the threads engine, otherwise NULL
+    volatile LONG pending;                     // Outstanding reads, plus one while reads are being issued
+    SRWLOCK writeLock;                         // Serializes writes, and keeps the handle open during one
+    volatile LONG state;                       // mux_device_state
+    int slot;                                  // Index in hid_mux.devices
+    uint16_t deviceId;                         // Stable id stamped on this device's reports
+    volatile LONG generation;                  // Numbers this opening of the device; a reopened device gets a new one
+    DWORD inputLength;                         // Bytes per input report, report ID included
+    DWORD outputLength;                        // Bytes per output report, report ID included; 0 if read-only
+} mux_device;
+
+// Called on the reader thread for every report, with the frame the device read into. The
+// handler owns the frame and must pass it on or return it to the pool. data, length and
+// device_id are set; the report ID byte is stripped when it is 0, as hid_read does, so
+// handlers see the same bytes either way.
+typedef void (*mux_report_handler)(const mux_device* device, hid_report* report, void* context);
+
+// Called on the reader thread when a device fails, e.g. because it was unplugged.
+// The device stays in its slot, in MUX_DEVICE_FAILED, until hid_mux_remove is called.
+typedef void (*mux_error_handler)(const mux_device* device, DWORD error, void* context);
+
+// Reads any number of HID devices from one thread. Every device handle is bound to one
+// I/O completion port with HID_MUX_READS_IN_FLIGHT overlapped reads outstanding; the
+// thread dequeues completions in batches, hands each report to on_report and reissues
+// the read. The threads engine instead gives each device a thread of its own, for
+// comparison; handlers are serialized either way.
+typedef struct {
+    hid_mux_engine engine;                        // How reads are waited for
+    frame_pool* pool;                             // Frames the devices read into
+    HANDLE port;                                  // I/O completion port shared by all devices; NULL with the threads engine
+    HANDLE thread;                                // Reader thread; NULL with the threads engine
+    volatile LONG running;                        // Cleared to ask the thread to exit
+    mux_report_handler on_report;                 // Called for each report, on a reader thread
+    mux_error_handler on_error;                   // Called when a device fails, on a reader thread
+    void* context;                                // Passed through to both handlers
+    SRWLOCK deliverLock;                          // Serializes handlers with the threads engine
+    volatile LONG64 reports;                      // Reports delivered
+    volatile LONG64 waits;                        // Blocking waits for completions
+    volatile LONG64 readsIssued;                  // ReadFile calls
+    volatile LONG64 dropped;                      // Reports dropped because the pool was empty
+    volatile LONG opens;                          // Devices added so far; numbers their generations
+    mux_device devices[HID_MUX_MAX_DEVICES];
+} hid_mux;
+
+// Function prototypes
+bool start_hid_mux(hid_mux* mux, hid_mux_engine engine, frame_pool* pool, mux_report_handler on_report, mux_error_handler on_error, void* context);
+void stop_hid_mux(hid_mux* mux);
+int hid_mux_add_handle(hid_mux* mux, HANDLE file, uint16_t deviceId, DWORD inputLength, DWORD outputLength);
+int hid_mux_open_path(hid_mux* mux, const char* path, uint16_t deviceId, uint16_t usagePage, uint16_t usage);
+void hid_mux_remove(hid_mux* mux, int slot);
+int hid_mux_write(hid_mux* mux, int slot, const unsigned char* data, size_t length);
+int hid_mux_write_id(hid_mux* mux, uint16_t deviceId, const unsigned char* data, size_t length);
+LONG hid_mux_generation(hid_mux* mux, uint16_t deviceId);
+int hid_mux_count(hid_mux* mux);
+void hid_mux_log_summary(hid_mux* mux);
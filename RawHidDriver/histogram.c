@@ -0,0 +1,146 @@
+#include "histogram.h"
+#include <string.h>
+
+/**
+ * Maps a value to its bucket. Values below HISTOGRAM_SUB_BUCKETS get a bucket each;
+ * above that, the top HISTOGRAM_SUB_BUCKET_BITS + 1 bits select the bucket.
+ */
+static int bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    unsigned long exponent;
+#ifdef _M_X64
+    _BitScanReverse64(&exponent, value);
+#else
+    if (value >> 32) {
+        _BitScanReverse(&exponent, (unsigned long)(value >> 32));
+        exponent += 32;
+    }
+    else {
+        _BitScanReverse(&exponent, (unsigned long)value);
+    }
+#endif
+    int shift = (int)exponent - HISTOGRAM_SUB_BUCKET_BITS;
+    int sub = (int)(value >> shift) - HISTOGRAM_SUB_BUCKETS;
+    return HISTOGRAM_SUB_BUCKETS + shift * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/**
+ * @return The largest value that maps to the bucket, the figure percentiles report.
+ */
+static uint64_t bucket_value(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int shift = (index - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS;
+    uint64_t sub = (uint64_t)((index - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS);
+    uint64_t lowest = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return lowest + ((1ULL << shift) - 1);
+}
+
+/**
+ * Clears every count. Not atomic with respect to concurrent recording.
+ *
+ * @param hist The histogram.
+ */
+void histogram_reset(histogram* hist) {
+    memset((void*)hist, 0, sizeof(*hist));
+}
+
+/**
+ * Records one value.
+ *
+ * @param hist The histogram.
+ * @param value The value, typically a latency in nanoseconds.
+ */
+void histogram_record(histogram* hist, uint64_t value) {
+    InterlockedIncrement64(&hist->counts[bucket_index(value)]);
+    InterlockedIncrement64(&hist->total);
+    InterlockedAdd64(&hist->sum, (LONG64)value);
+
+    LONG64 max = ReadNoFence64(&hist->max);
+    while ((LONG64)value > max) {
+        LONG64 previous = InterlockedCompareExchange64(&hist->max, (LONG64)value, max);
+        if (previous == max) {
+            break;
+        }
+        max = previous;
+    }
+}
+
+/**
+ * Records one value into a histogram no other thread records into at the same time.
+ * Plain loads and stores instead of four interlocked operations, so it costs a few
+ * nanoseconds; readers may see the counts a value or two behind.
+ *
+ * @param hist The histogram.
+ * @param value The value, typically a latency in nanoseconds.
+ */
+void histogram_record_owned(histogram* hist, uint64_t value) {
+    int index = bucket_index(value);
+
+    WriteNoFence64(&hist->counts[index], ReadNoFence64(&hist->counts[index]) + 1);
+    WriteNoFence64(&hist->total, ReadNoFence64(&hist->total) + 1);
+    WriteNoFence64(&hist->sum, ReadNoFence64(&hist->sum) + (LONG64)value);
+    if ((LONG64)value > ReadNoFence64(&hist->max)) {
+        WriteNoFence64(&hist->max, (LONG64)value);
+    }
+}
+
+/**
+ * @return The number of values recorded.
+ */
+uint64_t histogram_count(const histogram* hist) {
+    return (uint64_t)ReadNoFence64(&hist->total);
+}
+
+/**
+ * @return The largest value recorded, 0 if none.
+ */
+uint64_t histogram_max(const histogram* hist) {
+    return (uint64_t)ReadNoFence64(&hist->max);
+}
+
+/**
+ * @return The mean of the recorded values, 0 if none.
+ */
+double histogram_mean(const histogram* hist) {
+    uint64_t count = histogram_count(hist);
+    return count ? (double)(uint64_t)ReadNoFence64(&hist->sum) / (double)count : 0.0;
+}
+
+/**
+ * Returns the value at or below which the given share of recorded values fall.
+ *
+ * @param hist The histogram.
+ * @param percentile The percentile, 0 to 100, e.g. 99.9.
+ * @return The value, accurate to the bucket width, and never above the recorded maximum. 0 if empty.
+ */
+uint64_t histogram_percentile(const histogram* hist, double percentile) {
+    uint64_t count = histogram_count(hist);
+    if (count == 0) {
+        return 0;
+    }
+
+    // Rank of the value sought, 1-based; percentile 0 means the smallest value
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += (uint64_t)ReadNoFence64(&hist->counts[i]);
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            uint64_t max = histogram_max(hist);
+            return value < max ? value : max;
+        }
+    }
+    return histogram_max(hist);
+}
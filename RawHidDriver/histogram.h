@@ -0,0 +1,30 @@
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+
+// Log-linear latency histogram in the style of HdrHistogram: each power of two is split
+// into HISTOGRAM_SUB_BUCKETS linear buckets, so any recorded value is reported within
+// 1/HISTOGRAM_SUB_BUCKETS (6.25%) of itself, from 1 ns up to the full 64-bit range.
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + (64 - HISTOGRAM_SUB_BUCKET_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+// Recording is lock-free and safe from any number of threads; reads see a consistent
+// enough view for reporting while recording continues. histogram_record_owned trades the
+// interlocked operations for plain stores where only one thread at a time records.
+typedef struct {
+    volatile LONG64 counts[HISTOGRAM_BUCKETS];  // Values recorded per bucket
+    volatile LONG64 total;                      // Values recorded
+    volatile LONG64 sum;                        // Sum of the recorded values, for the mean
+    volatile LONG64 max;                        // Largest recorded value, exact
+} histogram;
+
+// Function prototypes
+void histogram_reset(histogram* hist);
+void histogram_record(histogram* hist, uint64_t value);
+void histogram_record_owned(histogram* hist, uint64_t value);
+uint64_t histogram_count(const histogram* hist);
+uint64_t histogram_max(const histogram* hist);
+double histogram_mean(const histogram* hist);
+uint64_t histogram_percentile(const histogram* hist, double percentile);
@@ -0,0 +1,183 @@
+#include "hotplug.h"
+#include "timing.h"
+#include <hidsdi.h>
+#include <ctype.h>
+#include <string.h>
+
+/**
+ * Called by the configuration manager on a thread-pool thread for every HID
+ * interface that arrives or is removed, matching or not.
+ */
+static DWORD CALLBACK on_device_notification(HCMNOTIFICATION notification, PVOID context, CM_NOTIFY_ACTION action,
+    PCM_NOTIFY_EVENT_DATA data, DWORD dataSize) {
+    hotplug_monitor* monitor = (hotplug_monitor*)context;
+    char path[512];
+
+    if (action != CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL && action != CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) {
+        return ERROR_SUCCESS;
+    }
+    if (WideCharToMultiByte(CP_UTF8, 0, data->u.DeviceInterface.SymbolicLink, -1, path, sizeof(path), NULL, NULL) == 0) {
+        return ERROR_SUCCESS;
+    }
+
+    hotplug_notify(monitor, path, action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL);
+    return ERROR_SUCCESS;
+}
+
+/**
+ * Summarises the set of matching devices so the polling thread can tell when it changed.
+ */
+static uint64_t device_fingerprint(hotplug_monitor* monitor) {
+    char* paths[64];
+    int count = enumerate_usage_paths(&monitor->usage, paths, 64);
+    uint64_t sum = 0;
+
+    for (int i = 0; i < count; i++) {
+        sum += stable_device_id(paths[i]);
+        free(paths[i]);
+    }
+    return (sum << 8) | (uint64_t)count;
+}
+
+/**
+ * Polling fallback: re-enumerates every pollIntervalMs and reports a change whenever
+ * the set of matching devices differs from the previous poll.
+ */
+static DWORD WINAPI poll_thread(LPVOID param) {
+    hotplug_monitor* monitor = (hotplug_monitor*)param;
+    uint64_t previous = device_fingerprint(monitor);
+
+    while (WaitForSingleObject(monitor->stopEvent, monitor->pollIntervalMs) == WAIT_TIMEOUT) {
+        uint64_t current = device_fingerprint(monitor);
+        if (current != previous) {
+            // The poll cannot tell which device changed, only that one did
+            hotplug_notify(monitor, NULL, (current & 0xFF) >= (previous & 0xFF));
+            previous = current;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Starts watching for devices matching the usage information.
+ *
+ * @param monitor Pointer to the hotplug_monitor struct to initialize.
+ * @param usage The devices of interest.
+ * @param forcePolling true to skip device notifications and poll, e.g. to test the fallback.
+ * @return true if the monitor is running, false otherwise.
+ */
+bool start_hotplug_monitor(hotplug_monitor* monitor, const hid_usage_info* usage, bool forcePolling) {
+    // Check for invalid arguments
+    if (!monitor || !usage) {
+        write_log(LOGLEVEL_ERROR, "Hotplug - Invalid arguments");
+        return false;
+    }
+
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->usage = *usage;
+    monitor->pollIntervalMs = HOTPLUG_POLL_INTERVAL_MS;
+    snprintf(monitor->vidPid, sizeof(monitor->vidPid), "vid_%04x&pid_%04x", usage->vendor_id, usage->product_id);
+
+    monitor->changeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (monitor->changeEvent == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Hotplug - Failed to create event. Error Code: %lu", GetLastError());
+        return false;
+    }
+
+    if (!forcePolling) {
+        CM_NOTIFY_FILTER filter = { 0 };
+        filter.cbSize = sizeof(filter);
+        filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+        HidD_GetHidGuid(&filter.u.DeviceInterface.ClassGuid);
+
+        CONFIGRET result = CM_Register_Notification(&filter, monitor, on_device_notification, &monitor->notification);
+        if (result == CR_SUCCESS) {
+            write_log(LOGLEVEL_INFO, "Hotplug - Listening for device notifications");
+            return true;
+        }
+        monitor->notification = NULL;
+        write_log_format(LOGLEVEL_WARN, "Hotplug - Device notifications unavailable (CONFIGRET %lu), polling instead", result);
+    }
+
+    monitor->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (monitor->stopEvent) {
+        monitor->pollThread = CreateThread(NULL, 0, poll_thread, monitor, 0, NULL);
+    }
+    if (monitor->pollThread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Hotplug - Failed to start polling. Error Code: %lu", GetLastError());
+        if (monitor->stopEvent) {
+            CloseHandle(monitor->stopEvent);
+            monitor->stopEvent = NULL;
+        }
+        CloseHandle(monitor->changeEvent);
+        monitor->changeEvent = NULL;  // stop_hotplug_monitor must not close it again
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Hotplug - Polling every %lu ms", monitor->pollIntervalMs);
+    return true;
+}
+
+/**
+ * Stops the monitor. No callback runs once this returns.
+ *
+ * @param monitor Pointer to the hotplug_monitor to stop.
+ */
+void stop_hotplug_monitor(hotplug_monitor* monitor) {
+    if (!monitor || monitor->changeEvent == NULL) {
+        return;
+    }
+
+    if (monitor->notification) {
+        // Waits for callbacks in progress to return
+        CM_Unregister_Notification(monitor->notification);
+        monitor->notification = NULL;
+    }
+    if (monitor->pollThread) {
+        SetEvent(monitor->stopEvent);
+        WaitForSingleObject(monitor->pollThread, INFINITE);
+        CloseHandle(monitor->pollThread);
+        CloseHandle(monitor->stopEvent);
+        monitor->pollThread = NULL;
+        monitor->stopEvent = NULL;
+    }
+
+    CloseHandle(monitor->changeEvent);
+    monitor->changeEvent = NULL;
+}
+
+/**
+ * Reports a device arriving or leaving. Called by the notification callback and the
+ * polling thread; tests and simulated devices can call it directly to inject events.
+ *
+ * @param monitor The monitor.
+ * @param path The device interface path, or NULL if unknown. Paths of other devices are ignored.
+ * @param arrived true for an arrival, false for a removal.
+ */
+void hotplug_notify(hotplug_monitor* monitor, const char* path, bool arrived) {
+    if (path) {
+        char lower[512];
+        size_t i = 0;
+        for (; path[i] && i < sizeof(lower) - 1; i++) {
+            lower[i] = (char)tolower((unsigned char)path[i]);
+        }
+        lower[i] = '\0';
+
+        if (!strstr(lower, monitor->vidPid)) {
+            return;
+        }
+    }
+
+    WriteRelease64(&monitor->lastChangeNs, (LONG64)monotonic_ns());
+    InterlockedIncrement(arrived ? &monitor->arrivals : &monitor->removals);
+    SetEvent(monitor->changeEvent);
+
+    write_log_format(LOGLEVEL_DEBUG, "Hotplug - Device %s: %s", arrived ? "arrived" : "removed", path ? path : "(poll)");
+}
+
+/**
+ * @return The monotonic_ns time of the latest matching arrival or removal, 0 if none.
+ */
+uint64_t hotplug_last_change(hotplug_monitor* monitor) {
+    return (uint64_t)ReadAcquire64(&monitor->lastChangeNs);
+}
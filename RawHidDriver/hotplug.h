@@ -0,0 +1,31 @@
+#pragma once
+
+#include <windows.h>
+#include <cfgmgr32.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "rawhid.h"
+
+// How often the polling fallback re-enumerates when device notifications are unavailable
+#define HOTPLUG_POLL_INTERVAL_MS 1000
+
+// Watches for matching HID devices arriving and leaving. Notifications come from the
+// configuration manager; if registration fails a thread polls the device list instead.
+typedef struct {
+    hid_usage_info usage;               // Devices of interest
+    char vidPid[24];                    // "vid_xxxx&pid_xxxx", matched against lower-cased interface paths
+    HANDLE changeEvent;                 // Auto-reset; signalled when a matching device arrives or leaves
+    HCMNOTIFICATION notification;       // Registration, or NULL when polling
+    HANDLE pollThread;                  // Polling fallback, or NULL when notifications work
+    HANDLE stopEvent;                   // Stops the polling thread
+    DWORD pollIntervalMs;               // Polling period
+    volatile LONG64 lastChangeNs;       // monotonic_ns of the latest change, to measure reopen time
+    volatile LONG arrivals;             // Matching arrivals seen
+    volatile LONG removals;             // Matching removals seen
+} hotplug_monitor;
+
+// Function prototypes
+bool start_hotplug_monitor(hotplug_monitor* monitor, const hid_usage_info* usage, bool forcePolling);
+void stop_hotplug_monitor(hotplug_monitor* monitor);
+void hotplug_notify(hotplug_monitor* monitor, const char* path, bool arrived);
+uint64_t hotplug_last_change(hotplug_monitor* monitor);
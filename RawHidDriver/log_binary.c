@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <string.h>
+#include "log_binary.h"
+
+// One conversion specification inside a printf format string.
+typedef struct {
+    const char* start;        // The '%'
+    const char* lengthStart;  // First length modifier character, or the conversion if there is none
+    const char* end;          // One past the conversion character
+    char conversion;          // Conversion character, '%' for "%%"
+    uint8_t type;             // LOGBIN_ARG_* consumed by the conversion, 0 for "%%"
+    bool starWidth;           // Width is taken from an int argument
+    bool starPrecision;       // Precision is taken from an int argument
+} format_spec;
+
+/**
+ * Parses the conversion specification starting at a '%'.
+ *
+ * @param p Pointer to the '%'.
+ * @param spec Receives the parsed specification.
+ * @return Pointer one past the specification, or NULL if it is malformed or uses a
+ *         conversion the binary format does not support (%n, wide strings).
+ */
+static const char* parse_spec(const char* p, format_spec* spec) {
+    int longs = 0;
+    bool wide = false;
+    bool is64 = false;
+
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+
+    if (*p == '%') {
+        spec->conversion = '%';
+        spec->lengthStart = p;
+        spec->end = p + 1;
+        return spec->end;
+    }
+
+    // Flags
+    while (*p && strchr("-+ #0", *p)) {
+        p++;
+    }
+
+    // Width
+    if (*p == '*') {
+        spec->starWidth = true;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+
+    // Precision
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->starPrecision = true;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    // Length modifiers, including the Microsoft I, I32, I64 and w forms
+    spec->lengthStart = p;
+    for (;;) {
+        if (*p == 'h' || *p == 'L') {
+            p++;
+        }
+        else if (*p == 'l') {
+            longs++;
+            p++;
+        }
+        else if (*p == 'j') {
+            is64 = true;
+            p++;
+        }
+        else if (*p == 'z' || *p == 't') {
+            is64 = sizeof(size_t) == 8;
+            p++;
+        }
+        else if (*p == 'w') {
+            wide = true;
+            p++;
+        }
+        else if (*p == 'I') {
+            if (p[1] == '6' && p[2] == '4') {
+                is64 = true;
+                p += 3;
+            }
+            else if (p[1] == '3' && p[2] == '2') {
+                p += 3;
+            }
+            else {
+                is64 = sizeof(size_t) == 8;
+                p++;
+            }
+        }
+        else {
+            break;
+        }
+    }
+
+    spec->conversion = *p;
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        spec->type = (longs >= 2 || is64) ? LOGBIN_ARG_INT64 : LOGBIN_ARG_INT32;
+        break;
+    case 'c': case 'C':
+        spec->type = LOGBIN_ARG_INT32;
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        spec->type = LOGBIN_ARG_DOUBLE;
+        break;
+    case 'p':
+        spec->type = LOGBIN_ARG_POINTER;
+        break;
+    case 's':
+        if (longs > 0 || wide) {
+            return NULL;
+        }
+        spec->type = LOGBIN_ARG_STRING;
+        break;
+    default:
+        return NULL;
+    }
+
+    spec->end = p + 1;
+    return spec->end;
+}
+
+/**
+ * Works out which arguments a format string consumes.
+ *
+ * @param format The printf format string.
+ * @param descriptor Receives the argument types in order.
+ * @return true if every conversion can be stored in binary form, false if the message
+ *         has to be formatted at the call site instead.
+ */
+bool logbin_parse_format(const char* format, logbin_descriptor* descriptor) {
+    format_spec spec;
+    const char* p = format;
+
+    descriptor->count = 0;
+
+    while ((p = strchr(p, '%')) != NULL) {
+        p = parse_spec(p, &spec);
+        if (!p) {
+            return false;
+        }
+        if (spec.type == 0) {
+            continue;
+        }
+
+        int needed = spec.starWidth + spec.starPrecision + 1;
+        if (descriptor->count + needed > LOGBIN_MAX_ARGS) {
+            return false;
+        }
+        if (spec.starWidth) {
+            descriptor->types[descriptor->count++] = LOGBIN_ARG_INT32;
+        }
+        if (spec.starPrecision) {
+            descriptor->types[descriptor->count++] = LOGBIN_ARG_INT32;
+        }
+        descriptor->types[descriptor->count++] = spec.type;
+    }
+    return true;
+}
+
+/**
+ * Returns the fewest bytes an argument of the given type can be packed into.
+ */
+static size_t min_arg_size(uint8_t type) {
+    switch (type) {
+    case LOGBIN_ARG_INT32:
+        return 4;
+    case LOGBIN_ARG_STRING:
+        return 2;
+    default:
+        return 8;
+    }
+}
+
+/**
+ * Packs the arguments of a call into a message record payload. Strings are truncated
+ * if needed so that every argument fits.
+ *
+ * @param descriptor The argument types, from logbin_parse_format.
+ * @param args The arguments.
+ * @param out The output buffer.
+ * @param capacity The size of the output buffer; must be at least LOGBIN_MAX_ARGS * 8.
+ * @return The number of bytes written.
+ */
+size_t logbin_encode_args(const logbin_descriptor* descriptor, va_list args, uint8_t* out, size_t capacity) {
+    size_t used = 0;
+    size_t reserved = 0;
+
+    // Room the remaining arguments need even if every string is cut to nothing
+    for (int i = 0; i < descriptor->count; i++) {
+        reserved += min_arg_size(descriptor->types[i]);
+    }
+
+    for (int i = 0; i < descriptor->count; i++) {
+        uint8_t type = descriptor->types[i];
+        reserved -= min_arg_size(type);
+
+        switch (type) {
+        case LOGBIN_ARG_INT32:
+            logbin_put_u32(out + used, (uint32_t)va_arg(args, int));
+            used += 4;
+            break;
+        case LOGBIN_ARG_INT64:
+            logbin_put_u64(out + used, (uint64_t)va_arg(args, long long));
+            used += 8;
+            break;
+        case LOGBIN_ARG_DOUBLE: {
+            double value = va_arg(args, double);
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            logbin_put_u64(out + used, bits);
+            used += 8;
+            break;
+        }
+        case LOGBIN_ARG_POINTER:
+            logbin_put_u64(out + used, (uint64_t)(uintptr_t)va_arg(args, void*));
+            used += 8;
+            break;
+        case LOGBIN_ARG_STRING: {
+            const char* value = va_arg(args, const char*);
+            if (!value) {
+                value = "(null)";
+            }
+            size_t length = strlen(value);
+            size_t room = capacity - used - reserved - 2;
+            if (length > room) {
+                length = room;
+            }
+            logbin_put_u16(out + used, (uint16_t)length);
+            memcpy(out + used + 2, value, length);
+            used += 2 + length;
+            break;
+        }
+        }
+    }
+    return used;
+}
+
+/**
+ * Writes the common record header.
+ *
+ * @param out The output buffer; at least LOGBIN_RECORD_HEADER_SIZE bytes.
+ * @param length Bytes that follow the length field (header remainder plus payload).
+ * @param type The LOGBIN_RECORD_* type.
+ * @param level The LogLevel of the message.
+ * @param formatId The format id, or 0 for records that have none.
+ * @param timestamp Monotonic timestamp in nanoseconds.
+ * @return LOGBIN_RECORD_HEADER_SIZE.
+ */
+size_t logbin_write_header(uint8_t* out, uint16_t length, uint8_t type, uint8_t level, uint16_t formatId, uint64_t timestamp) {
+    logbin_put_u16(out, length);
+    out[2] = type;
+    out[3] = level;
+    logbin_put_u16(out + 4, formatId);
+    logbin_put_u64(out + 6, timestamp);
+    return LOGBIN_RECORD_HEADER_SIZE;
+}
+
+/**
+ * Rebuilds a message from its format string and packed arguments. Each conversion is
+ * handed to snprintf on its own, with the length modifier rewritten to match how the
+ * argument was packed, so the result does not depend on the writer's type sizes.
+ *
+ * @param format The format string from the LOGBIN_RECORD_FORMAT record.
+ * @param descriptor The argument types from the same record.
+ * @param args The payload of the message record.
+ * @param argsLength The number of bytes in args.
+ * @param out The output buffer.
+ * @param outSize The size of the output buffer.
+ * @return The length of the formatted message.
+ */
+int logbin_format_message(const char* format, const logbin_descriptor* descriptor, const uint8_t* args, size_t argsLength, char* out, size_t outSize) {
+    size_t o = 0;
+    size_t a = 0;
+    int argIndex = 0;
+    const char* p = format;
+
+    if (outSize == 0) {
+        return 0;
+    }
+
+    while (*p && o < outSize - 1) {
+        format_spec spec;
+        const char* next;
+
+        if (*p != '%' || (next = parse_spec(p, &spec)) == NULL) {
+            out[o++] = *p++;
+            continue;
+        }
+        p = next;
+
+        if (spec.type == 0) {
+            out[o++] = '%';
+            continue;
+        }
+
+        // Rebuild the specification with '*' replaced by the packed values
+        char specText[64];
+        size_t s = 0;
+        for (const char* c = spec.start; c < spec.lengthStart && s < sizeof(specText) - 24; c++) {
+            if (*c == '*') {
+                if (argIndex >= descriptor->count || a + 4 > argsLength) {
+                    goto truncated;
+                }
+                s += snprintf(specText + s, sizeof(specText) - s, "%d", (int)logbin_get_u32(args + a));
+                a += 4;
+                argIndex++;
+            }
+            else {
+                specText[s++] = *c;
+            }
+        }
+
+        if (argIndex >= descriptor->count) {
+            goto truncated;
+        }
+
+        uint8_t type = descriptor->types[argIndex++];
+        size_t remaining = outSize - o;
+        int written = 0;
+
+        switch (type) {
+        case LOGBIN_ARG_INT32:
+            if (a + 4 > argsLength) {
+                goto truncated;
+            }
+            specText[s++] = spec.conversion == 'C' ? 'c' : spec.conversion;
+            specText[s] = '\0';
+            written = snprintf(out + o, remaining, specText, (int)logbin_get_u32(args + a));
+            a += 4;
+            break;
+        case LOGBIN_ARG_INT64:
+            if (a + 8 > argsLength) {
+                goto truncated;
+            }
+            specText[s++] = 'l';
+            specText[s++] = 'l';
+            specText[s++] = spec.conversion;
+            specText[s] = '\0';
+            written = snprintf(out + o, remaining, specText, (long long)logbin_get_u64(args + a));
+            a += 8;
+            break;
+        case LOGBIN_ARG_DOUBLE: {
+            if (a + 8 > argsLength) {
+                goto truncated;
+            }
+            uint64_t bits = logbin_get_u64(args + a);
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            specText[s++] = spec.conversion;
+            specText[s] = '\0';
+            written = snprintf(out + o, remaining, specText, value);
+            a += 8;
+            break;
+        }
+        case LOGBIN_ARG_POINTER:
+            if (a + 8 > argsLength) {
+                goto truncated;
+            }
+            written = snprintf(out + o, remaining, "%016llX", (unsigned long long)logbin_get_u64(args + a));
+            a += 8;
+            break;
+        case LOGBIN_ARG_STRING: {
+            if (a + 2 > argsLength) {
+                goto truncated;
+            }
+            size_t length = logbin_get_u16(args + a);
+            if (a + 2 + length > argsLength) {
+                goto truncated;
+            }
+            // Strings are packed without a terminator; bound the read with a precision
+            // unless the format already has one
+            bool hasPrecision = memchr(spec.start, '.', spec.lengthStart - spec.start) != NULL;
+            if (hasPrecision) {
+                specText[s++] = 's';
+                specText[s] = '\0';
+                char value[1024];
+                if (length >= sizeof(value)) {
+                    length = sizeof(value) - 1;
+                }
+                memcpy(value, args + a + 2, length);
+                value[length] = '\0';
+                written = snprintf(out + o, remaining, specText, value);
+            }
+            else {
+                specText[s++] = '.';
+                specText[s++] = '*';
+                specText[s++] = 's';
+                specText[s] = '\0';
+                written = snprintf(out + o, remaining, specText, (int)length, (const char*)(args + a + 2));
+            }
+            a += 2 + length;
+            break;
+        }
+        default:
+            goto truncated;
+        }
+
+        if (written > 0) {
+            o += (size_t)written < remaining ? (size_t)written : remaining - 1;
+        }
+    }
+
+    out[o] = '\0';
+    return (int)o;
+
+truncated:
+    o += snprintf(out + o, outSize - o, "<truncated>");
+    if (o >= outSize) {
+        o = outSize - 1;
+    }
+    out[o] = '\0';
+    return (int)o;
+}
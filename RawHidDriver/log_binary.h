@@ -0,0 +1,94 @@
+#pragma once
+
+// Binary log format used when the logger runs in binary mode. Call sites only copy
+// raw argument bytes; the format string is stored once per session and applied later
+// by RawHidLogDecoder. This header and log_binary.c have no platform dependencies so
+// the decoder can share them.
+//
+// A binary log is a sequence of records. Integers are little-endian.
+//
+//   offset  size  field
+//   0       2     length        bytes that follow this field
+//   2       1     type          LOGBIN_RECORD_*
+//   3       1     level         LogLevel of the message
+//   4       2     format_id     id of a LOGBIN_RECORD_FORMAT record from the same session
+//   6       8     timestamp_ns  monotonic clock when the message was logged
+//   14      n     payload       depends on type, see below
+//
+// LOGBIN_RECORD_SESSION  Starts a session; format ids are only valid within one.
+//                        payload = LOGBIN_MAGIC, uint32 version, uint64 unix time in ns
+//                        at the moment timestamp_ns was taken.
+// LOGBIN_RECORD_FORMAT   Defines format_id. Written before the first message that uses it.
+//                        payload = uint8 argument count, one LOGBIN_ARG_* per argument,
+//                        then the null-terminated format string.
+// LOGBIN_RECORD_MESSAGE  payload = the arguments, packed in order (see LOGBIN_ARG_*).
+// LOGBIN_RECORD_TEXT     A message that was formatted at the call site. payload = the text.
+// LOGBIN_RECORD_BYTES    A byte array, rendered as hex by the decoder. payload = the bytes.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#define LOGBIN_MAGIC "RHLOGBIN"
+#define LOGBIN_MAGIC_SIZE 8
+#define LOGBIN_VERSION 1
+
+#define LOGBIN_RECORD_HEADER_SIZE 14
+#define LOGBIN_MAX_ARGS 16
+
+enum {
+    LOGBIN_RECORD_SESSION = 1,
+    LOGBIN_RECORD_FORMAT,
+    LOGBIN_RECORD_MESSAGE,
+    LOGBIN_RECORD_TEXT,
+    LOGBIN_RECORD_BYTES
+};
+
+// How each argument is packed into a message record.
+enum {
+    LOGBIN_ARG_INT32 = 1,  // 4 bytes; also used for '*' widths and precisions
+    LOGBIN_ARG_INT64,      // 8 bytes
+    LOGBIN_ARG_DOUBLE,     // 8 bytes
+    LOGBIN_ARG_POINTER,    // 8 bytes, whatever the pointer size of the writer
+    LOGBIN_ARG_STRING      // uint16 length, then that many bytes (no terminator)
+};
+
+// The argument types a format string consumes, in order.
+typedef struct {
+    uint8_t count;
+    uint8_t types[LOGBIN_MAX_ARGS];
+} logbin_descriptor;
+
+// Function prototypes
+bool logbin_parse_format(const char* format, logbin_descriptor* descriptor);
+size_t logbin_encode_args(const logbin_descriptor* descriptor, va_list args, uint8_t* out, size_t capacity);
+size_t logbin_write_header(uint8_t* out, uint16_t length, uint8_t type, uint8_t level, uint16_t formatId, uint64_t timestamp);
+int logbin_format_message(const char* format, const logbin_descriptor* descriptor, const uint8_t* args, size_t argsLength, char* out, size_t outSize);
+
+static inline void logbin_put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void logbin_put_u32(uint8_t* p, uint32_t v) {
+    logbin_put_u16(p, (uint16_t)v);
+    logbin_put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline void logbin_put_u64(uint8_t* p, uint64_t v) {
+    logbin_put_u32(p, (uint32_t)v);
+    logbin_put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint16_t logbin_get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t logbin_get_u32(const uint8_t* p) {
+    return (uint32_t)logbin_get_u16(p) | ((uint32_t)logbin_get_u16(p + 2) << 16);
+}
+
+static inline uint64_t logbin_get_u64(const uint8_t* p) {
+    return (uint64_t)logbin_get_u32(p) | ((uint64_t)logbin_get_u32(p + 4) << 32);
+}
@@ -0,0 +1,152 @@
+#include "log_queue.h"
+#include <string.h>
+
+#define LOG_QUEUE_MASK (LOG_QUEUE_CAPACITY - 1)
+
+// Each record's sequence tells producers and the consumer who owns it:
+//   sequence == pos       free, the producer that claims pos may fill it
+//   sequence == pos + 1   filled, the consumer may read it
+// When the consumer is done it sets sequence to pos + capacity, which is the
+// position that will next map onto the same record.
+
+/**
+ * Initializes an empty log queue.
+ *
+ * @param queue Pointer to the log_queue struct to initialize.
+ * @return true on success, false if the wake event could not be created.
+ */
+bool init_log_queue(log_queue* queue) {
+    queue->enqueuePos = 0;
+    queue->dequeuePos = 0;
+    queue->dropped = 0;
+
+    for (LONG i = 0; i < LOG_QUEUE_CAPACITY; i++) {
+        queue->records[i].sequence = i;
+    }
+
+    queue->wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    return queue->wakeEvent != NULL;
+}
+
+/**
+ * Releases the resources held by a log queue.
+ *
+ * @param queue Pointer to the log_queue struct to destroy.
+ */
+void destroy_log_queue(log_queue* queue) {
+    if (queue->wakeEvent) {
+        CloseHandle(queue->wakeEvent);
+        queue->wakeEvent = NULL;
+    }
+}
+
+/**
+ * Claims the next free record so the caller can fill it in place. Safe to call from
+ * any thread; never blocks. Every successful claim must be followed by log_queue_commit.
+ *
+ * @param queue Pointer to the log queue.
+ * @param pos Receives the claimed position, to be passed to log_queue_commit.
+ * @return The record to fill, or NULL if the queue was full and the message was dropped.
+ */
+log_record* log_queue_claim(log_queue* queue, LONG* pos) {
+    LONG claimed = ReadNoFence(&queue->enqueuePos);
+    log_record* record;
+
+    for (;;) {
+        record = &queue->records[claimed & LOG_QUEUE_MASK];
+        LONG diff = ReadAcquire(&record->sequence) - claimed;
+
+        if (diff == 0) {
+            // Free; try to claim it
+            LONG seen = InterlockedCompareExchange(&queue->enqueuePos, claimed + 1, claimed);
+            if (seen == claimed) {
+                break;
+            }
+            claimed = seen;
+        }
+        else if (diff < 0) {
+            // The consumer has not released this record yet: the queue is full
+            InterlockedIncrement64(&queue->dropped);
+            return NULL;
+        }
+        else {
+            // Another producer claimed it first
+            claimed = ReadNoFence(&queue->enqueuePos);
+        }
+    }
+
+    *pos = claimed;
+    return record;
+}
+
+/**
+ * Publishes a record filled after log_queue_claim to the consumer.
+ *
+ * @param queue Pointer to the log queue.
+ * @param record The claimed record.
+ * @param pos The position returned by log_queue_claim.
+ */
+void log_queue_commit(log_queue* queue, log_record* record, LONG pos) {
+    WriteRelease(&record->sequence, pos + 1);
+
+    // The writer normally wakes on its own schedule; only hurry it when half full
+    if ((LONG)(pos + 1 - ReadNoFence(&queue->dequeuePos)) == LOG_QUEUE_CAPACITY / 2) {
+        SetEvent(queue->wakeEvent);
+    }
+}
+
+/**
+ * Copies a message into the next free record. Safe to call from any thread; never blocks.
+ *
+ * @param queue Pointer to the log queue.
+ * @param level The logging level of the message.
+ * @param message The message to queue.
+ * @return true if the record was queued, false if the queue was full and it was dropped.
+ */
+bool log_queue_push(log_queue* queue, LONG level, const char* message) {
+    LONG pos;
+    log_record* record = log_queue_claim(queue, &pos);
+    if (!record) {
+        return false;
+    }
+
+    record->level = level;
+    strncpy_s(record->data, sizeof(record->data), message, _TRUNCATE);
+    log_queue_commit(queue, record, pos);
+    return true;
+}
+
+/**
+ * Returns the oldest filled record without removing it. Consumer only.
+ *
+ * @param queue Pointer to the log queue.
+ * @return Pointer to the record, or NULL if there is nothing to read.
+ */
+log_record* log_queue_peek(log_queue* queue) {
+    LONG pos = queue->dequeuePos;
+    log_record* record = &queue->records[pos & LOG_QUEUE_MASK];
+
+    if (ReadAcquire(&record->sequence) != pos + 1) {
+        return NULL;
+    }
+    return record;
+}
+
+/**
+ * Hands the record returned by log_queue_peek back to the producers. Consumer only.
+ *
+ * @param queue Pointer to the log queue.
+ */
+void log_queue_release(log_queue* queue) {
+    LONG pos = queue->dequeuePos;
+    WriteRelease(&queue->records[pos & LOG_QUEUE_MASK].sequence, pos + LOG_QUEUE_CAPACITY);
+    WriteRelease(&queue->dequeuePos, pos + 1);
+}
+
+/**
+ * @param queue Pointer to the log queue.
+ * @return The number of records dropped because the queue was full.
+ */
+LONG64 log_queue_dropped(log_queue* queue) {
+    return InterlockedCompareExchange64(&queue->dropped, 0, 0);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOG_QUEUE_CAPACITY 4096  // Number of records; must be a power of two
+#define LOG_RECORD_SIZE 256      // Bytes per record, including the header fields
+#define LOG_RECORD_DATA_SIZE (LOG_RECORD_SIZE - 2 * sizeof(LONG))
+
+// A fixed-size log record. Messages longer than LOG_RECORD_DATA_SIZE - 1 are truncated.
+typedef struct {
+    volatile LONG sequence;           // Slot state; see log_queue.c
+    LONG level;                       // LogLevel of the message
+    char data[LOG_RECORD_DATA_SIZE];  // Null-terminated message, or an encoded record in binary mode
+} log_record;
+
+// Bounded lock-free multi-producer/single-consumer queue of log records.
+// Any thread may push; only the background writer pops. A full queue never blocks
+// a producer: the record is dropped and counted instead.
+typedef struct {
+    __declspec(align(64)) volatile LONG enqueuePos;  // Claimed by producers with CAS
+    __declspec(align(64)) volatile LONG dequeuePos;  // Advanced by the consumer only
+    __declspec(align(64)) volatile LONG64 dropped;   // Records rejected because the queue was full
+    HANDLE wakeEvent;                                // Wakes the consumer early when the queue fills up
+    __declspec(align(64)) log_record records[LOG_QUEUE_CAPACITY];
+} log_queue;
+
+// Function prototypes
+bool init_log_queue(log_queue* queue);
+void destroy_log_queue(log_queue* queue);
+bool log_queue_push(log_queue* queue, LONG level, const char* message);
+log_record* log_queue_claim(log_queue* queue, LONG* pos);
+void log_queue_commit(log_queue* queue, log_record* record, LONG pos);
+log_record* log_queue_peek(log_queue* queue);
+void log_queue_release(log_queue* queue);
+LONG64 log_queue_dropped(log_queue* queue);
@@ -0,0 +1,450 @@
+#include "log_segments.h"
+#include <winioctl.h>
+#include <stdio.h>
+#include <string.h>
+#include "log_binary.h"
+
+// Chunk used when scanning a leftover segment for the end of its data. Larger than the
+// largest binary record (a 16-bit length plus the field itself), so a walk always advances.
+#define TRIM_CHUNK_SIZE (128 * 1024)
+
+// This module sits underneath the logger, so it reports its own errors on stderr
+// rather than through write_log.
+
+/**
+ * Builds the path of a segment.
+ *
+ * @param segs The segment set.
+ * @param index 0 for the active segment, 1 to maxSegments for finished ones (1 is newest).
+ * @param out Receives the path.
+ * @param size The size of out.
+ */
+static void segment_path(const log_segments* segs, int index, char* out, size_t size) {
+    if (index == 0) {
+        snprintf(out, size, "%s", segs->path);
+    }
+    else {
+        snprintf(out, size, "%s.%d", segs->path, index);
+    }
+}
+
+static unsigned char chunk[TRIM_CHUNK_SIZE];
+
+/**
+ * Finds the end of the text in a segment: the last byte that is not zero. Text lines
+ * never contain a zero byte, so everything after it is preallocated tail.
+ *
+ * @param file The segment, open for reading.
+ * @param size The size of the file.
+ * @return The length of the text.
+ */
+static uint64_t text_data_end(HANDLE file, uint64_t size) {
+    uint64_t end = size;
+
+    while (end > 0) {
+        DWORD length = end < TRIM_CHUNK_SIZE ? (DWORD)end : TRIM_CHUNK_SIZE;
+        LARGE_INTEGER position;
+        DWORD read = 0;
+
+        position.QuadPart = (LONGLONG)(end - length);
+        if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN) || !ReadFile(file, chunk, length, &read, NULL) || read != length) {
+            return size;
+        }
+        while (length > 0 && chunk[length - 1] == 0) {
+            length--;
+            end--;
+        }
+        if (length > 0) {
+            break;
+        }
+    }
+    return end;
+}
+
+/**
+ * Finds the end of the records in a binary segment by walking them from the start.
+ * Arguments often end in zero bytes, so the end cannot be found by skipping zeros; the
+ * preallocated tail instead reads as a record length below the header size, which no
+ * record has. A record cut short by the end of the file is left out.
+ *
+ * @param file The segment, open for reading.
+ * @param size The size of the file.
+ * @return The length of the complete records.
+ */
+static uint64_t binary_data_end(HANDLE file, uint64_t size) {
+    uint64_t end = 0;
+
+    for (;;) {
+        DWORD length = size - end < TRIM_CHUNK_SIZE ? (DWORD)(size - end) : TRIM_CHUNK_SIZE;
+        LARGE_INTEGER position;
+        DWORD read = 0;
+
+        position.QuadPart = (LONGLONG)end;
+        if (length < LOGBIN_RECORD_HEADER_SIZE || !SetFilePointerEx(file, position, NULL, FILE_BEGIN) ||
+            !ReadFile(file, chunk, length, &read, NULL) || read != length) {
+            return end;
+        }
+
+        DWORD offset = 0;
+        while (length - offset >= LOGBIN_RECORD_HEADER_SIZE) {
+            DWORD recordLength = (DWORD)logbin_get_u16(chunk + offset) + 2;
+            uint8_t type = chunk[offset + 2];
+            if (recordLength < LOGBIN_RECORD_HEADER_SIZE || type < LOGBIN_RECORD_SESSION || type > LOGBIN_RECORD_BYTES) {
+                return end + offset;
+            }
+            if (recordLength > length - offset) {
+                break;  // Continues in the next chunk, or runs past the end of the file
+            }
+            offset += recordLength;
+        }
+        if (offset == 0) {
+            return end;
+        }
+        end += offset;
+    }
+}
+
+/**
+ * Cuts the zero-filled preallocated tail off a segment that was not closed cleanly,
+ * e.g. after a crash, so it ends where its data does.
+ *
+ * @param path The segment to trim.
+ * @param binary true if the segment holds binary log records, false for text.
+ * @return The size of the file after trimming, 0 if it is empty or missing.
+ */
+static uint64_t trim_preallocated_tail(const char* path, bool binary) {
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    LARGE_INTEGER size;
+    uint64_t end = 0;
+
+    if (GetFileSizeEx(file, &size)) {
+        end = binary ? binary_data_end(file, (uint64_t)size.QuadPart) : text_data_end(file, (uint64_t)size.QuadPart);
+
+        if (end < (uint64_t)size.QuadPart) {
+            LARGE_INTEGER position;
+            position.QuadPart = (LONGLONG)end;
+            SetFilePointerEx(file, position, NULL, FILE_BEGIN);
+            SetEndOfFile(file);
+        }
+    }
+
+    CloseHandle(file);
+    return end;
+}
+
+/**
+ * Moves every finished segment one place down the chain, dropping the oldest, and
+ * makes the active segment finished segment 1. The active segment must be closed.
+ *
+ * @param segs The segment set.
+ */
+static void shift_segments(log_segments* segs) {
+    char from[MAX_PATH + 16];
+    char to[MAX_PATH + 16];
+
+    if (segs->maxSegments <= 0) {
+        DeleteFileA(segs->path);
+        return;
+    }
+
+    segment_path(segs, segs->maxSegments, to, sizeof(to));
+    DeleteFileA(to);
+
+    for (int i = segs->maxSegments - 1; i >= 0; i--) {
+        segment_path(segs, i, from, sizeof(from));
+        segment_path(segs, i + 1, to, sizeof(to));
+        if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) && GetLastError() != ERROR_FILE_NOT_FOUND) {
+            fprintf(stderr, "Error: Unable to rotate %s (error %lu).\n", from, GetLastError());
+        }
+    }
+}
+
+/**
+ * Creates the active segment, preallocates it and maps it.
+ *
+ * @param segs The segment set.
+ * @return true on success, false otherwise.
+ */
+static bool map_segment(log_segments* segs) {
+    LARGE_INTEGER size;
+
+    // Readers such as tail or an editor may open the active segment while it is written
+    segs->file = CreateFileA(segs->path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (segs->file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Unable to create log segment %s (error %lu).\n", segs->path, GetLastError());
+        segs->file = NULL;
+        return false;
+    }
+
+    // Preallocate the whole segment so appends never extend the file
+    size.QuadPart = (LONGLONG)segs->segmentSize;
+    if (!SetFilePointerEx(segs->file, size, NULL, FILE_BEGIN) || !SetEndOfFile(segs->file)) {
+        fprintf(stderr, "Error: Unable to preallocate log segment (error %lu).\n", GetLastError());
+        CloseHandle(segs->file);
+        segs->file = NULL;
+        return false;
+    }
+
+    segs->mapping = CreateFileMappingA(segs->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (segs->mapping) {
+        segs->view = (char*)MapViewOfFile(segs->mapping, FILE_MAP_WRITE, 0, 0, 0);
+    }
+    if (!segs->view) {
+        fprintf(stderr, "Error: Unable to map log segment (error %lu).\n", GetLastError());
+        if (segs->mapping) {
+            CloseHandle(segs->mapping);
+            segs->mapping = NULL;
+        }
+        CloseHandle(segs->file);
+        segs->file = NULL;
+        return false;
+    }
+
+    segs->offset = 0;
+    segs->flushed = 0;
+    return true;
+}
+
+/**
+ * Unmaps the active segment and truncates it to the bytes written, so a finished
+ * segment has no zero-filled tail.
+ *
+ * @param segs The segment set.
+ */
+static void unmap_segment(log_segments* segs) {
+    LARGE_INTEGER end;
+
+    if (segs->view) {
+        FlushViewOfFile(segs->view, 0);
+        UnmapViewOfFile(segs->view);
+        segs->view = NULL;
+    }
+    if (segs->mapping) {
+        CloseHandle(segs->mapping);
+        segs->mapping = NULL;
+    }
+    if (segs->file) {
+        // The mapping must be gone before the file can shrink
+        end.QuadPart = (LONGLONG)segs->offset;
+        if (!SetFilePointerEx(segs->file, end, NULL, FILE_BEGIN) || !SetEndOfFile(segs->file)) {
+            fprintf(stderr, "Error: Unable to truncate log segment (error %lu).\n", GetLastError());
+        }
+        CloseHandle(segs->file);
+        segs->file = NULL;
+    }
+}
+
+/**
+ * Turns on NTFS compression for a finished segment.
+ *
+ * @param path The segment to compress.
+ * @return false if the volume does not support compression, true otherwise.
+ */
+static bool compress_segment(const char* path) {
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_COMPRESSED)) {
+        return true;
+    }
+
+    // Share everything so a rotation can rename the file while it is being compressed
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return true;
+    }
+
+    USHORT format = COMPRESSION_FORMAT_DEFAULT;
+    DWORD returned;
+    bool supported = true;
+    if (!DeviceIoControl(file, FSCTL_SET_COMPRESSION, &format, sizeof(format), NULL, 0, &returned, NULL)) {
+        DWORD error = GetLastError();
+        supported = error != ERROR_INVALID_FUNCTION && error != ERROR_NOT_SUPPORTED;
+    }
+
+    CloseHandle(file);
+    return supported;
+}
+
+/**
+ * Background compressor. Wakes after every rotation and compresses any finished segment
+ * that is not compressed yet, so a missed wake-up is caught on the next one.
+ *
+ * @param param Pointer to the owning segment set.
+ * @return Always 0.
+ */
+static DWORD WINAPI compress_thread(LPVOID param) {
+    log_segments* segs = (log_segments*)param;
+    char path[MAX_PATH + 16];
+
+    // Low CPU and I/O priority; logging must never wait on this
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    for (;;) {
+        WaitForSingleObject(segs->compressEvent, INFINITE);
+        if (!ReadAcquire(&segs->compressRunning)) {
+            break;
+        }
+
+        for (int i = 1; i <= segs->maxSegments; i++) {
+            segment_path(segs, i, path, sizeof(path));
+            if (!compress_segment(path)) {
+                fprintf(stderr, "Warning: The log volume does not support compression; finished segments are left as they are.\n");
+                return 0;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Opens a rotating set of log segments. A non-empty log left by an earlier run is
+ * finished first, so each run starts a fresh segment.
+ *
+ * @param segs Pointer to the segment set to initialize.
+ * @param path The path of the active segment.
+ * @param segmentSize Bytes per segment; raised to LOG_SEGMENT_MIN_SIZE if smaller.
+ * @param maxSegments Finished segments to keep.
+ * @param compress Whether to compress finished segments in the background.
+ * @param binary true if the log holds binary records, which decides how the end of a
+ *        segment left by a crash is found.
+ * @return true on success, false otherwise.
+ */
+bool open_log_segments(log_segments* segs, const char* path, uint64_t segmentSize, int maxSegments, bool compress, bool binary) {
+    memset(segs, 0, sizeof(*segs));
+    if (strlen(path) >= sizeof(segs->path)) {
+        fprintf(stderr, "Error: Log path is too long.\n");
+        return false;
+    }
+
+    strcpy_s(segs->path, sizeof(segs->path), path);
+    segs->segmentSize = segmentSize < LOG_SEGMENT_MIN_SIZE ? LOG_SEGMENT_MIN_SIZE : segmentSize;
+    segs->maxSegments = maxSegments;
+    segs->compress = compress && maxSegments > 0;
+
+    if (trim_preallocated_tail(segs->path, binary) > 0) {
+        shift_segments(segs);
+    }
+
+    if (!map_segment(segs)) {
+        return false;
+    }
+
+    if (segs->compress) {
+        segs->compressEvent = CreateEvent(NULL, FALSE, TRUE, NULL);  // Starts signalled to catch up on old segments
+        segs->compressRunning = 1;
+        if (segs->compressEvent) {
+            segs->compressThread = CreateThread(NULL, 0, compress_thread, segs, 0, NULL);
+        }
+        if (!segs->compressThread) {
+            fprintf(stderr, "Warning: Unable to start the log compressor; segments will not be compressed.\n");
+        }
+    }
+    return true;
+}
+
+/**
+ * @param segs The segment set.
+ * @return Bytes that still fit in the active segment.
+ */
+uint64_t log_segments_remaining(log_segments* segs) {
+    return segs->view ? segs->segmentSize - segs->offset : 0;
+}
+
+/**
+ * Finishes the active segment and starts a new one. If there is no active segment
+ * because creating one failed, only tries again, and only once LOG_SEGMENT_RETRY_MS
+ * has passed: shifting again would push history out for segments that never held data.
+ *
+ * @param segs The segment set.
+ * @return true if a new segment is ready for writing, false otherwise.
+ */
+bool log_segments_rotate(log_segments* segs) {
+    if (segs->view) {
+        bool empty = segs->offset == 0;
+        unmap_segment(segs);
+        if (!empty) {
+            // An empty segment is simply recreated in place
+            shift_segments(segs);
+            if (segs->compressThread) {
+                SetEvent(segs->compressEvent);
+            }
+        }
+    }
+    else if ((LONG)(GetTickCount() - segs->retryTick) < 0) {
+        return false;
+    }
+
+    if (!map_segment(segs)) {
+        segs->retryTick = GetTickCount() + LOG_SEGMENT_RETRY_MS;
+        fprintf(stderr, "Error: No log segment to write to; trying again in %d s.\n", LOG_SEGMENT_RETRY_MS / 1000);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Appends data to the active segment, rotating first if it does not fit. Data is never
+ * split across segments; anything larger than a whole segment is truncated.
+ *
+ * @param segs The segment set.
+ * @param data The bytes to append.
+ * @param length The number of bytes.
+ * @return true if the data was written, false otherwise.
+ */
+bool log_segments_append(log_segments* segs, const void* data, size_t length) {
+    if (!segs->view && !log_segments_rotate(segs)) {
+        return false;
+    }
+    if (length > segs->segmentSize) {
+        length = (size_t)segs->segmentSize;
+    }
+    if (segs->offset + length > segs->segmentSize && !log_segments_rotate(segs)) {
+        return false;
+    }
+
+    memcpy(segs->view + segs->offset, data, length);
+    segs->offset += length;
+    return true;
+}
+
+/**
+ * Forces what was appended since the last flush to disk. Appended data is visible to
+ * readers of the file immediately; this only matters for power loss.
+ *
+ * @param segs The segment set.
+ */
+void log_segments_flush(log_segments* segs) {
+    if (!segs->view || segs->offset == segs->flushed) {
+        return;
+    }
+
+    FlushViewOfFile(segs->view + segs->flushed, (SIZE_T)(segs->offset - segs->flushed));
+    FlushFileBuffers(segs->file);
+    segs->flushed = segs->offset;
+}
+
+/**
+ * Truncates and closes the active segment and stops the compressor.
+ *
+ * @param segs The segment set.
+ */
+void close_log_segments(log_segments* segs) {
+    unmap_segment(segs);
+
+    if (segs->compressThread) {
+        WriteRelease(&segs->compressRunning, 0);
+        SetEvent(segs->compressEvent);
+        WaitForSingleObject(segs->compressThread, INFINITE);
+        CloseHandle(segs->compressThread);
+        segs->compressThread = NULL;
+    }
+    if (segs->compressEvent) {
+        CloseHandle(segs->compressEvent);
+        segs->compressEvent = NULL;
+    }
+}
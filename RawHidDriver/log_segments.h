@@ -0,0 +1,48 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Size-based log rotation. The active segment is the log path itself; finished segments
+// are renamed to <path>.1 (newest) through <path>.<maxSegments> (oldest), and the oldest
+// is deleted when a new one is finished.
+//
+// The active segment is preallocated to its full size and written through a memory
+// mapping, so an append is a memcpy with no system call. On rotation or close the file
+// is truncated to the bytes actually written. Finished segments are compressed in the
+// background with NTFS compression, which is transparent: they stay plain text (or
+// plain .rhlog) to every tool that reads them.
+
+// Smallest segment accepted; a segment must hold at least one full writer batch
+#define LOG_SEGMENT_MIN_SIZE (256 * 1024)
+
+// After a new segment cannot be created, e.g. on a full disk, how long until the next try.
+// Writes fail until then; the finished segments are not shifted again.
+#define LOG_SEGMENT_RETRY_MS 5000
+
+typedef struct {
+    char path[MAX_PATH];          // Active segment; finished ones get a numeric suffix
+    uint64_t segmentSize;         // Bytes preallocated and mapped per segment
+    int maxSegments;              // Finished segments kept on disk
+    bool compress;                // Compress finished segments
+
+    HANDLE file;                  // Active segment
+    HANDLE mapping;
+    char* view;                   // The whole active segment, mapped read/write
+    uint64_t offset;              // Bytes written to the active segment
+    uint64_t flushed;             // Bytes of the active segment already flushed to disk
+    DWORD retryTick;              // GetTickCount() from which a failed segment is created again
+
+    HANDLE compressThread;        // Background compressor, NULL if compression is off
+    HANDLE compressEvent;         // Signalled after each rotation
+    volatile LONG compressRunning;
+} log_segments;
+
+// Function prototypes
+bool open_log_segments(log_segments* segs, const char* path, uint64_t segmentSize, int maxSegments, bool compress, bool binary);
+bool log_segments_append(log_segments* segs, const void* data, size_t length);
+uint64_t log_segments_remaining(log_segments* segs);
+bool log_segments_rotate(log_segments* segs);
+void log_segments_flush(log_segments* segs);
+void close_log_segments(log_segments* segs);
@@ -1,4 +1,10 @@
 #include "logger.h"
+#include "log_queue.h"
+#include "log_binary.h"
+#include "timing.h"
+#include "hex_encode.h"
+#include "log_segments.h"
+#include <io.h>
 
 /**
  * Constants for maximum log size and general buffer size for temporary string operations.
@@ -6,6 +12,23 @@
 #define MAX_LOG_SIZE 512
 #define BUFFER_SIZE 4096
 
+/**
+ * Async mode: how often the background writer drains the queue, and how many bytes
+ * it formats before handing them to the C runtime in one write.
+ */
+#define LOG_WRITER_INTERVAL_MS 20
+#define LOG_BATCH_SIZE 65536
+
+/**
+ * Binary mode: number of distinct format strings that can be stored by id (a power of two),
+ * and the lowest level still formatted and echoed to the console by the writer.
+ */
+#define LOG_FORMAT_TABLE_SIZE 1024
+#define LOG_BINARY_CONSOLE_LEVEL LOGLEVEL_WARN
+
+// Seconds between 1601-01-01 (FILETIME epoch) and 1970-01-01, in 100 ns units
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL
+
  /**
   * Internal variables to keep track of the log file and mutex.
   * Marked as 'static' to limit their scope to this file.
@@ -13,8 +36,43 @@
 static FILE* logFile = NULL;
 static HANDLE logMutex = NULL;
 
-// Internal variable for log level
-static LogLevel currentLogLevel = LOGLEVEL_DEBUG;
+// Runtime log level threshold. Not static: the logging macros in logger.h read it inline.
+volatile LogLevel currentLogLevel = LOGLEVEL_DEBUG;
+
+/**
+ * Async mode state. The queue is static so its records are allocated once, up front.
+ */
+static log_queue logQueue;
+static HANDLE writerThread = NULL;
+static volatile LONG asyncRunning = 0;
+static DWORD fsyncInterval = 0;
+
+// Rotation settings from set_log_rotation, and the segments when rotation is on
+static uint64_t rotateSegmentBytes = 0;
+static int rotateSegmentCount = 0;
+static bool rotateCompress = false;
+static log_segments segments;
+static bool segmented = false;
+
+/**
+ * Binary mode state. Format strings are keyed by address, so each call site is parsed
+ * once and afterwards only its arguments are copied. Ids are the table index plus one.
+ */
+typedef enum {
+    FORMAT_STATE_EMPTY = 0,  // Slot unused (or claimed and still being parsed)
+    FORMAT_STATE_READY,      // descriptor is valid
+    FORMAT_STATE_TEXT_ONLY   // Format uses conversions the binary format cannot store
+} format_state;
+
+typedef struct {
+    const char* volatile format;    // Key: address of the format string
+    volatile LONG state;            // format_state
+    logbin_descriptor descriptor;   // Argument types, valid once state is FORMAT_STATE_READY
+} log_format_entry;
+
+static volatile LONG binaryMode = 0;
+static log_format_entry formatTable[LOG_FORMAT_TABLE_SIZE];
+static bool formatWritten[LOG_FORMAT_TABLE_SIZE];  // Writer thread only: definition already in this session
 
 /**
  * Internal utility function to write to the log file.
@@ -24,7 +82,27 @@ static LogLevel currentLogLevel = LOGLEVEL_DEBUG;
 static void write_to_log_file(LogLevel level, const char* message);
 
 /**
- * Set the logging level.
+ * Returns the tag printed in front of messages of the given level.
+ *
+ * @param level The logging level.
+ * @return The level tag, e.g. "[DEBUG]".
+ */
+static const char* level_string(LogLevel level) {
+    switch (level) {
+    case LOGLEVEL_DEBUG:
+        return "[DEBUG]";
+    case LOGLEVEL_INFO:
+        return "[INFO]";
+    case LOGLEVEL_WARN:
+        return "[WARN]";
+    case LOGLEVEL_ERROR:
+        return "[ERROR]";
+    }
+    return "";
+}
+
+/**
+ * Set the logging level. Messages below this level are skipped before they are formatted.
  *
  * @param level The logging level.
  */
@@ -33,32 +111,532 @@ void set_log_level(LogLevel level) {
 }
 
 /**
- * Initialize the logger.
+ * Turns on size-based rotation for the next init_logger* call. The log file becomes the
+ * active segment; see log_segments.h.
+ *
+ * @param segmentBytes Size at which the log is rotated, or 0 to append to one file forever.
+ * @param maxSegments Number of finished segments to keep.
+ * @param compress Whether finished segments are compressed in the background.
+ */
+void set_log_rotation(uint64_t segmentBytes, int maxSegments, bool compress) {
+    rotateSegmentBytes = segmentBytes;
+    rotateSegmentCount = maxSegments;
+    rotateCompress = compress;
+}
+
+/**
+ * Closes the log file or the active segment.
+ */
+static void close_log_output(void) {
+    if (segmented) {
+        close_log_segments(&segments);
+        segmented = false;
+    }
+    if (logFile) {
+        fclose(logFile);
+        logFile = NULL;
+    }
+}
+
+/**
+ * Opens the log file and creates the mutex used by synchronous mode.
  *
  * @param filePath The path of the file to be used for logging.
+ * @param binary true for a binary log, false for a text one.
  */
-void init_logger(char* filePath) {
-    errno_t err = fopen_s(&logFile, filePath, "a");
-    if (err != 0) {
-        perror("Error opening file");
-        exit(-1);
+static void open_log_file(char* filePath, bool binary) {
+    if (rotateSegmentBytes > 0) {
+        if (!open_log_segments(&segments, filePath, rotateSegmentBytes, rotateSegmentCount, rotateCompress, binary)) {
+            exit(-1);
+        }
+        segmented = true;
+    }
+    else {
+        errno_t err = fopen_s(&logFile, filePath, binary ? "ab" : "a");
+        if (err != 0) {
+            perror("Error opening file");
+            exit(-1);
+        }
     }
 
     logMutex = CreateMutex(NULL, FALSE, NULL);
     if (logMutex == NULL) {
         fprintf(stderr, "Error: Unable to create mutex.\n");
-        fclose(logFile);
+        close_log_output();
+        exit(-1);
+    }
+}
+
+/**
+ * Appends bytes to the log: a plain store into the mapped segment when rotating,
+ * a buffered fwrite otherwise.
+ *
+ * @param data The bytes to write.
+ * @param length The number of bytes.
+ */
+static void write_log_output(const void* data, size_t length) {
+    bool written = segmented
+        ? log_segments_append(&segments, data, length)
+        : fwrite(data, 1, length, logFile) == length;
+    if (!written) {
+        fprintf(stderr, "Error: Unable to write to log file.\n");
+    }
+}
+
+/**
+ * Makes written data visible to other readers of the file. Mapped segments need nothing.
+ */
+static void flush_log_output(void) {
+    if (!segmented) {
+        fflush(logFile);
+    }
+}
+
+/**
+ * Forces written data to disk.
+ */
+static void sync_log_output(void) {
+    if (segmented) {
+        log_segments_flush(&segments);
+    }
+    else {
+        FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(logFile)));
+    }
+}
+
+/**
+ * Initialize the logger.
+ *
+ * @param filePath The path of the file to be used for logging.
+ */
+void init_logger(char* filePath) {
+    open_log_file(filePath, false);
+}
+
+/**
+ * Looks up the id of a format string, parsing and registering it on first use.
+ * Lock-free: a slot is claimed with a compare-exchange on its key.
+ *
+ * @param format The format string; its address is the key.
+ * @return The format id, or 0 if the message has to be formatted as text instead.
+ */
+static uint16_t lookup_format_id(const char* format) {
+    size_t index = (((uintptr_t)format >> 3) * 2654435761u) & (LOG_FORMAT_TABLE_SIZE - 1);
+
+    for (int probe = 0; probe < LOG_FORMAT_TABLE_SIZE; probe++) {
+        log_format_entry* entry = &formatTable[index];
+        const char* key = (const char*)ReadPointerAcquire((PVOID const volatile*)&entry->format);
+
+        if (key == NULL) {
+            key = (const char*)InterlockedCompareExchangePointer((PVOID volatile*)&entry->format, (PVOID)format, NULL);
+            if (key == NULL) {
+                // Claimed; parse once and publish
+                bool supported = logbin_parse_format(format, &entry->descriptor);
+                WriteRelease(&entry->state, supported ? FORMAT_STATE_READY : FORMAT_STATE_TEXT_ONLY);
+                return supported ? (uint16_t)(index + 1) : 0;
+            }
+        }
+
+        if (key == format) {
+            // Another thread may still be parsing it; fall back to text until it is ready
+            return ReadAcquire(&entry->state) == FORMAT_STATE_READY ? (uint16_t)(index + 1) : 0;
+        }
+
+        index = (index + 1) & (LOG_FORMAT_TABLE_SIZE - 1);
+    }
+    return 0;
+}
+
+/**
+ * Queues a binary record whose payload is a plain byte string (LOGBIN_RECORD_TEXT or
+ * LOGBIN_RECORD_BYTES). The payload is truncated to fit one queue record.
+ *
+ * @param level The logging level.
+ * @param type The LOGBIN_RECORD_* type.
+ * @param payload The payload bytes.
+ * @param length The number of payload bytes.
+ */
+static void push_binary_payload(LogLevel level, uint8_t type, const void* payload, size_t length) {
+    LONG pos;
+    log_record* record = log_queue_claim(&logQueue, &pos);
+    if (!record) {
+        return;
+    }
+
+    if (length > LOG_RECORD_DATA_SIZE - LOGBIN_RECORD_HEADER_SIZE) {
+        length = LOG_RECORD_DATA_SIZE - LOGBIN_RECORD_HEADER_SIZE;
+    }
+
+    uint8_t* out = (uint8_t*)record->data;
+    logbin_write_header(out, (uint16_t)(LOGBIN_RECORD_HEADER_SIZE - 2 + length), type, (uint8_t)level, 0, monotonic_ns());
+    memcpy(out + LOGBIN_RECORD_HEADER_SIZE, payload, length);
+
+    record->level = level;
+    log_queue_commit(&logQueue, record, pos);
+}
+
+/**
+ * Queues a message record: the format id plus the raw argument bytes. Nothing is formatted.
+ *
+ * @param level The logging level.
+ * @param format The format string.
+ * @param args The arguments for the format string.
+ */
+static void push_binary_message(LogLevel level, const char* format, va_list args) {
+    uint16_t formatId = lookup_format_id(format);
+    if (formatId == 0) {
+        char buffer[BUFFER_SIZE];
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        if (length > 0) {
+            push_binary_payload(level, LOGBIN_RECORD_TEXT, buffer, length < (int)sizeof(buffer) ? length : sizeof(buffer) - 1);
+        }
+        return;
+    }
+
+    LONG pos;
+    log_record* record = log_queue_claim(&logQueue, &pos);
+    if (!record) {
+        return;
+    }
+
+    uint8_t* out = (uint8_t*)record->data;
+    size_t used = logbin_encode_args(&formatTable[formatId - 1].descriptor, args,
+        out + LOGBIN_RECORD_HEADER_SIZE, LOG_RECORD_DATA_SIZE - LOGBIN_RECORD_HEADER_SIZE);
+    logbin_write_header(out, (uint16_t)(LOGBIN_RECORD_HEADER_SIZE - 2 + used), LOGBIN_RECORD_MESSAGE, (uint8_t)level, formatId, monotonic_ns());
+
+    record->level = level;
+    log_queue_commit(&logQueue, record, pos);
+}
+
+/**
+ * Writes a formatted batch to the console and the log file.
+ *
+ * @param batch The formatted lines.
+ * @param length The number of bytes in batch.
+ */
+static void write_log_batch(const char* batch, size_t length) {
+    fwrite(batch, 1, length, stdout);
+    write_log_output(batch, length);
+}
+
+/**
+ * Formats every queued record into batches and writes them out. Background writer only.
+ *
+ * @param batch Scratch buffer of LOG_BATCH_SIZE bytes.
+ * @return The number of records written.
+ */
+static int drain_log_queue(char* batch) {
+    size_t length = 0;
+    int records = 0;
+    log_record* record;
+
+    while ((record = log_queue_peek(&logQueue)) != NULL) {
+        // Worst case for one line: tag, space, full text, newline
+        if (length + LOG_RECORD_DATA_SIZE + 16 > LOG_BATCH_SIZE) {
+            write_log_batch(batch, length);
+            length = 0;
+        }
+
+        const char* levelStr = level_string((LogLevel)record->level);
+        length += snprintf(batch + length, LOG_BATCH_SIZE - length, "%s %s\n", levelStr, record->data);
+
+        log_queue_release(&logQueue);
+        records++;
+    }
+
+    if (length > 0) {
+        write_log_batch(batch, length);
+        fflush(stdout);
+        flush_log_output();
+    }
+    return records;
+}
+
+/**
+ * Appends the record that starts a binary session, and forgets which formats have been
+ * defined so each session in the file is self-contained. Background writer only.
+ *
+ * @param batch The batch to append to.
+ * @return The number of bytes appended.
+ */
+static size_t write_session_record(uint8_t* batch) {
+    FILETIME now;
+    uint64_t timestamp = monotonic_ns();
+    GetSystemTimePreciseAsFileTime(&now);
+    uint64_t unixNs = ((((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime) - FILETIME_UNIX_EPOCH) * 100;
+
+    size_t length = LOGBIN_RECORD_HEADER_SIZE + LOGBIN_MAGIC_SIZE + 4 + 8;
+    logbin_write_header(batch, (uint16_t)(length - 2), LOGBIN_RECORD_SESSION, 0, 0, timestamp);
+    memcpy(batch + LOGBIN_RECORD_HEADER_SIZE, LOGBIN_MAGIC, LOGBIN_MAGIC_SIZE);
+    logbin_put_u32(batch + LOGBIN_RECORD_HEADER_SIZE + LOGBIN_MAGIC_SIZE, LOGBIN_VERSION);
+    logbin_put_u64(batch + LOGBIN_RECORD_HEADER_SIZE + LOGBIN_MAGIC_SIZE + 4, unixNs);
+
+    memset(formatWritten, 0, sizeof(formatWritten));
+    return length;
+}
+
+/**
+ * Appends the record that defines a format id. Background writer only.
+ *
+ * @param batch The batch to append to; must have room for the definition.
+ * @param formatId The format id to define.
+ * @return The number of bytes appended.
+ */
+static size_t write_format_record(uint8_t* batch, uint16_t formatId) {
+    const log_format_entry* entry = &formatTable[formatId - 1];
+    size_t formatLength = strlen(entry->format) + 1;
+    size_t length = LOGBIN_RECORD_HEADER_SIZE + 1 + entry->descriptor.count + formatLength;
+
+    logbin_write_header(batch, (uint16_t)(length - 2), LOGBIN_RECORD_FORMAT, 0, formatId, 0);
+    batch[LOGBIN_RECORD_HEADER_SIZE] = entry->descriptor.count;
+    memcpy(batch + LOGBIN_RECORD_HEADER_SIZE + 1, entry->descriptor.types, entry->descriptor.count);
+    memcpy(batch + LOGBIN_RECORD_HEADER_SIZE + 1 + entry->descriptor.count, entry->format, formatLength);
+
+    formatWritten[formatId - 1] = true;
+    return length;
+}
+
+/**
+ * Formats a binary record for the console. Only used for records at or above
+ * LOG_BINARY_CONSOLE_LEVEL, so the cost stays off the common path.
+ *
+ * @param record The encoded record.
+ */
+static void echo_binary_record(const uint8_t* record) {
+    char text[BUFFER_SIZE];
+    size_t payloadLength = logbin_get_u16(record) + 2 - LOGBIN_RECORD_HEADER_SIZE;
+    const uint8_t* payload = record + LOGBIN_RECORD_HEADER_SIZE;
+    uint16_t formatId = logbin_get_u16(record + 4);
+
+    switch (record[2]) {
+    case LOGBIN_RECORD_MESSAGE:
+        logbin_format_message(formatTable[formatId - 1].format, &formatTable[formatId - 1].descriptor,
+            payload, payloadLength, text, sizeof(text));
+        break;
+    case LOGBIN_RECORD_BYTES:
+        hex_encode(payload, payloadLength, text, sizeof(text), false);
+        break;
+    default:
+        snprintf(text, sizeof(text), "%.*s", (int)payloadLength, (const char*)payload);
+        break;
+    }
+
+    printf("%s %s\n", level_string((LogLevel)record[3]), text);
+}
+
+/**
+ * Returns the space a queued binary record takes in the file, including the format
+ * definition that has to precede it if this is the first use of its format id in the session.
+ *
+ * @param data The encoded record.
+ * @param needsFormat Receives whether a format definition has to be written first.
+ * @return The number of bytes needed, at most.
+ */
+static size_t binary_record_space(const uint8_t* data, bool* needsFormat) {
+    size_t recordLength = logbin_get_u16(data) + 2;
+    uint16_t formatId = logbin_get_u16(data + 4);
+
+    *needsFormat = data[2] == LOGBIN_RECORD_MESSAGE && !formatWritten[formatId - 1];
+    if (!*needsFormat) {
+        return recordLength;
+    }
+    return recordLength + LOGBIN_RECORD_HEADER_SIZE + 1 + LOGBIN_MAX_ARGS + strlen(formatTable[formatId - 1].format) + 1;
+}
+
+/**
+ * @return How many bytes the next batch may hold: LOG_BATCH_SIZE, or less when the
+ *         active segment is nearly full.
+ */
+static size_t batch_capacity(void) {
+    if (segmented) {
+        uint64_t remaining = log_segments_remaining(&segments);
+        return remaining < LOG_BATCH_SIZE ? (size_t)remaining : LOG_BATCH_SIZE;
+    }
+    return LOG_BATCH_SIZE;
+}
+
+/**
+ * Copies every queued binary record into batches and writes them out, defining each
+ * format id the first time it appears in the session. When rotating, a batch never
+ * crosses a segment boundary and each segment opens with its own session record, so
+ * every segment decodes on its own. Background writer only.
+ *
+ * @param batch Scratch buffer of LOG_BATCH_SIZE bytes.
+ * @return The number of records written.
+ */
+static int drain_log_queue_binary(uint8_t* batch) {
+    size_t length = 0;
+    int records = 0;
+    log_record* record;
+
+    while ((record = log_queue_peek(&logQueue)) != NULL) {
+        const uint8_t* data = (const uint8_t*)record->data;
+        size_t recordLength = logbin_get_u16(data) + 2;
+        uint16_t formatId = logbin_get_u16(data + 4);
+        bool needsFormat;
+        size_t needed = binary_record_space(data, &needsFormat);
+
+        if (length + needed > batch_capacity()) {
+            if (length > 0) {
+                write_log_output(batch, length);
+            }
+            length = 0;
+
+            if (segmented && needed > log_segments_remaining(&segments)) {
+                if (!log_segments_rotate(&segments)) {
+                    // No segment until a retry succeeds; the record is dropped, not written
+                    log_queue_release(&logQueue);
+                    records++;
+                    continue;
+                }
+                length = write_session_record(batch);
+                needed = binary_record_space(data, &needsFormat);
+            }
+        }
+
+        if (needsFormat) {
+            length += write_format_record(batch + length, formatId);
+        }
+        memcpy(batch + length, data, recordLength);
+        length += recordLength;
+
+        if (data[3] >= LOG_BINARY_CONSOLE_LEVEL) {
+            echo_binary_record(data);
+        }
+
+        log_queue_release(&logQueue);
+        records++;
+    }
+
+    if (length > 0) {
+        write_log_output(batch, length);
+        flush_log_output();
+    }
+    return records;
+}
+
+/**
+ * Background writer thread. Wakes every LOG_WRITER_INTERVAL_MS (or early when the queue
+ * is half full), writes everything queued in large batches, and forces the file to disk
+ * every fsyncInterval milliseconds.
+ *
+ * @param param Unused.
+ * @return Always 0.
+ */
+static DWORD WINAPI log_writer_thread(LPVOID param) {
+    static char batch[LOG_BATCH_SIZE];
+    DWORD lastFsync = GetTickCount();
+    bool binary = ReadAcquire(&binaryMode) != 0;
+    bool dirty = false;
+
+    if (binary) {
+        size_t length = write_session_record((uint8_t*)batch);
+        write_log_output(batch, length);
+    }
+
+    for (;;) {
+        // Read the flag before draining so records queued before shutdown are written
+        bool running = ReadAcquire(&asyncRunning) != 0;
+        int written = binary ? drain_log_queue_binary((uint8_t*)batch) : drain_log_queue(batch);
+
+        if (written > 0) {
+            dirty = true;
+        }
+
+        if (dirty && GetTickCount() - lastFsync >= fsyncInterval) {
+            sync_log_output();
+            lastFsync = GetTickCount();
+            dirty = false;
+        }
+
+        if (!running) {
+            break;
+        }
+        WaitForSingleObject(logQueue.wakeEvent, LOG_WRITER_INTERVAL_MS);
+    }
+
+    if (dirty) {
+        sync_log_output();
+    }
+    return 0;
+}
+
+/**
+ * Starts the background writer used by the async and binary modes.
+ *
+ * @param fsyncIntervalMs How often written data is forced to disk, in milliseconds.
+ */
+static void start_log_writer(DWORD fsyncIntervalMs) {
+    if (!init_log_queue(&logQueue)) {
+        fprintf(stderr, "Error: Unable to create log queue event.\n");
+        close_log_output();
+        exit(-1);
+    }
+
+    fsyncInterval = fsyncIntervalMs;
+    asyncRunning = 1;
+
+    writerThread = CreateThread(NULL, 0, log_writer_thread, NULL, 0, NULL);
+    if (writerThread == NULL) {
+        fprintf(stderr, "Error: Unable to create log writer thread.\n");
+        asyncRunning = 0;
+        destroy_log_queue(&logQueue);
+    }
+}
+
+/**
+ * Initialize the logger in asynchronous mode. Messages are copied into a lock-free queue
+ * and written by a background thread, so logging never waits on the console or the disk.
+ * When the queue is full new messages are dropped and counted.
+ *
+ * @param filePath The path of the file to be used for logging.
+ * @param fsyncIntervalMs How often written data is forced to disk, in milliseconds.
+ */
+void init_logger_async(char* filePath, DWORD fsyncIntervalMs) {
+    open_log_file(filePath, false);
+    start_log_writer(fsyncIntervalMs);
+}
+
+/**
+ * Initialize the logger in binary mode. Call sites queue a format id and their raw
+ * arguments; the background writer copies the records to the file unformatted.
+ * Decode the file with RawHidLogDecoder. Only messages at LOG_BINARY_CONSOLE_LEVEL
+ * and above are formatted, by the writer, for the console.
+ *
+ * @param filePath The path of the binary log file.
+ * @param fsyncIntervalMs How often written data is forced to disk, in milliseconds.
+ */
+void init_logger_binary(char* filePath, DWORD fsyncIntervalMs) {
+    open_log_file(filePath, true);
+    binaryMode = 1;
+    start_log_writer(fsyncIntervalMs);
+    if (writerThread == NULL) {
+        // No writer means text would be written to a binary file; refuse to run that way
+        close_log_output();
         exit(-1);
     }
 }
 
+/**
+ * Returns the number of messages dropped because the async queue was full.
+ *
+ * @return The drop count, or 0 in synchronous mode.
+ */
+LONG64 get_log_dropped_count() {
+    if (writerThread == NULL) {
+        return 0;
+    }
+    return log_queue_dropped(&logQueue);
+}
+
 /**
  * Writes a simple log message with a specific logging level.
+ * Called through the write_log macro, which has already checked the level.
  *
  * @param level The logging level.
  * @param message The message string to be logged.
  */
-void write_log(LogLevel level, const char* message) {
+void write_log_impl(LogLevel level, const char* message) {
     write_to_log_file(level, message);
 }
 
@@ -69,34 +647,22 @@ void write_log(LogLevel level, const char* message) {
  * @param format A format string for the log message.
  * @param ... Variable arguments for the format string.
  */
-void write_log_format(LogLevel level, const char* format, ...) {
+void write_log_format_impl(LogLevel level, const char* format, ...) {
     char buffer[BUFFER_SIZE];
     va_list args;
     va_start(args, format);
+    if (ReadNoFence(&binaryMode)) {
+        // Binary mode: copy the arguments, leave the formatting to the decoder
+        push_binary_message(level, format, args);
+        va_end(args);
+        return;
+    }
     vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
 
     write_to_log_file(level, buffer);
 }
 
-/**
- * Converts a byte array to a hexadecimal string.
- *
- * @param data The byte array to convert.
- * @param data_len The length of the byte array.
- * @param out_str The output buffer for the hexadecimal string.
- * @param out_str_size The size of the output buffer.
- */
-void bytes_to_hex_string(const unsigned char* data, size_t data_len, char* out_str, size_t out_str_size) {
-    const char* hex_digits = "0123456789ABCDEF";
-    size_t j = 0;
-    for (size_t i = 0; i < data_len && j < out_str_size - 2; ++i) {
-        out_str[j++] = hex_digits[(data[i] >> 4) & 0x0F];
-        out_str[j++] = hex_digits[(data[i] & 0x0F)];
-    }
-    out_str[j] = '\0';  // Null-terminate the string
-}
-
 /**
  * Logs a byte array as a hexadecimal string.
  *
@@ -104,9 +670,15 @@ void bytes_to_hex_string(const unsigned char* data, size_t data_len, char* out_s
  * @param data The byte array to log.
  * @param data_len The length of the byte array.
  */
-void write_log_byte_array(LogLevel level, const unsigned char* data, size_t data_len) {
+void write_log_byte_array_impl(LogLevel level, const unsigned char* data, size_t data_len) {
+    if (ReadNoFence(&binaryMode)) {
+        // Binary mode: store the raw bytes, the decoder renders them as hex
+        push_binary_payload(level, LOGBIN_RECORD_BYTES, data, data_len);
+        return;
+    }
+
     char buffer[BUFFER_SIZE]; // Make sure BUFFER_SIZE is large enough to hold the hex string
-    bytes_to_hex_string(data, data_len, buffer, sizeof(buffer));
+    hex_encode(data, data_len, buffer, sizeof(buffer), false);
     write_to_log_file(level, buffer);
 }
 
@@ -117,11 +689,8 @@ void write_log_byte_array(LogLevel level, const unsigned char* data, size_t data
  * @param message A message string to prefix the log.
  * @param value The 64-bit unsigned integer to log.
  */
-void write_log_uint64_dec(LogLevel level, const char* message, uint64_t value) {
-    char buffer[BUFFER_SIZE];
-    snprintf(buffer, sizeof(buffer), "%s: %llu", message, value);
-
-    write_to_log_file(level, buffer);
+void write_log_uint64_dec_impl(LogLevel level, const char* message, uint64_t value) {
+    write_log_format_impl(level, "%s: %llu", message, value);
 }
 
 /**
@@ -131,11 +700,8 @@ void write_log_uint64_dec(LogLevel level, const char* message, uint64_t value) {
  * @param message A message string to prefix the log.
  * @param value The 64-bit unsigned integer to log.
  */
-void write_log_uint64_hex(LogLevel level, const char* message, uint64_t value) {
-    char buffer[BUFFER_SIZE];
-    snprintf(buffer, sizeof(buffer), "%s: 0x%llx", message, value);
-
-    write_to_log_file(level, buffer);
+void write_log_uint64_hex_impl(LogLevel level, const char* message, uint64_t value) {
+    write_log_format_impl(level, "%s: 0x%llx", message, value);
 }
 
 /**
@@ -145,7 +711,7 @@ void write_log_uint64_hex(LogLevel level, const char* message, uint64_t value) {
  * @param message A message string to prefix the log.
  * @param value The 64-bit unsigned integer to log.
  */
-void write_log_uint64_bin(LogLevel level, const char* message, uint64_t value) {
+void write_log_uint64_bin_impl(LogLevel level, const char* message, uint64_t value) {
     char buffer[BUFFER_SIZE];
     char binaryStr[65];
 
@@ -167,37 +733,36 @@ void write_log_uint64_bin(LogLevel level, const char* message, uint64_t value) {
  * @param message The message string to be logged.
  */
 static void write_to_log_file(LogLevel level, const char* message) {
-    const char* levelStr = "";
-    switch (level) {
-    case LOGLEVEL_DEBUG:
-        levelStr = "[DEBUG]";
-        break;
-    case LOGLEVEL_INFO:
-        levelStr = "[INFO]";
-        break;
-    case LOGLEVEL_WARN:
-        levelStr = "[WARN]";
-        break;
-    case LOGLEVEL_ERROR:
-        levelStr = "[ERROR]";
-        break;
+    // Binary mode: store the text as-is in a binary record
+    if (ReadNoFence(&binaryMode)) {
+        push_binary_payload(level, LOGBIN_RECORD_TEXT, message, strlen(message));
+        return;
     }
 
-    // Print to console
-    printf("%s %s\n", levelStr, message);
-
-    if (level <= currentLogLevel) {
+    // Async mode: hand the message to the background writer and get back to work
+    if (ReadAcquire(&asyncRunning)) {
+        log_queue_push(&logQueue, level, message);
         return;
     }
 
+    const char* levelStr = level_string(level);
+
+    // Print to console
+    printf("%s %s\n", levelStr, message);
+
     WaitForSingleObject(logMutex, INFINITE);
 
     // Write to the log file
-    if (fprintf(logFile, "%s %s\n", levelStr, message) < 0) {
+    if (segmented) {
+        char line[BUFFER_SIZE + 16];
+        int length = snprintf(line, sizeof(line), "%s %s\n", levelStr, message);
+        write_log_output(line, length < (int)sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+    else if (fprintf(logFile, "%s %s\n", levelStr, message) < 0) {
         fprintf(stderr, "Error: Unable to write to log file.\n");
     }
 
-    fflush(logFile);
+    flush_log_output();
     ReleaseMutex(logMutex);
 }
 
@@ -205,9 +770,22 @@ static void write_to_log_file(LogLevel level, const char* message) {
  * Close and clean up the logger.
  */
 void close_logger() {
-    if (logFile) {
-        fclose(logFile);
+    if (writerThread) {
+        // Report drops while the writer can still take the message
+        LONG64 dropped = log_queue_dropped(&logQueue);
+        if (dropped > 0) {
+            write_log_format(LOGLEVEL_WARN, "Logger - %lld messages dropped because the log queue was full", dropped);
+        }
+
+        // The writer drains whatever is still queued before it exits
+        WriteRelease(&asyncRunning, 0);
+        SetEvent(logQueue.wakeEvent);
+        WaitForSingleObject(writerThread, INFINITE);
+        CloseHandle(writerThread);
+        writerThread = NULL;
+        destroy_log_queue(&logQueue);
     }
+    close_log_output();
     if (logMutex) {
         CloseHandle(logMutex);
     }
@@ -1,12 +1,9 @@
 #pragma once
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <windows.h>
 
-// Global log file pointer and mutex for thread safety.
-extern FILE* logFile;
-extern HANDLE logMutex;
-
 typedef enum {
     LOGLEVEL_DEBUG = 1,
     LOGLEVEL_INFO,
@@ -14,12 +11,44 @@ typedef enum {
     LOGLEVEL_ERROR
 } LogLevel;
 
+// Build-time floor: calls below this level are compiled out, arguments included.
+// Override per configuration, e.g. /DLOG_MIN_LEVEL=LOGLEVEL_INFO for release builds.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOGLEVEL_DEBUG
+#endif
+
+// Runtime threshold set by set_log_level. Read by the macros below; do not write directly.
+extern volatile LogLevel currentLogLevel;
+
+// True when a message of the given level would be written. With a constant level the
+// first half folds away at compile time, leaving one compare against currentLogLevel.
+#define log_level_enabled(level) ((level) >= LOG_MIN_LEVEL && (level) >= currentLogLevel)
+
+// The logging entry points are macros so the level check runs before any argument
+// is evaluated or formatted. The *_impl functions do the actual work.
+#define write_log(level, message) \
+    do { if (log_level_enabled(level)) write_log_impl((level), (message)); } while (0)
+#define write_log_format(level, ...) \
+    do { if (log_level_enabled(level)) write_log_format_impl((level), __VA_ARGS__); } while (0)
+#define write_log_byte_array(level, data, data_len) \
+    do { if (log_level_enabled(level)) write_log_byte_array_impl((level), (data), (data_len)); } while (0)
+#define write_log_uint64_dec(level, message, value) \
+    do { if (log_level_enabled(level)) write_log_uint64_dec_impl((level), (message), (value)); } while (0)
+#define write_log_uint64_bin(level, message, value) \
+    do { if (log_level_enabled(level)) write_log_uint64_bin_impl((level), (message), (value)); } while (0)
+#define write_log_uint64_hex(level, message, value) \
+    do { if (log_level_enabled(level)) write_log_uint64_hex_impl((level), (message), (value)); } while (0)
+
 void init_logger(char* filePath);
+void init_logger_async(char* filePath, DWORD fsyncIntervalMs);
+void init_logger_binary(char* filePath, DWORD fsyncIntervalMs);
+void set_log_rotation(uint64_t segmentBytes, int maxSegments, bool compress);
+LONG64 get_log_dropped_count();
 void set_log_level(LogLevel level);
-void write_log_format(LogLevel level, const char* format, ...);
-void write_log_byte_array(LogLevel level, const unsigned char* data, size_t data_len);
-void write_log_uint64_dec(LogLevel level, const char* message, uint64_t value);
-void write_log_uint64_bin(LogLevel level, const char* message, uint64_t value);
-void write_log_uint64_hex(LogLevel level, const char* message, uint64_t value);
-void write_log(LogLevel level, const char* message);
+void write_log_format_impl(LogLevel level, const char* format, ...);
+void write_log_byte_array_impl(LogLevel level, const unsigned char* data, size_t data_len);
+void write_log_uint64_dec_impl(LogLevel level, const char* message, uint64_t value);
+void write_log_uint64_bin_impl(LogLevel level, const char* message, uint64_t value);
+void write_log_uint64_hex_impl(LogLevel level, const char* message, uint64_t value);
+void write_log_impl(LogLevel level, const char* message);
 void close_logger();
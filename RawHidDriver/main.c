@@ -1,8 +1,25 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include "tcp_client.h"
 #include "logger.h"
 #include "rawhid.h"
+#include "hid_mux.h"
+#include "hotplug.h"
+#include "heartbeat.h"
+#include "connection.h"
+#include "report_ring.h"
+#include "frame_pool.h"
+#include "forwarder.h"
+#include "downstream.h"
+#include "device_cache.h"
+#include "capture.h"
+#include "replay.h"
+#include "stage_latency.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "timing.h"
 #include "windows.h"
 #include "config.h"
 
@@ -12,13 +29,27 @@
 #define PING_INTERVAL 5000 // Ping every 5 seconds
 #define PING_TIMEOUT 1000  // Timeout after 1 second
 
+// How often the ping round-trip distribution is logged
+#define HEARTBEAT_SUMMARY_INTERVAL 60000
+
 #define RECONNECT_INTERVAL 60000
 
-bool send_ping(hid_device* handle) {
+// After a hotplug arrival the device may refuse opens for a moment; retry this often, this many times
+#define HOTPLUG_RETRY_INTERVAL 20
+#define HOTPLUG_OPEN_RETRIES 10
+
+// Backoff between attempts to reopen devices while none is open
+#define HID_RECONNECT_BASE_MS 50
+#define HID_RECONNECT_MAX_MS 5000
+
+// Once a replay has written its last report, how long to let the pipeline drain
+#define REPLAY_DRAIN_MS 2000
+
+bool send_ping(hid_mux* mux, int slot) {
     unsigned char ping_message[32] = { 0x00, 0x00, 0x00, 0x00 };  // Account for the ignored first byte
-    ping_message[1] = 0x01;
+    ping_message[1] = PING_REQUEST;
 
-    int res = hid_write(handle, ping_message, sizeof(ping_message));
+    int res = hid_mux_write(mux, slot, ping_message, sizeof(ping_message));
     if (res < 0) {
         write_log(LOGLEVEL_ERROR, "Failed to send ping.");
         return false;
@@ -26,29 +57,452 @@ bool send_ping(hid_device* handle) {
     return true;
 }
 
-bool wait_for_pong(hid_device* handle, unsigned int timeout) {
-    DWORD start_time = GetTickCount();
-    unsigned char buf[64]; // Buffer for incoming data
+// monotonic_ns when main started, and when the reader saw the first report (0 until then)
+static uint64_t startNs;
+static volatile LONG64 firstReportNs;
 
-    while (GetTickCount() - start_time < timeout) {
-        int res = hid_read_timeout(handle, buf, sizeof(buf), 100);
-        if (res > 0) {
-            if (buf[0] == PONG_RESPONSE) {
-                return true; // Pong received
-            }
-            // If it's not a pong, assume it's a message from the keyboard
+// State shared between the main thread and the HID reader thread. Arrays are indexed by mux slot.
+typedef struct {
+    report_ring* rings[FORWARDER_MAX_SINKS];       // Queue of each sink, drained by its forwarder thread
+    int sinkCount;                                 // Sinks every report is queued to
+    wire_format_mode format;                       // How reports shared between sinks are encoded
+    frame_pool* pool;                              // Where reports that are not forwarded go back to
+    heartbeat* beat;                               // Outstanding pings; the reader disarms them as pongs arrive
+    uint32_t nextSequence[HID_MUX_MAX_DEVICES];    // Sequence number for the next report; only touched by the reader
+    // Last report queued to each sink per device, for RING_POLICY_COALESCE; length 0 if unknown
+    unsigned char lastQueued[FORWARDER_MAX_SINKS][HID_MUX_MAX_DEVICES][REPORT_SIZE_BYTES];
+    uint16_t lastQueuedLength[FORWARDER_MAX_SINKS][HID_MUX_MAX_DEVICES];
+    HANDLE deviceErrorEvent;                       // Signalled when any device fails
+    capture_writer* capture;                       // Records every report read, NULL unless capturing
+    stage_latency* latency;                        // Where the reader records STAGE_READ_TO_QUEUE
+} forward_context;
+
+/**
+ * Checks whether a report repeats the last one queued to a sink from the same device.
+ */
+static bool is_repeat(forward_context* forward, int sink, int slot, const hid_report* report) {
+    return forward->lastQueuedLength[sink][slot] == report->length &&
+        memcmp(forward->lastQueued[sink][slot], report->data, report->length) == 0;
+}
+
+/**
+ * Queues a report to one sink under its ring's policy. The sink's hold on the report is
+ * released if it is not queued, and so is a report evicted to make room for it.
+ *
+ * @return true if the report was queued.
+ */
+static bool queue_to_sink(forward_context* forward, int sink, int slot, hid_report* report) {
+    report_ring* ring = forward->rings[sink];
+    bool coalesce = ring->policy == RING_POLICY_COALESCE;
+
+    // A repeat carries nothing new; while the sender is behind it is not worth a slot
+    if (coalesce && report_ring_occupancy(ring) > 0 && is_repeat(forward, sink, slot, report)) {
+        report_ring_count_coalesced(ring);
+        frame_pool_release(forward->pool, report);
+        return false;
+    }
+    // Copied before the push, after which the report may already be sent and reused
+    if (coalesce) {
+        memcpy(forward->lastQueued[sink][slot], report->data, report->length);
+        forward->lastQueuedLength[sink][slot] = report->length;
+    }
+
+    hid_report* evicted;
+    bool queued = report_ring_push(ring, report, &evicted);
+    frame_pool_release(forward->pool, evicted);
+    if (!queued) {
+        forward->lastQueuedLength[sink][slot] = 0;
+        frame_pool_release(forward->pool, report);
+    }
+    return queued;
+}
+
+/**
+ * Called on the reader thread for every report read from any device.
+ * A pong answering an outstanding ping is handed to the heartbeat, everything else is
+ * queued for the forwarder, so forwarding never pauses for a ping. The report stays in
+ * the frame it was read into.
+ */
+void on_report(const mux_device* device, hid_report* report, void* context) {
+    forward_context* forward = (forward_context*)context;
+
+    if (ReadAcquire64(&firstReportNs) == 0) {
+        InterlockedCompareExchange64(&firstReportNs, (LONG64)report->timestamp, 0);
+    }
+    if (forward->capture) {
+        capture_report(forward->capture, device->deviceId, report->timestamp, report->data, report->length);
+    }
+
+    // With no ping outstanding the byte is data, not a pong, and is forwarded like any report
+    if (report->data[0] == PONG_RESPONSE && heartbeat_pong(forward->beat, device->slot, report->timestamp)) {
+        frame_pool_release(forward->pool, report);
+        return;
+    }
+
+    if (report->length > REPORT_SIZE_BYTES) {
+        report->length = REPORT_SIZE_BYTES;
+    }
+    report->sequence = forward->nextSequence[device->slot]++;
+
+    // Once pushed the report belongs to the forwarders, so the stage is timed from copies
+    uint64_t readNs = report->timestamp;
+    uint64_t queuedNs = monotonic_ns();
+    report->queuedNs = queuedNs;
+
+    // Every sink gets the same frame. It is encoded here, while this thread still holds
+    // it alone, and each sink releases its hold once sent.
+    if (forward->sinkCount > 1) {
+        if (!forwarder_encode_shared(report, forward->format)) {
+            frame_pool_release(forward->pool, report);
+            return;
+        }
+        frame_pool_share(forward->pool, report, forward->sinkCount - 1);
+    }
+
+    // A full ring drops, evicts or waits as its policy says, and counts it. The sequence
+    // number was consumed either way, so a report that is not sent shows up as a gap.
+    for (int sink = 0; sink < forward->sinkCount; sink++) {
+        if (queue_to_sink(forward, sink, device->slot, report) && sink == 0) {
+            stage_latency_record(forward->latency, STAGE_READ_TO_QUEUE, readNs, queuedNs);
         }
-        else if (res < 0) {
-            write_log(LOGLEVEL_ERROR, "Error reading from device.");
+    }
+}
+
+/**
+ * Called on the reader thread when a device fails, e.g. because it was unplugged.
+ */
+void on_device_error(const mux_device* device, DWORD error, void* context) {
+    forward_context* forward = (forward_context*)context;
+    SetEvent(forward->deviceErrorEvent);
+}
+
+// Servers the reports go to, and the ring between the HID reader and each sink: one per
+// server, then one for the UDP sink and one for the local publisher if they are on.
+// Static so the slots are allocated once.
+static const tcp_socket_info sinkServers[] = SINK_SERVERS;
+static const int sinkCount = sizeof(sinkServers) / sizeof(sinkServers[0]);
+static const int forwarderCount = sizeof(sinkServers) / sizeof(sinkServers[0]) + (UDP_SERVER_PORT != 0);
+static const int ringCount = sizeof(sinkServers) / sizeof(sinkServers[0]) + (UDP_SERVER_PORT != 0) + (PUBLISH_PORT != 0);
+static report_ring sinkRings[FORWARDER_MAX_SINKS];
+
+// Serves the report stream to local subscribers, from sinkRings[forwarderCount]
+static publisher localPublisher;
+
+// Frames the devices read into; a report stays in its frame until it has been sent
+static frame_pool framePool;
+
+// Path of the device in each mux slot, NULL for free slots
+static char* devicePaths[HID_MUX_MAX_DEVICES];
+
+// Signals when a matching device is plugged in or removed
+static hotplug_monitor hotplug;
+
+// Ping tracking and round-trip times
+static heartbeat beat;
+
+// Reconnect state of the device side: up while at least one device is open
+static connection hidLink;
+
+// Device paths that opened on earlier runs
+static device_cache pathCache;
+
+// Where each forwarded report's time went, stage by stage
+static stage_latency pipelineLatency;
+
+// Capture file every report is written to, with --capture
+static capture_writer capture;
+
+// Capture file played back in place of the devices, with --replay
+static replay playback;
+static bool replaying;
+
+static bool path_is_open(const char* path) {
+    for (int slot = 0; slot < HID_MUX_MAX_DEVICES; slot++) {
+        if (devicePaths[slot] && _stricmp(devicePaths[slot], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Opens one device by path. It gets an id derived from its path, so the same keyboard
+ * keeps its id across reconnects and restarts.
+ *
+ * @return The slot of the device, or -1 if it could not be opened.
+ */
+int open_device(hid_mux* mux, hid_usage_info* usage_info, const char* path) {
+    // Two paths hashing to the same id is unlikely; step past it if it happens
+    uint16_t deviceId = stable_device_id(path);
+    for (int slot = 0; slot < HID_MUX_MAX_DEVICES; slot++) {
+        if (devicePaths[slot] && mux->devices[slot].deviceId == deviceId) {
+            deviceId++;
+            slot = -1;
+        }
+    }
+
+    char* copy = _strdup(path);
+    if (!copy) {
+        return -1;
+    }
+    int slot = hid_mux_open_path(mux, path, deviceId, usage_info->usage_page, usage_info->usage);
+    if (slot < 0) {
+        free(copy);
+        return -1;
+    }
+
+    devicePaths[slot] = copy;
+    device_cache_remember(&pathCache, usage_info, path);
+    write_log_format(LOGLEVEL_INFO, "Device 0x%04x is %s", deviceId, path);
+    return slot;
+}
+
+/**
+ * Opens the cached paths that are not open yet, without enumerating. Paths that no
+ * longer open are dropped from the cache.
+ *
+ * @return The number of cached paths that failed to open.
+ */
+int open_cached_devices(hid_mux* mux, hid_usage_info* usage_info) {
+    const char* paths[HID_MUX_MAX_DEVICES];
+    const char* stale[HID_MUX_MAX_DEVICES];
+    int found = device_cache_paths(&pathCache, usage_info, paths, HID_MUX_MAX_DEVICES);
+    int staleCount = 0;
+
+    for (int i = 0; i < found; i++) {
+        if (!path_is_open(paths[i]) && open_device(mux, usage_info, paths[i]) < 0) {
+            stale[staleCount++] = paths[i];
+        }
+    }
+
+    // Forgetting frees the path, so only once the loop is done with it
+    for (int i = 0; i < staleCount; i++) {
+        device_cache_forget(&pathCache, usage_info, stale[i]);
+    }
+    return staleCount;
+}
+
+/**
+ * Enumerates and opens every matching device that is not open yet.
+ *
+ * @return The number of devices open afterwards.
+ */
+int open_matching_devices(hid_mux* mux, hid_usage_info* usage_info) {
+    char* paths[HID_MUX_MAX_DEVICES];
+    int found = enumerate_usage_paths(usage_info, paths, HID_MUX_MAX_DEVICES);
+
+    for (int i = 0; i < found; i++) {
+        if (!path_is_open(paths[i])) {
+            open_device(mux, usage_info, paths[i]);
+        }
+        free(paths[i]);
+    }
+
+    return hid_mux_count(mux);
+}
+
+/**
+ * Opens matching devices, trying the cached paths first. Enumeration only runs when the
+ * cache opened nothing new or one of its paths went stale, e.g. after the device moved
+ * to another port.
+ *
+ * @return The number of devices open afterwards.
+ */
+int open_devices(hid_mux* mux, hid_usage_info* usage_info) {
+    // A replay's stand-in devices are the only ones
+    if (replaying) {
+        return hid_mux_count(mux);
+    }
+
+    int before = hid_mux_count(mux);
+    int stale = open_cached_devices(mux, usage_info);
+
+    if (stale > 0 || hid_mux_count(mux) == before) {
+        open_matching_devices(mux, usage_info);
+    }
+    save_device_cache(&pathCache);
+    return hid_mux_count(mux);
+}
+
+/**
+ * Closes the device in a slot. Its sequence restarts at 0 if it comes back.
+ */
+void close_device(hid_mux* mux, forward_context* forward, int slot) {
+    hid_mux_remove(mux, slot);
+    free(devicePaths[slot]);
+    devicePaths[slot] = NULL;
+    forward->nextSequence[slot] = 0;  // The slot is idle, so the reader is not using it
+    for (int sink = 0; sink < FORWARDER_MAX_SINKS; sink++) {
+        forward->lastQueuedLength[sink][slot] = 0;
+    }
+    heartbeat_clear(forward->beat, slot);
+}
+
+/**
+ * Closes every failed device and reopens whatever matching devices are present.
+ *
+ * @return The number of devices open afterwards.
+ */
+int reopen_devices(hid_mux* mux, forward_context* forward, hid_usage_info* usage_info) {
+    for (int slot = 0; slot < HID_MUX_MAX_DEVICES; slot++) {
+        if (ReadAcquire(&mux->devices[slot].state) == MUX_DEVICE_FAILED) {
+            close_device(mux, forward, slot);
+        }
+    }
+    return open_devices(mux, usage_info);
+}
+
+/**
+ * Opens matching devices after a hotplug event and logs how long after the event they
+ * were ready.
+ *
+ * @return true if a device was opened.
+ */
+bool open_new_devices(hid_mux* mux, hid_usage_info* usage_info) {
+    int before = hid_mux_count(mux);
+    int after = open_devices(mux, usage_info);
+    if (after <= before) {
+        return false;
+    }
+
+    uint64_t sinceChange = monotonic_ns() - hotplug_last_change(&hotplug);
+    write_log_format(LOGLEVEL_INFO, "Opened %d device(s) %llu us after hotplug; reading from %d.",
+        after - before, (unsigned long long)(sinceChange / 1000), after);
+    return true;
+}
+
+/**
+ * Pings every open device without waiting for the answers. The reader thread matches
+ * the pongs; check_pings finds the devices that stayed silent.
+ */
+void send_pings(hid_mux* mux, forward_context* forward) {
+    for (int slot = 0; slot < HID_MUX_MAX_DEVICES; slot++) {
+        // Replayed devices have no output reports to ping with
+        if (ReadAcquire(&mux->devices[slot].state) != MUX_DEVICE_OPEN || mux->devices[slot].outputLength == 0) {
+            continue;
+        }
+        // A ping still outstanding will be reported by check_pings; don't restart its clock
+        if (ReadAcquire64(&forward->beat->sentNs[slot]) != 0) {
+            continue;
+        }
+        heartbeat_sent(forward->beat, slot, monotonic_ns());
+        if (!send_ping(mux, slot)) {
+            close_device(mux, forward, slot);
+        }
+    }
+}
+
+/**
+ * Closes devices whose ping went unanswered for PING_TIMEOUT.
+ *
+ * @return true if every device is healthy, false if any was closed.
+ */
+bool check_pings(hid_mux* mux, forward_context* forward) {
+    uint64_t now = monotonic_ns();
+    bool healthy = true;
+
+    for (int slot = 0; slot < HID_MUX_MAX_DEVICES; slot++) {
+        if (heartbeat_expired(forward->beat, slot, now, PING_TIMEOUT * 1000000ULL)) {
+            write_log_format(LOGLEVEL_WARN, "Device 0x%04x did not answer the ping.", mux->devices[slot].deviceId);
+            close_device(mux, forward, slot);
+            healthy = false;
+        }
+    }
+    return healthy;
+}
+
+/**
+ * Brings the device-side state machine in line with the devices actually open, and
+ * makes a backoff-paced attempt to open devices while none is. Hotplug events still
+ * open devices straight away; the attempts cover devices that are present but failed to
+ * open, or arrivals the notifications missed.
+ */
+void update_hid_link(hid_mux* mux, hid_usage_info* usage_info) {
+    uint64_t now = monotonic_ns();
+
+    if (hid_mux_count(mux) > 0) {
+        connection_established(&hidLink, now);
+        return;
+    }
+    connection_lost(&hidLink, now);
+
+    if (connection_attempt_due(&hidLink, now)) {
+        if (open_devices(mux, usage_info) > 0) {
+            connection_established(&hidLink, monotonic_ns());
+        }
+        else {
+            connection_attempt_failed(&hidLink, monotonic_ns());
+        }
+    }
+}
+
+/**
+ * Allocates the ring of every sink.
+ *
+ * @return true on success; on failure no ring is left allocated.
+ */
+bool init_sink_rings(void) {
+    for (int sink = 0; sink < ringCount; sink++) {
+        if (!init_report_ring(&sinkRings[sink], QUEUE_POLICY)) {
+            while (--sink >= 0) {
+                destroy_report_ring(&sinkRings[sink]);
+            }
             return false;
         }
     }
-    return false; // Timeout reached, no pong received
+    return true;
+}
+
+/**
+ * Frees the ring of every sink. Call once nothing pushes to or drains them.
+ */
+void destroy_sink_rings(void) {
+    for (int sink = 0; sink < ringCount; sink++) {
+        destroy_report_ring(&sinkRings[sink]);
+    }
+}
+
+/**
+ * @return The number of reports queued to any sink and not yet sent.
+ */
+LONG sink_backlog(void) {
+    LONG backlog = 0;
+    for (int sink = 0; sink < ringCount; sink++) {
+        backlog += report_ring_occupancy(&sinkRings[sink]);
+    }
+    return backlog;
+}
+
+/**
+ * Stops watching for devices, closes every device and stops the reader thread.
+ */
+void stop_devices(hid_mux* mux, forward_context* forward) {
+    stop_hotplug_monitor(&hotplug);
+    for (int slot = 0; slot < HID_MUX_MAX_DEVICES; slot++) {
+        if (devicePaths[slot]) {
+            close_device(mux, forward, slot);
+        }
+    }
+    stop_hid_mux(mux);
+    save_device_cache(&pathCache);
+    free_device_cache(&pathCache);
+}
+
+/**
+ * Closes the events in a forward context. Call after the reader thread has stopped.
+ */
+void close_forward_context(forward_context* forward) {
+    if (forward->deviceErrorEvent) {
+        CloseHandle(forward->deviceErrorEvent);
+    }
 }
 
 // Global variable to control the main loop
 volatile bool keepRunning = true;
 
+// Signalled by the control handler so the main thread wakes immediately
+HANDLE stopEvent = NULL;
+
 // Control handler function
 BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
     switch (fdwCtrlType) {
@@ -56,6 +510,7 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
     case CTRL_C_EVENT:
         printf("Ctrl+C event\n");
         keepRunning = false; // Set the flag to false to exit the main loop
+        SetEvent(stopEvent);
         return TRUE;
 
     default:
@@ -63,15 +518,75 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
     }
 }
 
-int main() {
-    
+/**
+ * Reads the command line options.
+ *
+ * @param capturePath Receives the file given with --capture, or NULL.
+ * @param replayPath Receives the file given with --replay, or NULL.
+ * @param speed Receives the --speed factor: 1 unless given, 0 for max.
+ * @return false if the command line is not understood.
+ */
+bool parse_options(int argc, char** argv, const char** capturePath, const char** replayPath, double* speed) {
+    *capturePath = NULL;
+    *replayPath = NULL;
+    *speed = 1.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--capture") == 0) {
+            *capturePath = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0) {
+            *replayPath = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--speed") == 0) {
+            i++;
+            *speed = _stricmp(argv[i], "max") == 0 ? 0.0 : atof(argv[i]);
+            if (*speed <= 0 && _stricmp(argv[i], "max") != 0) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    startNs = monotonic_ns();
+
+    const char* capturePath;
+    const char* replayPath;
+    double replaySpeed;
+    if (!parse_options(argc, argv, &capturePath, &replayPath, &replaySpeed)) {
+        printf("Usage: RawHidDriver [--capture <file>] [--replay <file> [--speed <factor>|max]]\n");
+        return 1;
+    }
+
+    // Created before the handler is registered so Ctrl+C always has something to signal
+    stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (stopEvent == NULL) {
+        printf("ERROR: Could not create stop event");
+        return 1;
+    }
+
     // Register the control handler
     if (!SetConsoleCtrlHandler(CtrlHandler, TRUE)) {
         printf("ERROR: Could not set control handler");
         return 1;
     }
 
-    init_logger(LOG_FILE); // Initialize the logger
+    // Initialize the logger
+    set_log_rotation(LOG_SEGMENT_BYTES, LOG_SEGMENT_COUNT, LOG_SEGMENT_COMPRESS);
+    if (LOG_BINARY) {
+        init_logger_binary(LOG_BINARY_FILE, LOG_FSYNC_INTERVAL_MS);
+    }
+    else if (LOG_ASYNC) {
+        init_logger_async(LOG_FILE, LOG_FSYNC_INTERVAL_MS);
+    }
+    else {
+        init_logger(LOG_FILE);
+    }
     set_log_level(LOGLEVEL_DEBUG); // Set the desired log level
     write_log(LOGLEVEL_DEBUG, "Logger initialized.");
     
@@ -82,106 +597,320 @@ int main() {
     usage_info.usage_page = TARGET_USAGE_PAGE; // Example Usage Page for raw HID, replace with actual
     usage_info.usage = TARGET_USAGE; // Example Usage for raw HID, replace with actual
 
-    // Attempt to get a handle to the HID device
-    hid_device* handle = get_handle(&usage_info);
-    if (handle) {
-        // If we successfully got a handle, try to open the usage path
-        open_usage_path(&usage_info, &handle);
+    load_device_cache(&pathCache, DEVICE_CACHE_FILE);
+
+    if (ringCount > FORWARDER_MAX_SINKS || !init_sink_rings()) {
+        write_log(LOGLEVEL_ERROR, "Could not set up the sinks.");
+        close_logger();
+        return -1;
     }
-    else {
-        // Handle error: could not find the device
-        write_log(LOGLEVEL_ERROR, "Could not find the device.");
-        close_logger(); // Clean up the logger
+    // Frames for every sink ring full at once, every read the multiplexer keeps outstanding
+    // plus the report each device is handing over, and a send batch per forwarder. A sink
+    // that stops draining then pins at most its own ring's worth, and the reader always has
+    // frames for the sinks that still drain.
+    LONG framePoolSize = REPORT_RING_CAPACITY * ringCount + HID_MUX_MAX_DEVICES * (HID_MUX_READS_IN_FLIGHT + 1) +
+        SEND_BATCH_MAX_FRAMES * forwarderCount;
+    if (!init_frame_pool(&framePool, framePoolSize)) {
+        destroy_sink_rings();
+        close_logger();
         return -1;
     }
 
-    // Define server information
-    tcp_socket_info server_info;
-    server_info.ip = SERVER_IP;  // The IP address of the server, replace with actual
-    server_info.port = SERVER_PORT;  // The port number of the server, replace with actual
+    init_heartbeat(&beat);
 
-    // Initialize TCP client and connect to the server
-    SOCKET serverSocket = init_client(&server_info);
-    if (serverSocket == INVALID_SOCKET) {
-        hid_close(handle);
-        hid_exit();
-        write_log(LOGLEVEL_ERROR, "Failed to initialize TCP client.");
+    forward_context forward = { 0 };
+    for (int sink = 0; sink < ringCount; sink++) {
+        forward.rings[sink] = &sinkRings[sink];
+    }
+    forward.sinkCount = ringCount;
+    forward.format = WIRE_FORMAT;
+    forward.pool = &framePool;
+    forward.beat = &beat;
+    forward.latency = &pipelineLatency;
+    init_stage_latency(&pipelineLatency);
+    forward.deviceErrorEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (capturePath && open_capture(&capture, capturePath)) {
+        forward.capture = &capture;
+    }
+
+    // One reader thread serves every device; it starts empty and devices are added below
+    hid_mux mux = { 0 };
+    if (!forward.deviceErrorEvent || !start_hid_mux(&mux, HID_IO_ENGINE, &framePool, on_report, on_device_error, &forward)) {
+        write_log(LOGLEVEL_ERROR, "Could not start the HID reader.");
+        close_forward_context(&forward);
+        destroy_sink_rings();
+        destroy_frame_pool(&framePool);
+        close_logger();
+        return -1;
+    }
+
+    // Watch before enumerating so a device plugged in between the two is not missed
+    if (!start_hotplug_monitor(&hotplug, &usage_info, HOTPLUG_FORCE_POLLING)) {
+        stop_devices(&mux, &forward);
+        close_forward_context(&forward);
+        destroy_sink_rings();
+        destroy_frame_pool(&framePool);
         close_logger();
         return -1;
     }
 
-    if (handle) {
-        // We have successfully connected to the device
-        // Now we can start listening for messages
-        hid_set_nonblocking(handle, true);
-        DWORD last_ping_time = 0;
+    int deviceCount;
+    if (replayPath) {
+        // The capture stands in for the devices; nothing real is opened
+        replaying = start_replay(&playback, &mux, replayPath, replaySpeed);
+        if (!replaying) {
+            stop_devices(&mux, &forward);
+            close_forward_context(&forward);
+            close_capture(&capture);
+            destroy_sink_rings();
+            destroy_frame_pool(&framePool);
+            close_logger();
+            return -1;
+        }
+        deviceCount = hid_mux_count(&mux);
+    }
+    else {
+        // Cached paths open without enumerating. As in open_devices, enumeration only runs
+        // when the cache opened nothing or one of its paths went stale; a device the cache
+        // does not know yet is found once it is plugged in, or on the next reconnect
+        int stale = open_cached_devices(&mux, &usage_info);
+        uint64_t cachedNs = monotonic_ns();
+        write_log_format(LOGLEVEL_INFO, "Opened %d cached device(s) %llu us after startup.",
+            hid_mux_count(&mux), (unsigned long long)((cachedNs - startNs) / 1000));
+
+        if (stale > 0 || hid_mux_count(&mux) == 0) {
+            open_matching_devices(&mux, &usage_info);
+            write_log_format(LOGLEVEL_INFO, "Enumeration took %llu us.", (unsigned long long)((monotonic_ns() - cachedNs) / 1000));
+        }
+        deviceCount = hid_mux_count(&mux);
+        save_device_cache(&pathCache);
+    }
+    if (deviceCount == 0) {
+        write_log(LOGLEVEL_WARN, "Could not find the device. Waiting for it to be plugged in.");
+    }
+    else {
+        write_log_format(LOGLEVEL_INFO, "Reading from %d device(s).", deviceCount);
+    }
+    init_connection(&hidLink, "HID", HID_RECONNECT_BASE_MS, HID_RECONNECT_MAX_MS, deviceCount > 0);
+
+    // Connect to the primary server; the other sinks connect on their own sender threads
+    tcp_socket_info server_info = sinkServers[0];
+    SOCKET serverSocket = init_client(&server_info);
+    if (serverSocket == INVALID_SOCKET) {
+        // The forwarder keeps trying in the background; reports queue up meanwhile
+        write_log(LOGLEVEL_WARN, "Failed to initialize TCP client. Retrying in the background.");
+    }
+
+    static const uint8_t stateCommands[] = DOWNSTREAM_STATE_COMMANDS;
+    downstream_config command_config;
+    command_config.format = WIRE_FORMAT;
+    command_config.writeIntervalUs = DOWNSTREAM_WRITE_INTERVAL_US;
+    command_config.stateCommands = stateCommands;
+    command_config.stateCommandCount = sizeof(stateCommands) / sizeof(stateCommands[0]);
+
+    static forwarder senders[FORWARDER_MAX_SINKS];
+    static downstream commands;
+    static metrics_server metrics;
+    bool metricsStarted = false;
+
+    int sendersStarted = 0;
+    for (; sendersStarted < forwarderCount; sendersStarted++) {
+        forwarder_config sender_config;
+        sender_config.serverSocket = sendersStarted == 0 ? serverSocket : INVALID_SOCKET;
+        if (sendersStarted < sinkCount) {
+            sender_config.server = sinkServers[sendersStarted];
+            sender_config.transport = SINK_TRANSPORT_TCP;
+        }
+        else {
+            // The UDP sink, after the TCP servers
+            sender_config.server.ip = UDP_SERVER_IP;
+            sender_config.server.port = UDP_SERVER_PORT;
+            sender_config.transport = SINK_TRANSPORT_UDP;
+        }
+        sender_config.multicastTtl = UDP_MULTICAST_TTL;
+        sender_config.format = WIRE_FORMAT;
+        sender_config.flushBytes = SEND_FLUSH_BYTES;
+        sender_config.flushDeadlineUs = SEND_FLUSH_DEADLINE_US;
+        // Stage stamps live in the shared report, so only the primary records them
+        sender_config.latency = sendersStarted == 0 ? &pipelineLatency : NULL;
+        if (!start_forwarder(&senders[sendersStarted], &sinkRings[sendersStarted], &framePool, &sender_config)) {
+            break;
+        }
+    }
+
+    if (sendersStarted == forwarderCount) {
+        if (!start_downstream(&commands, &mux, &senders[0], &command_config)) {
+            write_log(LOGLEVEL_WARN, "Could not start the downstream path; server commands will be ignored.");
+        }
+        bool publishing = false;
+        if (PUBLISH_PORT != 0) {
+            // A publisher that failed to start closes its ring, so its reports are dropped
+            tcp_socket_info publish_address = { PUBLISH_IP, PUBLISH_PORT };
+            publishing = start_publisher(&localPublisher, &sinkRings[forwarderCount], &framePool, WIRE_FORMAT, &publish_address);
+            if (!publishing) {
+                write_log(LOGLEVEL_WARN, "Could not start publishing to local subscribers.");
+            }
+        }
+        if (METRICS_PORT != 0) {
+            metrics_sources sources = { &mux, { 0 }, { 0 }, forwarderCount, &framePool, &commands, &beat, &hidLink, &pipelineLatency,
+                publishing ? &localPublisher : NULL };
+            for (int sink = 0; sink < forwarderCount; sink++) {
+                sources.rings[sink] = &sinkRings[sink];
+                sources.sinks[sink] = &senders[sink];
+            }
+            tcp_socket_info metrics_address = { METRICS_IP, METRICS_PORT };
+            metricsStarted = start_metrics_server(&metrics, &sources, &metrics_address);
+        }
+        // The reader thread queues reports from every device and the forwarder sends them;
+        // this thread only wakes for heartbeats, hotplug events, device failures and shutdown.
+        DWORD last_ping_time = GetTickCount();
+        DWORD last_summary_time = last_ping_time;
+        LONG seenArrivals = ReadAcquire(&hotplug.arrivals);
+        int openRetries = 0;
+        bool firstReportLogged = false;
         while (keepRunning) {
-            if (GetTickCount() - last_ping_time >= PING_INTERVAL) {
-                if (send_ping(handle)) {
-                    if (wait_for_pong(handle, PING_TIMEOUT)) {
-                        // Pong received within the timeout, all is good
-                        last_ping_time = GetTickCount();
-                    }
-                    else {
-                        // No pong received, attempt to reconnect
-                        write_log(LOGLEVEL_WARN, "Attempting to reconnect...");
-                        handle = get_handle(&usage_info);
-                        if (handle) {
-                            // If we successfully got a handle, try to open the usage path
-                            open_usage_path(&usage_info, &handle);
-                        }
-                        else {
-                            // Handle error: could not find the device
-                            write_log(LOGLEVEL_ERROR, "Could not find the device.");
-                            close_logger(); // Clean up the logger
-                            return -1;
-                        }
-                    }
+            DWORD elapsed = GetTickCount() - last_ping_time;
+            DWORD timeout = elapsed >= PING_INTERVAL ? 0 : PING_INTERVAL - elapsed;
+            uint64_t deadline = heartbeat_next_deadline(&beat, PING_TIMEOUT * 1000000ULL);
+            if (deadline != 0) {
+                // Wake when the oldest outstanding ping times out
+                uint64_t now = monotonic_ns();
+                DWORD untilDeadline = deadline <= now ? 0 : (DWORD)((deadline - now + 999999) / 1000000);
+                if (untilDeadline < timeout) {
+                    timeout = untilDeadline;
                 }
-                last_ping_time = GetTickCount();
             }
-            unsigned char buf[64]; // Buffer for incoming data
-            char hexData[3 * 3 + 1]; // Each byte -> 2 hex chars, 3 bytes total, plus 1 for null terminator
-
-            // Read data from the device
-            int res = hid_read(handle, buf, sizeof(buf));
-            if (res > 0) {
-                // Convert the first three bytes of buf to a hex string
-                snprintf(hexData, sizeof(hexData), "%02X %02X %02X", buf[0], buf[1], buf[2]);
-
-                // Log the converted hex string
-                write_log(LOGLEVEL_DEBUG, hexData);
-
-                // Send the hex string over TCP
-                int bytesSent = send_to_server(serverSocket, hexData, strlen(hexData));
-                if (bytesSent < 0) {
-                    // Handle error in sending
-                    write_log(LOGLEVEL_ERROR, "Failed to send hex data to server.");
-                    // Reconnection logic if necessary
+            DWORD untilAttempt = connection_wait_ms(&hidLink, monotonic_ns());
+            if (untilAttempt < timeout) {
+                timeout = untilAttempt;
+            }
+            if (openRetries > 0 && timeout > HOTPLUG_RETRY_INTERVAL) {
+                timeout = HOTPLUG_RETRY_INTERVAL;
+            }
+            HANDLE waitHandles[4] = { stopEvent, forward.deviceErrorEvent, hotplug.changeEvent, playback.doneEvent };
+
+            DWORD waitResult = WaitForMultipleObjects(replaying ? 4 : 3, waitHandles, FALSE, timeout);
+            if (waitResult == WAIT_OBJECT_0) {
+                break; // Ctrl+C
+            }
+            if (waitResult == WAIT_OBJECT_0 + 3) {
+                // The whole capture was written; let the reader and the forwarder catch up
+                for (int waited = 0; waited < REPLAY_DRAIN_MS && sink_backlog() > 0; waited += 10) {
+                    Sleep(10);
                 }
+                break;
             }
-            else if (res < 0) {
-                // Handle error in reading from HID device
+
+            if (waitResult == WAIT_OBJECT_0 + 1) {
+                // Handle error in reading from HID device. An unplugged device ends up here
+                // straight away; anything still present is reopened.
                 write_log(LOGLEVEL_ERROR, "Error reading from device.");
-                break;
+                reopen_devices(&mux, &forward, &usage_info);
+            }
+            else if (waitResult == WAIT_OBJECT_0 + 2 || openRetries > 0) {
+                // Removals already show up as read errors, so only arrivals need work here
+                LONG arrivals = ReadAcquire(&hotplug.arrivals);
+                if (open_new_devices(&mux, &usage_info)) {
+                    openRetries = 0;
+                }
+                else if (arrivals != seenArrivals) {
+                    // The interface can be announced before it accepts opens; try again shortly
+                    openRetries = HOTPLUG_OPEN_RETRIES;
+                }
+                else if (openRetries > 0) {
+                    openRetries--;
+                }
+                seenArrivals = arrivals;
             }
 
-            Sleep(20); // Sleep to prevent a tight loop
+            if (!check_pings(&mux, &forward)) {
+                // Drop the silent devices and reopen the ones that are still present
+                write_log(LOGLEVEL_WARN, "Attempting to reconnect...");
+                reopen_devices(&mux, &forward, &usage_info);
+            }
+            update_hid_link(&mux, &usage_info);
+            if (!firstReportLogged && ReadAcquire64(&firstReportNs) != 0) {
+                write_log_format(LOGLEVEL_INFO, "First report %llu us after startup.",
+                    (unsigned long long)((ReadAcquire64(&firstReportNs) - startNs) / 1000));
+                firstReportLogged = true;
+            }
+            if (GetTickCount() - last_ping_time >= PING_INTERVAL) {
+                send_pings(&mux, &forward);
+                last_ping_time = GetTickCount();
+            }
+            if (GetTickCount() - last_summary_time >= HEARTBEAT_SUMMARY_INTERVAL) {
+                hid_mux_log_summary(&mux);
+                frame_pool_log_summary(&framePool);
+                heartbeat_log_summary(&beat);
+                connection_log_summary(&hidLink);
+                for (int sink = 0; sink < forwarderCount; sink++) {
+                    connection_log_summary(&senders[sink].link);
+                }
+                downstream_log_summary(&commands);
+                stage_latency_log_summary(&pipelineLatency);
+                if (publishing) {
+                    publisher_log_summary(&localPublisher);
+                }
+                last_summary_time = GetTickCount();
+            }
+        }
+        // Scrapes read every other component, so they stop first
+        if (metricsStarted) {
+            stop_metrics_server(&metrics);
+        }
+        // The primary forwarder closes the connection, which releases the downstream reader
+        for (int sink = 0; sink < forwarderCount; sink++) {
+            stop_forwarder(&senders[sink]);
         }
+        if (publishing) {
+            stop_publisher(&localPublisher);
+        }
+        stop_downstream(&commands);
+        stop_devices(&mux, &forward);
+        if (replaying) {
+            stop_replay(&playback);
+            replay_log_summary(&playback);
+        }
+        close_capture(&capture);
+        downstream_log_summary(&commands);
+        hid_mux_log_summary(&mux);
+        frame_pool_log_summary(&framePool);
+        stage_latency_log_summary(&pipelineLatency);
+        heartbeat_log_summary(&beat);
+        connection_log_summary(&hidLink);
     }
     else {
-        // Handle error: could not open usage path
-        hid_close(handle);
+        // Handle error: could not start sending. A started primary owns the socket.
+        for (int sink = 0; sink < sendersStarted; sink++) {
+            stop_forwarder(&senders[sink]);
+        }
+        // Nothing drains the other rings either; a reader blocked on one must not wait
+        for (int sink = 0; sink < ringCount; sink++) {
+            report_ring_close(&sinkRings[sink]);
+        }
+        stop_devices(&mux, &forward);
+        if (replaying) {
+            stop_replay(&playback);
+        }
+        close_capture(&capture);
+        close_forward_context(&forward);
+        destroy_sink_rings();
+        destroy_frame_pool(&framePool);
+        if (sendersStarted == 0 && serverSocket != INVALID_SOCKET) {
+            cleanup_client(serverSocket);
+        }
         hid_exit();
-        write_log(LOGLEVEL_ERROR, "Could not open the usage path.");
+        write_log(LOGLEVEL_ERROR, "Could not start the forwarder.");
         close_logger();
         return -1;
     }
 
-    // Clean up and close the device handle
-    hid_close(handle);
+    // Clean up and close the device handles; the forwarder closed the socket
+    close_forward_context(&forward);
+    destroy_sink_rings();
+    destroy_frame_pool(&framePool);
     hid_exit();
-    write_log(LOGLEVEL_INFO, "Application exiting due to Ctrl+C.");
+    write_log(LOGLEVEL_INFO, replaying ? "Application exiting after the replay." : "Application exiting due to Ctrl+C.");
     close_logger(); // Clean up the logger
     return 0;
 }
@@ -0,0 +1,307 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <ws2tcpip.h>
+#include "logger.h"
+
+// Quantiles reported for every latency summary
+static const double quantiles[] = { 50.0, 99.0, 99.9 };
+
+// Page being rendered
+typedef struct {
+    char* out;
+    int size;
+    int used;
+} metrics_page;
+
+static void append(metrics_page* page, const char* format, ...) {
+    va_list args;
+
+    if (page->used >= page->size - 1) {
+        return;
+    }
+    va_start(args, format);
+    int written = vsnprintf(page->out + page->used, page->size - page->used, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        page->used += written < page->size - page->used ? written : page->size - page->used - 1;
+    }
+}
+
+static void append_metric(metrics_page* page, const char* name, const char* type, const char* help) {
+    append(page, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Appends the samples of a summary from a histogram of nanosecond values, in seconds.
+ *
+ * @param labels Extra labels, e.g. "stage=\"queued\"", or "" for none.
+ */
+static void append_summary(metrics_page* page, const char* name, const char* labels, const histogram* hist) {
+    const char* separator = labels[0] ? "," : "";
+    uint64_t count = histogram_count(hist);
+
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        append(page, "%s{%s%squantile=\"%g\"} %.9f\n", name, labels, separator, quantiles[i] / 100.0,
+            histogram_percentile(hist, quantiles[i]) / 1e9);
+    }
+    append(page, "%s_sum%s%s%s %.9f\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+        histogram_mean(hist) * (double)count / 1e9);
+    append(page, "%s_count%s%s%s %llu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+        (unsigned long long)count);
+}
+
+/**
+ * Renders every metric in the Prometheus text exposition format.
+ *
+ * @param sources Where the metrics come from.
+ * @param page Receives the page, null-terminated.
+ * @param size Size of page in bytes.
+ * @return The length of the page.
+ */
+int render_metrics(const metrics_sources* sources, char* page, int size) {
+    metrics_page out = { page, size, 0 };
+    page[0] = '\0';
+
+    if (sources->mux) {
+        append_metric(&out, "rawhid_reports_read_total", "counter", "Reports read from the devices.");
+        append(&out, "rawhid_reports_read_total %lld\n", ReadNoFence64(&sources->mux->reports));
+        append_metric(&out, "rawhid_devices_open", "gauge", "Devices currently open.");
+        append(&out, "rawhid_devices_open %d\n", hid_mux_count(sources->mux));
+    }
+
+    // Each sink is labelled with the server it sends to, and the UDP one with its scheme
+    char sinkLabels[FORWARDER_MAX_SINKS][64];
+    for (int i = 0; i < sources->sinkCount; i++) {
+        snprintf(sinkLabels[i], sizeof(sinkLabels[i]), "sink=\"%s%s:%u\"",
+            sources->sinks[i]->config.transport == SINK_TRANSPORT_UDP ? "udp://" : "",
+            sources->sinks[i]->config.server.ip, sources->sinks[i]->config.server.port);
+    }
+
+    append_metric(&out, "rawhid_reports_dropped_total", "counter", "Reports dropped before reaching a sender.");
+    for (int i = 0; i < sources->sinkCount; i++) {
+        append(&out, "rawhid_reports_dropped_total{reason=\"queue_full\",%s} %lld\n", sinkLabels[i],
+            report_ring_dropped(sources->rings[i]));
+    }
+    for (int i = 0; i < sources->sinkCount; i++) {
+        append(&out, "rawhid_reports_dropped_total{reason=\"evicted\",%s} %lld\n", sinkLabels[i],
+            report_ring_evicted(sources->rings[i]));
+        append(&out, "rawhid_reports_dropped_total{reason=\"coalesced\",%s} %lld\n", sinkLabels[i],
+            report_ring_coalesced(sources->rings[i]));
+    }
+    if (sources->mux) {
+        append(&out, "rawhid_reports_dropped_total{reason=\"no_frame\"} %lld\n", ReadNoFence64(&sources->mux->dropped));
+    }
+
+    if (sources->sinkCount > 0) {
+        append_metric(&out, "rawhid_reader_blocked_seconds_total", "counter", "Time the reader waited for room in a full queue.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            append(&out, "rawhid_reader_blocked_seconds_total{%s} %.6f\n", sinkLabels[i],
+                report_ring_blocked_ns(sources->rings[i]) / 1e9);
+        }
+    }
+
+    if (sources->sinkCount > 0) {
+        append_metric(&out, "rawhid_queue_depth", "gauge", "Reports waiting for the sender, per sink.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            append(&out, "rawhid_queue_depth{%s} %ld\n", sinkLabels[i], report_ring_occupancy(sources->rings[i]));
+        }
+        append_metric(&out, "rawhid_queue_high_water", "gauge", "Most reports ever waiting for the sender, per sink.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            append(&out, "rawhid_queue_high_water{%s} %ld\n", sinkLabels[i], report_ring_high_water(sources->rings[i]));
+        }
+    }
+    if (sources->pool) {
+        append_metric(&out, "rawhid_frames_in_use", "gauge", "Report frames read into and not yet sent.");
+        append(&out, "rawhid_frames_in_use %ld\n", ReadNoFence(&sources->pool->inUse));
+    }
+
+    if (sources->sinkCount > 0) {
+        append_metric(&out, "rawhid_frames_sent_total", "counter", "Reports sent, per sink.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            append(&out, "rawhid_frames_sent_total{%s} %lld\n", sinkLabels[i], ReadNoFence64(&sources->sinks[i]->framesSent));
+        }
+        append_metric(&out, "rawhid_bytes_sent_total", "counter", "Bytes sent, per sink.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            append(&out, "rawhid_bytes_sent_total{%s} %lld\n", sinkLabels[i], ReadNoFence64(&sources->sinks[i]->bytesSent));
+        }
+        append_metric(&out, "rawhid_send_calls_total", "counter", "Send system calls made, per sink.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            append(&out, "rawhid_send_calls_total{%s} %lld\n", sinkLabels[i], ReadNoFence64(&sources->sinks[i]->sendCalls));
+        }
+        append_metric(&out, "rawhid_udp_batches_lost_total", "counter", "Batches a UDP sink discarded because the send failed.");
+        for (int i = 0; i < sources->sinkCount; i++) {
+            if (sources->sinks[i]->config.transport == SINK_TRANSPORT_UDP) {
+                append(&out, "rawhid_udp_batches_lost_total{%s} %lld\n", sinkLabels[i], ReadNoFence64(&sources->sinks[i]->batchesLost));
+            }
+        }
+    }
+
+    append_metric(&out, "rawhid_reconnects_total", "counter", "Outages that began, per side of the pipeline.");
+    for (int i = 0; i < sources->sinkCount; i++) {
+        append(&out, "rawhid_reconnects_total{link=\"server\",%s} %lld\n", sinkLabels[i],
+            ReadNoFence64(&sources->sinks[i]->link.outages));
+    }
+    if (sources->hidLink) {
+        append(&out, "rawhid_reconnects_total{link=\"device\"} %lld\n", ReadNoFence64(&sources->hidLink->outages));
+    }
+
+    if (sources->pub) {
+        report_ring* ring = sources->pub->ring;
+        append_metric(&out, "rawhid_subscribers", "gauge", "Local subscribers connected.");
+        append(&out, "rawhid_subscribers %ld\n", ReadNoFence(&sources->pub->subscriberCount));
+        append_metric(&out, "rawhid_subscribers_cut_off_total", "counter", "Local subscribers dropped for falling too far behind.");
+        append(&out, "rawhid_subscribers_cut_off_total %lld\n", ReadNoFence64(&sources->pub->cutOff));
+        append_metric(&out, "rawhid_published_frames_total", "counter", "Reports sent to every local subscriber.");
+        append(&out, "rawhid_published_frames_total %lld\n", ReadNoFence64(&sources->pub->framesPublished));
+        append_metric(&out, "rawhid_published_bytes_total", "counter", "Bytes sent to local subscribers, over all of them.");
+        append(&out, "rawhid_published_bytes_total %lld\n", ReadNoFence64(&sources->pub->bytesSent));
+        append_metric(&out, "rawhid_publisher_queue_depth", "gauge", "Reports waiting for the publisher.");
+        append(&out, "rawhid_publisher_queue_depth %ld\n", report_ring_occupancy(ring));
+        append_metric(&out, "rawhid_publisher_dropped_total", "counter", "Reports the publisher's full queue dropped or evicted.");
+        append(&out, "rawhid_publisher_dropped_total %lld\n", report_ring_dropped(ring) + report_ring_evicted(ring));
+    }
+
+    if (sources->commands) {
+        append_metric(&out, "rawhid_commands_written_total", "counter", "Server commands written to a device.");
+        append(&out, "rawhid_commands_written_total %lld\n", ReadNoFence64(&sources->commands->written));
+        append_metric(&out, "rawhid_commands_dropped_total", "counter", "Server commands dropped because the queue was full.");
+        append(&out, "rawhid_commands_dropped_total %lld\n", ReadNoFence64(&sources->commands->dropped));
+    }
+
+    if (sources->beat) {
+        append_metric(&out, "rawhid_ping_rtt_seconds", "summary", "Round-trip time of answered device pings.");
+        append_summary(&out, "rawhid_ping_rtt_seconds", "", &sources->beat->roundTrip);
+        append_metric(&out, "rawhid_pings_missed_total", "counter", "Device pings that timed out.");
+        append(&out, "rawhid_pings_missed_total %lld\n", ReadNoFence64(&sources->beat->missed));
+    }
+
+    if (sources->latency) {
+        char labels[32];
+        append_metric(&out, "rawhid_stage_latency_seconds", "summary", "Time reports spent in each stage of the pipeline.");
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            snprintf(labels, sizeof(labels), "stage=\"%s\"", stage_latency_name((pipeline_stage)i));
+            append_summary(&out, "rawhid_stage_latency_seconds", labels, &sources->latency->stages[i]);
+        }
+    }
+
+    append_metric(&out, "rawhid_log_records_dropped_total", "counter", "Log messages dropped because the log queue was full.");
+    append(&out, "rawhid_log_records_dropped_total %lld\n", get_log_dropped_count());
+
+    return out.used;
+}
+
+/**
+ * Answers one scrape: waits briefly for the request, sends the page and closes.
+ */
+static void answer_scrape(metrics_server* server, SOCKET client) {
+    char request[1024];
+    char header[128];
+    DWORD timeout = METRICS_REQUEST_TIMEOUT_MS;
+
+    // The request is not needed, only read so closing does not reset the connection
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    recv(client, request, sizeof(request), 0);
+
+    int length = render_metrics(&server->sources, server->page, sizeof(server->page));
+    int headerLength = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", length);
+
+    WSABUF buffers[2] = { { (ULONG)headerLength, header }, { (ULONG)length, server->page } };
+    DWORD sent;
+    if (WSASend(client, buffers, 2, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_WARN, "Metrics - Failed to answer a scrape. Error Code: %d", WSAGetLastError());
+    }
+    InterlockedIncrement64(&server->scrapes);
+
+    shutdown(client, SD_SEND);
+    closesocket(client);
+}
+
+/**
+ * Metrics thread entry point. Answers scrapes until the listener is closed.
+ */
+static DWORD WINAPI metrics_thread(LPVOID param) {
+    metrics_server* server = (metrics_server*)param;
+
+    write_log(LOGLEVEL_DEBUG, "Metrics - Thread started");
+    while (ReadAcquire(&server->running)) {
+        SOCKET client = accept(server->listener, NULL, NULL);
+        if (client == INVALID_SOCKET) {
+            if (ReadAcquire(&server->running)) {
+                write_log_format(LOGLEVEL_WARN, "Metrics - accept failed. Error Code: %d", WSAGetLastError());
+                Sleep(METRICS_REQUEST_TIMEOUT_MS);
+            }
+            continue;
+        }
+        answer_scrape(server, client);
+    }
+    write_log(LOGLEVEL_DEBUG, "Metrics - Thread exiting");
+    return 0;
+}
+
+/**
+ * Starts serving the metrics.
+ *
+ * @param server Pointer to the metrics_server struct to initialize.
+ * @param sources Where the metrics come from; copied.
+ * @param address Where to listen. Bind to 127.0.0.1 unless the scraper runs elsewhere.
+ * @return true if the server is listening.
+ */
+bool start_metrics_server(metrics_server* server, const metrics_sources* sources, tcp_socket_info* address) {
+    WSADATA wsaData;
+    struct sockaddr_in addr = { 0 };
+
+    server->sources = *sources;
+    server->listener = INVALID_SOCKET;
+    server->thread = NULL;
+    server->scrapes = 0;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        write_log_format(LOGLEVEL_ERROR, "Metrics - Failed to initialize WinSock. Error Code: %d", WSAGetLastError());
+        return false;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(address->port);
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listener == INVALID_SOCKET ||
+        inet_pton(AF_INET, address->ip, &addr.sin_addr) <= 0 ||
+        bind(server->listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(server->listener, 4) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_ERROR, "Metrics - Failed to listen on %s:%d. Error Code: %d",
+            address->ip, address->port, WSAGetLastError());
+        stop_metrics_server(server);
+        return false;
+    }
+
+    server->running = 1;
+    server->thread = CreateThread(NULL, 0, metrics_thread, server, 0, NULL);
+    if (server->thread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Metrics - Failed to create thread. Error Code: %lu", GetLastError());
+        stop_metrics_server(server);
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Metrics - Serving on http://%s:%d/metrics", address->ip, address->port);
+    return true;
+}
+
+/**
+ * Stops the metrics thread and closes the listener.
+ */
+void stop_metrics_server(metrics_server* server) {
+    WriteRelease(&server->running, 0);
+    if (server->listener != INVALID_SOCKET) {
+        closesocket(server->listener);  // Releases the thread from accept
+        server->listener = INVALID_SOCKET;
+    }
+    if (server->thread) {
+        WaitForSingleObject(server->thread, INFINITE);
+        CloseHandle(server->thread);
+        server->thread = NULL;
+        write_log_format(LOGLEVEL_INFO, "Metrics - Answered %lld scrapes", ReadNoFence64(&server->scrapes));
+    }
+    WSACleanup();
+}
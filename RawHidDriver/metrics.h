@@ -0,0 +1,53 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdbool.h>
+#include "hid_mux.h"
+#include "report_ring.h"
+#include "frame_pool.h"
+#include "forwarder.h"
+#include "downstream.h"
+#include "heartbeat.h"
+#include "connection.h"
+#include "stage_latency.h"
+#include "publisher.h"
+
+// Largest page a scrape returns; metrics that do not fit are cut off
+#define METRICS_PAGE_BYTES (16 * 1024)
+
+// A scrape that has not sent its request within this long is answered anyway
+#define METRICS_REQUEST_TIMEOUT_MS 1000
+
+// Where the metrics come from. Every counter and gauge is written by the one thread
+// that owns it; a scrape only reads them, so it never takes a lock the forwarding path
+// uses. Any pointer may be NULL to leave those metrics out.
+typedef struct {
+    hid_mux* mux;                                // Reports read, devices open
+    report_ring* rings[FORWARDER_MAX_SINKS];     // Queue depth and drops per sink
+    forwarder* sinks[FORWARDER_MAX_SINKS];       // Bytes, frames, send calls and reconnects per sink
+    int sinkCount;                               // Entries used in rings and sinks
+    frame_pool* pool;                            // Frames in use, pool exhaustion
+    downstream* commands;                        // Server commands written and dropped
+    heartbeat* beat;                             // Ping round trips
+    connection* hidLink;                         // Device reconnects
+    stage_latency* latency;                      // Per-stage report latency
+    publisher* pub;                              // Local subscribers, queue and drops of the publisher
+} metrics_sources;
+
+// Serves the metrics in the Prometheus text format over HTTP. One thread accepts a
+// scrape at a time, answers it and closes the connection; whatever the request asks
+// for, the answer is the metrics page.
+typedef struct {
+    metrics_sources sources;      // What is reported
+    SOCKET listener;              // Listening socket, closed to stop the thread
+    HANDLE thread;                // Accepts and answers scrapes
+    volatile LONG running;        // Cleared to ask the thread to exit
+    volatile LONG64 scrapes;      // Scrapes answered
+    char page[METRICS_PAGE_BYTES];// Page being rendered, only touched by the thread
+} metrics_server;
+
+// Function prototypes
+bool start_metrics_server(metrics_server* server, const metrics_sources* sources, tcp_socket_info* address);
+void stop_metrics_server(metrics_server* server);
+int render_metrics(const metrics_sources* sources, char* page, int size);
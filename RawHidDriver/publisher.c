@@ -0,0 +1,291 @@
+#include "publisher.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ws2tcpip.h>
+#include "forwarder.h"
+
+/**
+ * Closes a subscriber and moves the last one into its place.
+ *
+ * @param pub Pointer to the publisher.
+ * @param index The subscriber to drop.
+ * @param cutOff true if it is dropped for falling behind rather than for disconnecting.
+ */
+static void drop_subscriber(publisher* pub, int index, bool cutOff) {
+    publisher_subscriber* sub = &pub->subscribers[index];
+    LONG last = pub->subscriberCount - 1;
+
+    closesocket(sub->socket);
+    free(sub->buffer);
+    if (cutOff) {
+        WriteNoFence64(&pub->cutOff, pub->cutOff + 1);
+        write_log_format(LOGLEVEL_WARN, "Publisher - Cut off a subscriber %d bytes behind", sub->used - sub->start);
+    }
+
+    pub->subscribers[index] = pub->subscribers[last];
+    pub->pollFds[index + 1] = pub->pollFds[last + 1];
+    WriteNoFence(&pub->subscriberCount, last);
+}
+
+/**
+ * Accepts every subscriber waiting on the listener.
+ */
+static void accept_subscribers(publisher* pub) {
+    for (;;) {
+        SOCKET socket = accept(pub->listener, NULL, NULL);
+        if (socket == INVALID_SOCKET) {
+            return;  // WSAEWOULDBLOCK once the backlog is empty
+        }
+
+        u_long nonBlocking = 1;
+        int noDelay = 1;
+        char* buffer = pub->subscriberCount < PUBLISHER_MAX_SUBSCRIBERS ? malloc(PUBLISHER_SUBSCRIBER_BUFFER_BYTES) : NULL;
+        if (!buffer || ioctlsocket(socket, FIONBIO, &nonBlocking) == SOCKET_ERROR ||
+            WSAEventSelect(socket, pub->socketEvent, FD_READ | FD_WRITE | FD_CLOSE) == SOCKET_ERROR) {
+            write_log(LOGLEVEL_WARN, "Publisher - Refused a subscriber");
+            free(buffer);
+            closesocket(socket);
+            continue;
+        }
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+        LONG index = pub->subscriberCount;
+        pub->subscribers[index].socket = socket;
+        pub->subscribers[index].buffer = buffer;
+        pub->subscribers[index].start = 0;
+        pub->subscribers[index].used = 0;
+        pub->pollFds[index + 1].fd = socket;
+        pub->pollFds[index + 1].events = POLLRDNORM;
+        pub->pollFds[index + 1].revents = 0;
+        WriteNoFence(&pub->subscriberCount, index + 1);
+        WriteNoFence64(&pub->accepted, pub->accepted + 1);
+    }
+}
+
+/**
+ * Sends as much of a subscriber's queue as the socket takes without blocking.
+ *
+ * @return false if the connection failed and the subscriber should be dropped.
+ */
+static bool flush_subscriber(publisher* pub, publisher_subscriber* sub) {
+    while (sub->start < sub->used) {
+        int sent = send(sub->socket, sub->buffer + sub->start, sub->used - sub->start, 0);
+        if (sent == SOCKET_ERROR) {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+        sub->start += sent;
+        WriteNoFence64(&pub->bytesSent, pub->bytesSent + sent);
+    }
+    sub->start = 0;
+    sub->used = 0;
+    return true;
+}
+
+/**
+ * Copies a frame into every subscriber's queue, cutting off the ones without room.
+ */
+static void queue_frame(publisher* pub, const char* frame, int length) {
+    for (LONG i = 0; i < pub->subscriberCount; i++) {
+        publisher_subscriber* sub = &pub->subscribers[i];
+        if (sub->used + length > PUBLISHER_SUBSCRIBER_BUFFER_BYTES && sub->start > 0) {
+            // Move the unsent bytes to the front to make room
+            memmove(sub->buffer, sub->buffer + sub->start, sub->used - sub->start);
+            sub->used -= sub->start;
+            sub->start = 0;
+        }
+        if (sub->used + length > PUBLISHER_SUBSCRIBER_BUFFER_BYTES) {
+            drop_subscriber(pub, i--, true);
+            continue;
+        }
+        memcpy(sub->buffer + sub->used, frame, length);
+        sub->used += length;
+    }
+}
+
+/**
+ * Takes up to PUBLISHER_BATCH_REPORTS reports off the ring and queues them to every
+ * subscriber.
+ *
+ * @return The number of reports taken.
+ */
+static int publish_reports(publisher* pub) {
+    int count = 0;
+    hid_report* report;
+
+    while (count < PUBLISHER_BATCH_REPORTS && (report = report_ring_pop(pub->ring)) != NULL) {
+        // Shared reports arrive encoded; one only this sink holds is encoded here
+        if (report->wire || forwarder_encode_shared(report, pub->format)) {
+            queue_frame(pub, report->wire, report->wireLength);
+        }
+        frame_pool_release(pub->pool, report);
+        count++;
+    }
+    WriteNoFence64(&pub->framesPublished, pub->framesPublished + count);
+    return count;
+}
+
+/**
+ * Publisher thread entry point. Alternates between publishing what the ring holds and
+ * polling the sockets: new subscribers, closed ones and ones whose queue can drain.
+ */
+static DWORD WINAPI publisher_thread(LPVOID param) {
+    publisher* pub = (publisher*)param;
+    char discard[512];
+
+    write_log(LOGLEVEL_DEBUG, "Publisher - Thread started");
+    pub->pollFds[0].fd = pub->listener;
+    pub->pollFds[0].events = POLLRDNORM;
+
+    while (ReadAcquire(&pub->running)) {
+        int published = publish_reports(pub);
+
+        // Flush every subscriber once per batch; only those left with a backlog wait for POLLWRNORM
+        bool backlog = false;
+        for (LONG i = 0; i < pub->subscriberCount; i++) {
+            publisher_subscriber* sub = &pub->subscribers[i];
+            if (!flush_subscriber(pub, sub)) {
+                drop_subscriber(pub, i--, false);
+                continue;
+            }
+            pub->pollFds[i + 1].events = sub->used > 0 ? POLLRDNORM | POLLWRNORM : POLLRDNORM;
+            backlog |= sub->used > 0;
+        }
+
+        if (published == 0) {
+            // Park until a report is pushed or a socket has news. A backlogged subscriber
+            // signals once its socket takes more, so it never delays the others.
+            report_ring_wait_handle(pub->ring, pub->socketEvent, PUBLISHER_IDLE_WAIT_MS);
+        }
+
+        if (WSAPoll(pub->pollFds, (ULONG)pub->subscriberCount + 1, 0) <= 0) {
+            continue;
+        }
+        if (pub->pollFds[0].revents & POLLRDNORM) {
+            accept_subscribers(pub);
+        }
+        for (LONG i = 0; i < pub->subscriberCount; i++) {
+            SHORT revents = pub->pollFds[i + 1].revents;
+            if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                drop_subscriber(pub, i--, false);
+            }
+            else if ((revents & POLLRDNORM) && recv(pub->subscribers[i].socket, discard, sizeof(discard), 0) <= 0) {
+                // Subscribers have nothing to say; readable means closed
+                drop_subscriber(pub, i--, false);
+            }
+        }
+    }
+
+    while (pub->subscriberCount > 0) {
+        drop_subscriber(pub, pub->subscriberCount - 1, false);
+    }
+
+    write_log(LOGLEVEL_DEBUG, "Publisher - Thread exiting");
+    return 0;
+}
+
+/**
+ * Starts listening for subscribers and publishing the reports queued to the ring.
+ *
+ * @param pub Pointer to the publisher struct to initialize.
+ * @param ring The ring the HID reader pushes reports into for this sink.
+ * @param pool The pool the reports come from; they are returned to it once queued.
+ * @param format How reports are encoded.
+ * @param address Where to listen; port 0 picks a free port, see pub->port.
+ * @return true if the publisher is listening.
+ */
+bool start_publisher(publisher* pub, report_ring* ring, frame_pool* pool, wire_format_mode format, tcp_socket_info* address) {
+    WSADATA wsaData;
+    struct sockaddr_in addr = { 0 };
+    int addrLength = sizeof(addr);
+    u_long nonBlocking = 1;
+
+    pub->ring = ring;
+    pub->pool = pool;
+    pub->format = format;
+    pub->thread = NULL;
+    pub->subscriberCount = 0;
+    pub->accepted = 0;
+    pub->cutOff = 0;
+    pub->framesPublished = 0;
+    pub->bytesSent = 0;
+
+    pub->socketEvent = NULL;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        write_log_format(LOGLEVEL_ERROR, "Publisher - Failed to initialize WinSock. Error Code: %d", WSAGetLastError());
+        pub->listener = INVALID_SOCKET;
+        return false;
+    }
+
+    // Auto-reset; shared by every socket, which WSAPoll then tells apart
+    pub->socketEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pub->socketEvent == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Publisher - Failed to create socket event. Error Code: %lu", GetLastError());
+        pub->listener = INVALID_SOCKET;
+        stop_publisher(pub);
+        return false;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(address->port);
+    pub->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (pub->listener == INVALID_SOCKET ||
+        inet_pton(AF_INET, address->ip, &addr.sin_addr) <= 0 ||
+        bind(pub->listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(pub->listener, SOMAXCONN) == SOCKET_ERROR ||
+        ioctlsocket(pub->listener, FIONBIO, &nonBlocking) == SOCKET_ERROR ||
+        WSAEventSelect(pub->listener, pub->socketEvent, FD_ACCEPT) == SOCKET_ERROR ||
+        getsockname(pub->listener, (struct sockaddr*)&addr, &addrLength) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_ERROR, "Publisher - Failed to listen on %s:%d. Error Code: %d",
+            address->ip, address->port, WSAGetLastError());
+        stop_publisher(pub);
+        return false;
+    }
+    pub->port = ntohs(addr.sin_port);
+
+    pub->running = 1;
+    pub->thread = CreateThread(NULL, 0, publisher_thread, pub, 0, NULL);
+    if (pub->thread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Publisher - Failed to create thread. Error Code: %lu", GetLastError());
+        stop_publisher(pub);
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Publisher - Publishing reports on %s:%u", address->ip, pub->port);
+    return true;
+}
+
+/**
+ * Stops the publisher thread, disconnects every subscriber and closes the listener.
+ *
+ * @param pub Pointer to the publisher to stop.
+ */
+void stop_publisher(publisher* pub) {
+    WriteRelease(&pub->running, 0);
+    report_ring_close(pub->ring);  // Nothing drains the ring from here on; a blocked reader must not wait
+    if (pub->thread) {
+        report_ring_wake(pub->ring);
+        WaitForSingleObject(pub->thread, INFINITE);
+        CloseHandle(pub->thread);
+        pub->thread = NULL;
+        publisher_log_summary(pub);
+    }
+    if (pub->listener != INVALID_SOCKET) {
+        closesocket(pub->listener);
+        pub->listener = INVALID_SOCKET;
+    }
+    if (pub->socketEvent) {
+        CloseHandle(pub->socketEvent);
+        pub->socketEvent = NULL;
+    }
+    WSACleanup();
+}
+
+/**
+ * Logs how many subscribers are connected, how many were cut off, and what was published.
+ */
+void publisher_log_summary(publisher* pub) {
+    write_log_format(LOGLEVEL_INFO, "Publisher - %ld subscribers (%lld accepted, %lld cut off); %lld reports published, %lld bytes sent",
+        ReadNoFence(&pub->subscriberCount), ReadNoFence64(&pub->accepted), ReadNoFence64(&pub->cutOff),
+        ReadNoFence64(&pub->framesPublished), ReadNoFence64(&pub->bytesSent));
+}
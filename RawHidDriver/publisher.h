@@ -0,0 +1,60 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdbool.h>
+#include "report_ring.h"
+#include "frame_pool.h"
+#include "tcp_client.h"
+
+// Most subscribers connected at once; further connections are refused
+#define PUBLISHER_MAX_SUBSCRIBERS 1024
+
+// Bytes queued per subscriber. A subscriber whose queue would overflow has fallen too
+// far behind and is cut off, so it can never hold up the others.
+#define PUBLISHER_SUBSCRIBER_BUFFER_BYTES (64 * 1024)
+
+// Most reports taken off the ring before the subscribers are flushed
+#define PUBLISHER_BATCH_REPORTS 64
+
+// Longest the thread parks before looking at the sockets again; the ring and the sockets
+// wake it sooner whenever there is something to do
+#define PUBLISHER_IDLE_WAIT_MS 20
+
+// One connected subscriber
+typedef struct {
+    SOCKET socket;              // Non-blocking
+    char* buffer;               // Frames not yet accepted by the socket
+    int start;                  // First unsent byte in buffer
+    int used;                   // End of the unsent bytes in buffer
+} publisher_subscriber;
+
+// Publishes the report stream to every TCP client that connects. The publisher is a sink
+// like a forwarder: it drains a report ring of its own, copies each frame into every
+// subscriber's queue and flushes each queue with one non-blocking send. A single thread
+// polls the listener and the subscribers with WSAPoll, and parks on the ring and on an
+// event every socket signals, so neither a push nor a socket ever waits for a timeout.
+typedef struct {
+    report_ring* ring;                                        // Ring filled by the HID reader
+    frame_pool* pool;                                         // Where published reports are returned
+    wire_format_mode format;                                  // How reports are encoded
+    SOCKET listener;                                          // Accepts subscribers
+    uint16_t port;                                            // Port the listener is bound to
+    HANDLE thread;                                            // Publisher thread handle
+    HANDLE socketEvent;                                       // Signalled by the sockets: a subscriber to accept, one closing or one with room to drain
+    volatile LONG running;                                    // Cleared to ask the thread to exit
+    publisher_subscriber subscribers[PUBLISHER_MAX_SUBSCRIBERS];
+    WSAPOLLFD pollFds[PUBLISHER_MAX_SUBSCRIBERS + 1];         // Listener first, then one per subscriber
+
+    // Statistics, written by the publisher thread only
+    volatile LONG subscriberCount;    // Subscribers connected
+    volatile LONG64 accepted;         // Subscribers that connected
+    volatile LONG64 cutOff;           // Subscribers dropped for falling too far behind
+    volatile LONG64 framesPublished;  // Reports taken off the ring and queued to every subscriber
+    volatile LONG64 bytesSent;        // Bytes sent, over every subscriber
+} publisher;
+
+// Function prototypes
+bool start_publisher(publisher* pub, report_ring* ring, frame_pool* pool, wire_format_mode format, tcp_socket_info* address);
+void stop_publisher(publisher* pub);
+void publisher_log_summary(publisher* pub);
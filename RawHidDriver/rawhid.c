@@ -1,4 +1,6 @@
 #include "rawhid.h"
+#include <ctype.h>
+#include <string.h>
 
 /**
  * Opens a HID device based on vendor and product IDs.
@@ -29,7 +31,9 @@ hid_device* get_handle(hid_usage_info* usage_info) {
 }
 
 /**
- * Opens a HID device based on its usage path.
+ * Replaces a handle from get_handle with one opened on the interface that matches the
+ * usage page and usage. The old handle is closed once the new one is open; if no
+ * interface matches, it is left as it was.
  *
  * @param usage_info Pointer to a hid_usage_info struct containing device details.
  * @param handle Double pointer to the handle where the HID device handle will be stored.
@@ -50,21 +54,23 @@ void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
     write_log_format(LOGLEVEL_INFO, "RAWHID - Enumerating HID devices for Vendor ID: 0x%x, Product ID: 0x%x",
         usage_info->vendor_id, usage_info->product_id);
     // Enumerate HID devices using vendor and product IDs
-    struct hid_device_info* enum_device_info = hid_enumerate(usage_info->vendor_id, usage_info->product_id);
-    if (!enum_device_info) {
+    struct hid_device_info* devices = hid_enumerate(usage_info->vendor_id, usage_info->product_id);
+    if (!devices) {
         write_log_format(LOGLEVEL_ERROR, "RAWHID - Failed to enumerate devices for Vendor ID: 0x%x, Product ID: 0x%x",
             usage_info->vendor_id, usage_info->product_id);
         return;
     }
 
     // Loop through the enumerated devices and open the one that matches the usage page and usage
-    for (; enum_device_info != NULL; enum_device_info = enum_device_info->next) {
+    for (struct hid_device_info* enum_device_info = devices; enum_device_info != NULL; enum_device_info = enum_device_info->next) {
         if (enum_device_info->usage_page == usage_info->usage_page &&
             enum_device_info->usage == usage_info->usage) {
 
             // Open the device by its path
-            *handle = hid_open_path(enum_device_info->path);
-            if (*handle) {
+            hid_device* opened = hid_open_path(enum_device_info->path);
+            if (opened) {
+                hid_close(*handle);
+                *handle = opened;
                 write_log_format(LOGLEVEL_INFO, "RAWHID - Successfully opened device with Usage Page: 0x%x, Usage: 0x%x",
                     usage_info->usage_page, usage_info->usage);
                 break;
@@ -76,8 +82,60 @@ void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
         }
     }
 
-    // Free the enumeration list
-    hid_free_enumeration(enum_device_info);
+    // Free the whole enumeration list, not just what the loop left behind
+    hid_free_enumeration(devices);
+}
+
+/**
+ * Finds every device that matches the vendor ID, product ID, usage page and usage.
+ *
+ * @param usage_info Pointer to a hid_usage_info struct containing device details.
+ * @param paths Receives up to maxPaths device paths. Free each one with free().
+ * @param maxPaths The capacity of paths.
+ * @return The number of paths stored, or -1 if an error occurs.
+ */
+int enumerate_usage_paths(hid_usage_info* usage_info, char** paths, int maxPaths) {
+    // Check for invalid arguments
+    if (!usage_info || !paths) {
+        write_log(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
+        return -1;
+    }
+
+    struct hid_device_info* devices = hid_enumerate(usage_info->vendor_id, usage_info->product_id);
+    int count = 0;
+
+    for (struct hid_device_info* device = devices; device != NULL && count < maxPaths; device = device->next) {
+        if (device->usage_page == usage_info->usage_page && device->usage == usage_info->usage) {
+            paths[count] = _strdup(device->path);
+            if (paths[count]) {
+                count++;
+            }
+        }
+    }
+
+    hid_free_enumeration(devices);
+
+    write_log_format(LOGLEVEL_INFO, "RAWHID - Found %d devices with Usage Page: 0x%x, Usage: 0x%x",
+        count, usage_info->usage_page, usage_info->usage);
+    return count;
+}
+
+/**
+ * Derives a device id from a device path. On Windows the path embeds the USB serial
+ * number or, for devices without one, the port the device is plugged into, so the id
+ * survives replugging and restarts as long as the device stays on the same port.
+ *
+ * @param path The device path, as returned by hid_enumerate.
+ * @return A 16-bit id; callers must still resolve the rare collision.
+ */
+uint16_t stable_device_id(const char* path) {
+    // FNV-1a over the path, which Windows compares case-insensitively
+    uint32_t hash = 2166136261u;
+    for (; *path; path++) {
+        hash ^= (uint32_t)tolower((unsigned char)*path);
+        hash *= 16777619u;
+    }
+    return (uint16_t)(hash ^ (hash >> 16));
 }
 
 /**
@@ -90,7 +148,7 @@ void open_usage_path(hid_usage_info* usage_info, hid_device** handle) {
  */
 int write_to_handle(hid_device** handle, unsigned char* message, size_t size) {
     // Check for invalid arguments
-    if (*handle == NULL || !message) {
+    if (!handle || *handle == NULL || !message) {
         write_log(LOGLEVEL_ERROR, "RAWHID - Invalid arguments");
         return -1; // Return -1 to indicate failure
     }
@@ -99,12 +157,12 @@ int write_to_handle(hid_device** handle, unsigned char* message, size_t size) {
     write_log_format(LOGLEVEL_DEBUG, "RAWHID - Attempting to write %d bytes to handle", size);
 
     // Write the message to the HID device
-    int result = hid_write(handle, message, size);
+    int result = hid_write(*handle, message, size);
     if (result < 0) {
         write_log(LOGLEVEL_ERROR, "RAWHID - Failed to write to handle");
         return result;
     }
 
-    write_log(LOGLEVEL_DEBUG, "RAWHID - Wrote to handle", message);
+    write_log(LOGLEVEL_DEBUG, "RAWHID - Wrote to handle");
     return result; // Return the number of bytes written or -1 if an error occurs
 }
@@ -18,6 +18,8 @@ typedef struct {
 } hid_usage_info;
 
 // Function prototypes
-hid_device* get_handle(struct hid_usage_info* device_info);
-void open_usage_path(struct hid_usage_info* device_info, hid_device** handle);
+hid_device* get_handle(hid_usage_info* device_info);
+void open_usage_path(hid_usage_info* device_info, hid_device** handle);
 int write_to_handle(hid_device** handle, unsigned char* message, size_t size);
+int enumerate_usage_paths(hid_usage_info* usage_info, char** paths, int maxPaths);
+uint16_t stable_device_id(const char* path);
@@ -0,0 +1,214 @@
+#include "replay.h"
+#include <stdio.h>
+#include <string.h>
+#include "logger.h"
+#include "timing.h"
+
+/**
+ * Finds the pipe standing in for a captured device.
+ *
+ * @return The index into play->pipes, or -1 if the device is unknown.
+ */
+static int find_device(replay* play, uint16_t deviceId) {
+    for (int i = 0; i < play->deviceCount; i++) {
+        if (play->deviceIds[i] == deviceId) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Creates a message-mode pipe whose client end reads like a HID device handle, and adds
+ * the client end to the multiplexer.
+ *
+ * @return true on success.
+ */
+static bool add_device(replay* play, uint16_t deviceId) {
+    char name[64];
+    int index = play->deviceCount;
+
+    snprintf(name, sizeof(name), "\\\\.\\pipe\\RawHidReplay-%lu-%d", GetCurrentProcessId(), index);
+    HANDLE server = CreateNamedPipeA(name, PIPE_ACCESS_OUTBOUND, PIPE_TYPE_MESSAGE | PIPE_WAIT, 1,
+        (CAPTURE_MAX_REPORT + 1) * 64, 0, 0, NULL);
+    if (server == INVALID_HANDLE_VALUE) {
+        write_log_format(LOGLEVEL_ERROR, "Replay - Failed to create pipe. Error Code: %lu", GetLastError());
+        return false;
+    }
+
+    HANDLE client = CreateFileA(name, GENERIC_READ | FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    if (client == INVALID_HANDLE_VALUE || !SetNamedPipeHandleState(client, &mode, NULL, NULL)) {
+        write_log_format(LOGLEVEL_ERROR, "Replay - Failed to open pipe. Error Code: %lu", GetLastError());
+        if (client != INVALID_HANDLE_VALUE) {
+            CloseHandle(client);
+        }
+        CloseHandle(server);
+        return false;
+    }
+
+    // Reads carry the report ID byte in front of the longest report
+    if (hid_mux_add_handle(play->mux, client, deviceId, CAPTURE_MAX_REPORT + 1, 0) < 0) {
+        CloseHandle(server);
+        return false;
+    }
+
+    play->deviceIds[index] = deviceId;
+    play->pipes[index] = server;
+    play->deviceCount++;
+    return true;
+}
+
+/**
+ * Waits until monotonic_ns reaches target: on the pacing timer until just before it, then
+ * spinning for the last few microseconds, which no timer is precise enough for.
+ */
+static void wait_until(replay* play, uint64_t target) {
+    HANDLE handles[2] = { play->stopEvent, play->pacingTimer };
+
+    if (arm_deadline_timer(play->pacingTimer, target)) {
+        WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+    }
+    while (monotonic_ns() < target && ReadAcquire(&play->running)) {
+        YieldProcessor();
+    }
+}
+
+/**
+ * Replay thread: writes each captured report to its device's pipe at its captured time,
+ * scaled by the replay speed.
+ */
+static DWORD WINAPI replay_thread(LPVOID param) {
+    replay* play = (replay*)param;
+    capture_record record;
+    unsigned char message[CAPTURE_MAX_REPORT + 1];
+    uint64_t startNs = monotonic_ns();
+
+    message[0] = 0;  // Unnumbered report, which the reader strips like hid_read does
+
+    while (ReadAcquire(&play->running) && capture_read_next(&play->reader, &record)) {
+        int index = find_device(play, record.deviceId);
+        if (index < 0) {
+            continue;
+        }
+
+        if (play->speed > 0) {
+            uint64_t target = startNs + (uint64_t)((double)record.timestampNs / play->speed);
+            wait_until(play, target);
+            uint64_t now = monotonic_ns();
+            histogram_record(&play->lag, now > target ? now - target : 0);
+        }
+
+        // Blocks while the pipe is full, which paces a replay at full speed to the reader
+        DWORD written;
+        memcpy(message + 1, record.data, record.length);
+        if (!WriteFile(play->pipes[index], message, record.length + 1, &written, NULL)) {
+            write_log_format(LOGLEVEL_WARN, "Replay - Write to device 0x%04x failed. Error Code: %lu", record.deviceId, GetLastError());
+            break;
+        }
+        InterlockedIncrement64(&play->replayed);
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Replay - Finished after %llu ms",
+        (unsigned long long)((monotonic_ns() - startNs) / 1000000));
+    SetEvent(play->doneEvent);
+    return 0;
+}
+
+/**
+ * Starts replaying a capture file. The capture is scanned once for its devices, which
+ * are added to the multiplexer straight away; the reports follow on a thread of their own.
+ *
+ * @param play Pointer to the replay struct to initialize.
+ * @param mux The multiplexer to add the stand-in devices to.
+ * @param path The capture file.
+ * @param speed 1 for the original timing, N for N times faster, 0 for as fast as possible.
+ * @return true if the replay started.
+ */
+bool start_replay(replay* play, hid_mux* mux, const char* path, double speed) {
+    capture_record record;
+
+    memset(play, 0, sizeof(*play));
+    play->mux = mux;
+    play->speed = speed;
+    histogram_reset(&play->lag);
+
+    if (!open_capture_reader(&play->reader, path)) {
+        return false;
+    }
+    while (capture_read_next(&play->reader, &record)) {
+        if (find_device(play, record.deviceId) < 0 &&
+            (play->deviceCount == REPLAY_MAX_DEVICES || !add_device(play, record.deviceId))) {
+            write_log_format(LOGLEVEL_WARN, "Replay - Skipping the reports of device 0x%04x", record.deviceId);
+        }
+    }
+    close_capture_reader(&play->reader);
+
+    // Reopen to play from the first record
+    play->doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    play->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    play->pacingTimer = create_deadline_timer();
+    if (play->deviceCount == 0 || play->doneEvent == NULL || play->stopEvent == NULL || play->pacingTimer == NULL ||
+        !open_capture_reader(&play->reader, path)) {
+        write_log_format(LOGLEVEL_ERROR, "Replay - Nothing to replay in %s", path);
+        stop_replay(play);
+        return false;
+    }
+
+    play->running = 1;
+    play->thread = CreateThread(NULL, 0, replay_thread, play, 0, NULL);
+    if (play->thread == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Replay - Failed to create thread. Error Code: %lu", GetLastError());
+        stop_replay(play);
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "Replay - Playing %s on %d device(s) at %s", path, play->deviceCount,
+        speed > 0 ? "captured timing" : "full speed");
+    return true;
+}
+
+/**
+ * Stops the replay thread and closes the pipes. Remove the stand-in devices from the
+ * multiplexer first; a write blocked on a full pipe only returns once its reader is gone.
+ */
+void stop_replay(replay* play) {
+    WriteRelease(&play->running, 0);
+    if (play->stopEvent) {
+        SetEvent(play->stopEvent);
+    }
+    if (play->thread) {
+        WaitForSingleObject(play->thread, INFINITE);
+        CloseHandle(play->thread);
+        play->thread = NULL;
+    }
+
+    for (int i = 0; i < play->deviceCount; i++) {
+        CloseHandle(play->pipes[i]);
+    }
+    play->deviceCount = 0;
+    close_capture_reader(&play->reader);
+    if (play->doneEvent) {
+        CloseHandle(play->doneEvent);
+        play->doneEvent = NULL;
+    }
+    if (play->stopEvent) {
+        CloseHandle(play->stopEvent);
+        play->stopEvent = NULL;
+    }
+    if (play->pacingTimer) {
+        CloseHandle(play->pacingTimer);
+        play->pacingTimer = NULL;
+    }
+}
+
+/**
+ * Logs how many reports were replayed and how closely they kept the captured timing.
+ */
+void replay_log_summary(replay* play) {
+    write_log_format(LOGLEVEL_INFO, "Replay - Replayed %lld reports, lag p50 %llu us, p99 %llu us, max %llu us",
+        (long long)ReadAcquire64(&play->replayed),
+        (unsigned long long)(histogram_percentile(&play->lag, 50.0) / 1000),
+        (unsigned long long)(histogram_percentile(&play->lag, 99.0) / 1000),
+        (unsigned long long)(histogram_max(&play->lag) / 1000));
+}
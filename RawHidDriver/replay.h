@@ -0,0 +1,35 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "capture.h"
+#include "hid_mux.h"
+#include "histogram.h"
+
+// Devices a replay can stand in for
+#define REPLAY_MAX_DEVICES HID_MUX_MAX_DEVICES
+
+// Plays a capture file back in place of the real devices. Every device in the capture
+// becomes a named pipe added to the multiplexer under the captured device id, so the
+// reports go through the same read, queue and send path as live traffic.
+typedef struct {
+    capture_reader reader;                        // Capture being played
+    double speed;                                 // 1 for the original timing, N for N times faster, 0 for as fast as possible
+    hid_mux* mux;                                 // Multiplexer the pipes were added to
+    uint16_t deviceIds[REPLAY_MAX_DEVICES];       // Captured device id per pipe
+    HANDLE pipes[REPLAY_MAX_DEVICES];             // Write ends, one per captured device
+    int deviceCount;
+    HANDLE thread;                                // Writes the reports on schedule
+    volatile LONG running;
+    HANDLE stopEvent;                             // Manual-reset; cuts a wait for the next report short
+    HANDLE pacingTimer;                           // Wakes the thread shortly before the next report is due
+    HANDLE doneEvent;                             // Signalled once the whole capture was written
+    volatile LONG64 replayed;                     // Reports written
+    histogram lag;                                // How late each report was written, ns
+} replay;
+
+// Function prototypes
+bool start_replay(replay* play, hid_mux* mux, const char* path, double speed);
+void stop_replay(replay* play);
+void replay_log_summary(replay* play);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include "wire_format.h"
+
+#define REPORT_SIZE_BYTES 64
+
+// Largest input report a report buffer takes, report ID included
+#define REPORT_READ_BYTES 256
+
+// Bytes kept free in front of the read area, so the wire header can be written in place
+// and the frame sent without copying the report
+#define REPORT_HEADROOM FRAME_HEADER_SIZE
+
+// A single report as read from the HID device. Reports live in a frame_pool; the device
+// reads straight into buffer and the frame is handed along by pointer until it is sent.
+typedef struct {
+    uint64_t timestamp;                    // monotonic_ns() when the read completed
+    uint64_t queuedNs;                     // monotonic_ns() when it was pushed onto the report ring
+    uint64_t dequeuedNs;                   // monotonic_ns() when the forwarder took it off the ring
+    uint32_t sequence;                     // Per-device counter assigned by the reader
+    uint16_t device_id;                    // Device the report came from
+    uint16_t length;                       // Number of valid bytes in data
+    unsigned char* data;                   // Raw report bytes, inside buffer after the headroom
+    char* wire;                            // The encoded frame when the report is shared between sinks, else NULL
+    int wireLength;                        // Bytes in wire
+    unsigned char buffer[REPORT_HEADROOM + REPORT_READ_BYTES]; // Headroom, then the read area
+} hid_report;
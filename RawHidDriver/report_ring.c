@@ -0,0 +1,301 @@
+#include "report_ring.h"
+#include "logger.h"
+#include "timing.h"
+
+#define REPORT_RING_MASK (REPORT_RING_CAPACITY - 1)
+
+static const char* policyNames[] = { "drop-newest", "drop-oldest", "block", "coalesce" };
+
+/**
+ * Initializes an empty report ring.
+ *
+ * @param ring Pointer to the report_ring struct to initialize.
+ * @param policy What report_ring_push does when the ring is full.
+ * @return true on success, false if an event could not be created.
+ */
+bool init_report_ring(report_ring* ring, report_ring_policy policy) {
+    if (!ring) {
+        write_log(LOGLEVEL_ERROR, "Report Ring - Ring is NULL");
+        return false;
+    }
+
+    ring->head = 0;
+    ring->consumerWaiting = 0;
+    ring->policy = policy;
+    ring->tail = 0;
+    ring->highWater = 0;
+    ring->dropped = 0;
+    ring->evicted = 0;
+    ring->coalesced = 0;
+    ring->blockedNs = 0;
+    ring->producerWaiting = 0;
+    ring->closed = 0;
+
+    // Auto-reset: one wake per park
+    ring->wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    ring->spaceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (ring->wakeEvent == NULL || ring->spaceEvent == NULL) {
+        write_log_format(LOGLEVEL_ERROR, "Report Ring - Failed to create events. Error Code: %lu", GetLastError());
+        destroy_report_ring(ring);
+        return false;
+    }
+
+    write_log_format(LOGLEVEL_DEBUG, "Report Ring - Initialized with %d slots, %s when full",
+        REPORT_RING_CAPACITY, report_ring_policy_name(policy));
+    return true;
+}
+
+/**
+ * Releases the resources held by a report ring.
+ *
+ * @param ring Pointer to the report_ring struct to destroy.
+ */
+void destroy_report_ring(report_ring* ring) {
+    if (ring && ring->wakeEvent) {
+        CloseHandle(ring->wakeEvent);
+        ring->wakeEvent = NULL;
+    }
+    if (ring && ring->spaceEvent) {
+        CloseHandle(ring->spaceEvent);
+        ring->spaceEvent = NULL;
+    }
+}
+
+/**
+ * Waits until the consumer frees a slot or the ring is closed.
+ *
+ * @return The head index once the ring has room, or tail - REPORT_RING_CAPACITY if the
+ *         ring was closed while still full.
+ */
+static LONG wait_for_room(report_ring* ring, LONG tail) {
+    LONG head = ReadAcquire(&ring->head);
+    uint64_t start = monotonic_ns();
+
+    while ((ULONG)(tail - head) >= REPORT_RING_CAPACITY && !ReadAcquire(&ring->closed)) {
+        // The full barrier orders the flag before the re-check, pairing with report_ring_pop
+        InterlockedExchange(&ring->producerWaiting, 1);
+        if ((ULONG)(tail - ReadAcquire(&ring->head)) >= REPORT_RING_CAPACITY) {
+            WaitForSingleObject(ring->spaceEvent, REPORT_RING_BLOCK_WAIT_MS);
+        }
+        WriteRelease(&ring->producerWaiting, 0);
+        head = ReadAcquire(&ring->head);
+    }
+
+    InterlockedAdd64(&ring->blockedNs, (LONG64)(monotonic_ns() - start));
+    return head;
+}
+
+/**
+ * Queues a report in the next free slot. Producer side only. A full ring is handled by
+ * the ring's policy: the report is dropped, the oldest report is evicted for it, or the
+ * call waits for room. Only RING_POLICY_BLOCK ever waits.
+ *
+ * @param ring Pointer to the report ring.
+ * @param report The report to queue. The ring holds the pointer, not a copy; the consumer
+ *               owns the report from here on.
+ * @param evicted Receives the report evicted to make room, or NULL. The caller owns it.
+ * @return true if the report was queued, false if it was dropped. The caller still owns
+ *         a dropped report.
+ */
+bool report_ring_push(report_ring* ring, hid_report* report, hid_report** evicted) {
+    LONG tail = ring->tail;
+    LONG head = ReadAcquire(&ring->head);
+
+    *evicted = NULL;
+    if ((ULONG)(tail - head) >= REPORT_RING_CAPACITY) {
+        if (ring->policy == RING_POLICY_DROP_OLDEST) {
+            // The slot at head is not reused before head moves, so it can be read first.
+            // If the consumer claims it in the meantime, that made the room instead.
+            hid_report* oldest = ring->slots[head & REPORT_RING_MASK];
+            if (InterlockedCompareExchange(&ring->head, head + 1, head) == head) {
+                *evicted = oldest;
+                InterlockedIncrement64(&ring->evicted);
+            }
+            head = ReadAcquire(&ring->head);
+        }
+        else if (ring->policy == RING_POLICY_BLOCK) {
+            head = wait_for_room(ring, tail);
+        }
+
+        if ((ULONG)(tail - head) >= REPORT_RING_CAPACITY) {
+            InterlockedIncrement64(&ring->dropped);
+            return false;
+        }
+    }
+
+    ring->slots[tail & REPORT_RING_MASK] = report;
+
+    // Publish the slot. The full barrier orders the publish before the check of
+    // consumerWaiting below, so a consumer that is about to park cannot be missed.
+    InterlockedExchange(&ring->tail, tail + 1);
+
+    LONG occupancy = (LONG)(tail + 1 - head);
+    if (occupancy > ring->highWater) {
+        WriteNoFence(&ring->highWater, occupancy);
+    }
+
+    if (ReadNoFence(&ring->consumerWaiting)) {
+        SetEvent(ring->wakeEvent);
+    }
+    return true;
+}
+
+/**
+ * Counts a report the producer left out of the ring as a repeat under
+ * RING_POLICY_COALESCE. Producer side only.
+ *
+ * @param ring Pointer to the report ring.
+ */
+void report_ring_count_coalesced(report_ring* ring) {
+    WriteNoFence64(&ring->coalesced, ReadNoFence64(&ring->coalesced) + 1);
+}
+
+/**
+ * Removes the oldest queued report. Consumer side only.
+ *
+ * @param ring Pointer to the report ring.
+ * @return The oldest report, now owned by the consumer, or NULL if the ring is empty.
+ */
+hid_report* report_ring_pop(report_ring* ring) {
+    for (;;) {
+        LONG head = ReadAcquire(&ring->head);
+        if (head == ReadAcquire(&ring->tail)) {
+            return NULL;
+        }
+        hid_report* report = ring->slots[head & REPORT_RING_MASK];
+
+        switch (ring->policy) {
+        case RING_POLICY_DROP_OLDEST:
+            // The producer may have evicted this report; whoever moves head owns it
+            if (InterlockedCompareExchange(&ring->head, head + 1, head) != head) {
+                continue;
+            }
+            return report;
+
+        case RING_POLICY_BLOCK:
+            // The full barrier orders the freed slot before the check of producerWaiting
+            InterlockedExchange(&ring->head, head + 1);
+            if (ReadNoFence(&ring->producerWaiting)) {
+                SetEvent(ring->spaceEvent);
+            }
+            return report;
+
+        default:
+            WriteRelease(&ring->head, head + 1);
+            return report;
+        }
+    }
+}
+
+/**
+ * Marks the consumer as gone, so a producer blocked on a full ring drops its report
+ * instead of waiting forever. Call when the consumer stops.
+ *
+ * @param ring Pointer to the report ring.
+ */
+void report_ring_close(report_ring* ring) {
+    WriteRelease(&ring->closed, 1);
+    SetEvent(ring->spaceEvent);
+}
+
+/**
+ * Parks the consumer until the producer queues a report, report_ring_wake is called,
+ * or the timeout expires. Returns immediately if the ring is not empty.
+ *
+ * @param ring Pointer to the report ring.
+ * @param timeout Maximum time to wait in milliseconds.
+ */
+void report_ring_wait(report_ring* ring, DWORD timeout) {
+    InterlockedExchange(&ring->consumerWaiting, 1);
+
+    if (ring->head == ReadAcquire(&ring->tail)) {
+        WaitForSingleObject(ring->wakeEvent, timeout);
+    }
+
+    WriteRelease(&ring->consumerWaiting, 0);
+}
+
+/**
+ * Like report_ring_wait, but also returns when another handle is signalled: a timer, so
+ * a consumer holding back a batch can sleep until its deadline, or an event its sockets
+ * signal, so it can serve them without polling.
+ *
+ * @param ring Pointer to the report ring.
+ * @param handle A timer or event the caller waits on as well.
+ * @param timeout Maximum time to wait in milliseconds.
+ */
+void report_ring_wait_handle(report_ring* ring, HANDLE handle, DWORD timeout) {
+    HANDLE handles[2] = { ring->wakeEvent, handle };
+
+    InterlockedExchange(&ring->consumerWaiting, 1);
+
+    if (ring->head == ReadAcquire(&ring->tail)) {
+        WaitForMultipleObjects(2, handles, FALSE, timeout);
+    }
+
+    WriteRelease(&ring->consumerWaiting, 0);
+}
+
+/**
+ * Wakes a parked consumer, e.g. so it can notice a shutdown request.
+ *
+ * @param ring Pointer to the report ring.
+ */
+void report_ring_wake(report_ring* ring) {
+    SetEvent(ring->wakeEvent);
+}
+
+/**
+ * @param ring Pointer to the report ring.
+ * @return The number of reports currently queued.
+ */
+LONG report_ring_occupancy(report_ring* ring) {
+    return (LONG)(ReadAcquire(&ring->tail) - ReadAcquire(&ring->head));
+}
+
+/**
+ * @param ring Pointer to the report ring.
+ * @return The highest number of reports that have been queued at once.
+ */
+LONG report_ring_high_water(report_ring* ring) {
+    return ReadNoFence(&ring->highWater);
+}
+
+/**
+ * @param ring Pointer to the report ring.
+ * @return The number of reports dropped because the ring was full.
+ */
+LONG64 report_ring_dropped(report_ring* ring) {
+    return InterlockedCompareExchange64(&ring->dropped, 0, 0);
+}
+
+/**
+ * @param ring Pointer to the report ring.
+ * @return The number of queued reports evicted to make room under RING_POLICY_DROP_OLDEST.
+ */
+LONG64 report_ring_evicted(report_ring* ring) {
+    return ReadNoFence64(&ring->evicted);
+}
+
+/**
+ * @param ring Pointer to the report ring.
+ * @return The number of repeats left out under RING_POLICY_COALESCE.
+ */
+LONG64 report_ring_coalesced(report_ring* ring) {
+    return ReadNoFence64(&ring->coalesced);
+}
+
+/**
+ * @param ring Pointer to the report ring.
+ * @return Nanoseconds the producer spent waiting for room under RING_POLICY_BLOCK.
+ */
+uint64_t report_ring_blocked_ns(report_ring* ring) {
+    return (uint64_t)ReadNoFence64(&ring->blockedNs);
+}
+
+/**
+ * @return A short name for the policy, for logs.
+ */
+const char* report_ring_policy_name(report_ring_policy policy) {
+    return policy >= 0 && policy <= RING_POLICY_COALESCE ? policyNames[policy] : "unknown";
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <windows.h>
+#include <stdbool.h>
+#include "report.h"
+
+#define CACHE_LINE_SIZE 64
+
+// Number of report slots in the ring. Must be a power of two.
+#define REPORT_RING_CAPACITY 1024
+
+// How long a blocked producer waits for room before checking whether the ring was closed
+#define REPORT_RING_BLOCK_WAIT_MS 100
+
+// What the producer does when the ring is full. Every report that does not reach the
+// consumer has already consumed its sequence number, so it shows up on the wire as a gap.
+typedef enum {
+    RING_POLICY_DROP_NEWEST = 0,  // The new report is dropped; the reader never waits
+    RING_POLICY_DROP_OLDEST,      // The oldest queued report is evicted for it; the freshest data wins
+    RING_POLICY_BLOCK,            // The reader waits for room, so reports back up into the device
+    RING_POLICY_COALESCE          // As DROP_NEWEST, and while reports are queued a device's repeat of
+                                  // its previous report is left out (see report_ring_count_coalesced)
+} report_ring_policy;
+
+// Fixed-capacity single-producer/single-consumer ring of report pointers. Reports are
+// pooled frames (see frame_pool.h) and pass through by pointer; only the pointer is queued.
+// The HID reader thread is the only producer and the forwarder thread is the only consumer.
+// Indices run freely and are masked on access; each side's index lives on its own cache line
+// so the two threads never write to the same line. Under RING_POLICY_DROP_OLDEST the producer
+// may also advance head, so both sides claim the oldest slot with a compare-exchange.
+typedef struct {
+    // Consumer side
+    __declspec(align(CACHE_LINE_SIZE)) volatile LONG head;  // Next slot to read
+    volatile LONG consumerWaiting;                          // Set while the consumer is parked on wakeEvent
+    report_ring_policy policy;                              // What a full ring does, fixed at init
+
+    // Producer side
+    __declspec(align(CACHE_LINE_SIZE)) volatile LONG tail;  // Next slot to write
+    volatile LONG highWater;                                // Highest occupancy seen by the producer
+    volatile LONG64 dropped;                                // Reports rejected because the ring was full
+    volatile LONG64 evicted;                                // Queued reports evicted to make room
+    volatile LONG64 coalesced;                              // Repeats left out while reports were queued
+    volatile LONG64 blockedNs;                              // Time the producer spent waiting for room
+    volatile LONG producerWaiting;                          // Set while the producer is parked on spaceEvent
+    volatile LONG closed;                                   // Set once the consumer is gone; a blocked producer gives up
+
+    __declspec(align(CACHE_LINE_SIZE)) HANDLE wakeEvent;    // Wakes a parked consumer
+    HANDLE spaceEvent;                                      // Wakes a producer blocked on a full ring
+
+    __declspec(align(CACHE_LINE_SIZE)) hid_report* slots[REPORT_RING_CAPACITY];
+} report_ring;
+
+// Function prototypes
+bool init_report_ring(report_ring* ring, report_ring_policy policy);
+void destroy_report_ring(report_ring* ring);
+bool report_ring_push(report_ring* ring, hid_report* report, hid_report** evicted);
+void report_ring_count_coalesced(report_ring* ring);
+hid_report* report_ring_pop(report_ring* ring);
+void report_ring_close(report_ring* ring);
+void report_ring_wait(report_ring* ring, DWORD timeout);
+void report_ring_wait_handle(report_ring* ring, HANDLE handle, DWORD timeout);
+void report_ring_wake(report_ring* ring);
+LONG report_ring_occupancy(report_ring* ring);
+LONG report_ring_high_water(report_ring* ring);
+LONG64 report_ring_dropped(report_ring* ring);
+LONG64 report_ring_evicted(report_ring* ring);
+LONG64 report_ring_coalesced(report_ring* ring);
+uint64_t report_ring_blocked_ns(report_ring* ring);
+const char* report_ring_policy_name(report_ring_policy policy);
@@ -0,0 +1,54 @@
+#include "stage_latency.h"
+#include "logger.h"
+
+static const char* stageNames[STAGE_COUNT] = { "read-to-queue", "queued", "batch-to-sent", "read-to-sent" };
+
+/**
+ * Clears every stage.
+ *
+ * @param latency Pointer to the stage_latency struct to initialize.
+ */
+void init_stage_latency(stage_latency* latency) {
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        histogram_reset(&latency->stages[i]);
+    }
+}
+
+/**
+ * Records how long a report spent in a stage. Call only from the thread that owns the stage.
+ *
+ * @param latency The stage latencies, NULL to record nothing.
+ * @param stage The stage.
+ * @param fromNs monotonic_ns when the report entered the stage.
+ * @param toNs monotonic_ns when it left.
+ */
+void stage_latency_record(stage_latency* latency, pipeline_stage stage, uint64_t fromNs, uint64_t toNs) {
+    if (latency) {
+        histogram_record_owned(&latency->stages[stage], toNs > fromNs ? toNs - fromNs : 0);
+    }
+}
+
+/**
+ * @return A short name for the stage, for logs and benchmark output.
+ */
+const char* stage_latency_name(pipeline_stage stage) {
+    return stage >= 0 && stage < STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+/**
+ * Logs the percentiles of every stage that has recorded anything.
+ */
+void stage_latency_log_summary(const stage_latency* latency) {
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const histogram* stage = &latency->stages[i];
+        if (histogram_count(stage) == 0) {
+            continue;
+        }
+        write_log_format(LOGLEVEL_INFO, "Latency - %s: %llu reports, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us",
+            stageNames[i], (unsigned long long)histogram_count(stage),
+            histogram_percentile(stage, 50.0) / 1000.0,
+            histogram_percentile(stage, 99.0) / 1000.0,
+            histogram_percentile(stage, 99.9) / 1000.0,
+            histogram_max(stage) / 1000.0);
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include "histogram.h"
+
+// Points a report passes on its way from the device to the socket. Each is a
+// monotonic_ns stamp in hid_report; a stage is the time between two of them.
+typedef enum {
+    STAGE_READ_TO_QUEUE,   // Read completion to the push onto the ring: the report handler
+    STAGE_QUEUED,          // Push to the forwarder taking it off the ring
+    STAGE_BATCH_TO_SENT,   // Taken off the ring to the send call returning: batching and the send
+    STAGE_READ_TO_SENT,    // The whole way, read completion to the send call returning
+    STAGE_COUNT
+} pipeline_stage;
+
+// Per-stage latency of forwarded reports. Each stage is only recorded by one thread -
+// the reader for STAGE_READ_TO_QUEUE, the forwarder for the rest - so recording is a
+// handful of plain stores and never takes a lock.
+typedef struct {
+    histogram stages[STAGE_COUNT];  // Latency per stage, ns
+} stage_latency;
+
+// Function prototypes
+void init_stage_latency(stage_latency* latency);
+void stage_latency_record(stage_latency* latency, pipeline_stage stage, uint64_t fromNs, uint64_t toNs);
+void stage_latency_log_summary(const stage_latency* latency);
+const char* stage_latency_name(pipeline_stage stage);
@@ -1,4 +1,6 @@
 #include "tcp_client.h"
+#include "hex_encode.h"
+#include <string.h>
 
 /**
  * Initializes the TCP client and connects to the server.
@@ -47,6 +49,13 @@ SOCKET init_client(tcp_socket_info* server_info) {
     // Set server port
     serverAddr.sin_port = htons(server_info->port);
 
+    // Reports are latency-sensitive and the forwarder does its own coalescing,
+    // so never let Nagle hold a segment back waiting for an ACK
+    BOOL noDelay = TRUE;
+    if (setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay)) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_WARN, "TCP Client - Failed to set TCP_NODELAY. Error Code: %d", WSAGetLastError());
+    }
+
     // Connect to the server
     if (connect(clientSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
         write_log_format(LOGLEVEL_ERROR, "TCP Client - Connect failed. Error Code: %d; Server IP: %s, Port: %d",
@@ -82,8 +91,8 @@ int read_message_from_server(SOCKET serverSocket, char* buffer) {
     while (totalBytesRead < MESSAGE_SIZE_BYTES) {
         bytesRead = recv(serverSocket, buffer + totalBytesRead, MESSAGE_SIZE_BYTES - totalBytesRead, 0);
 
-        // Check for socket errors
-        if (bytesRead == SOCKET_ERROR && WSAGetLastError() != 10053) {
+        // Check for socket errors, including a connection aborted by a sender closing it
+        if (bytesRead == SOCKET_ERROR) {
             write_log_format(LOGLEVEL_ERROR, "TCP Client - Error occurred while reading from socket. Error Code: %d", WSAGetLastError());
             return -1;
         }
@@ -130,6 +139,90 @@ int send_to_server(SOCKET serverSocket, const char* data, int dataLength) {
     return 0;
 }
 
+/**
+ * Sends several buffers to the server with a single gathering WSASend call.
+ *
+ * @param serverSocket The server socket to send the data to.
+ * @param buffers The buffers to send, in order.
+ * @param bufferCount The number of buffers.
+ * @return The number of bytes sent, or -1 on error.
+ */
+int send_frames_to_server(SOCKET serverSocket, WSABUF* buffers, DWORD bufferCount) {
+    // Check for null buffers or zero count
+    if (!buffers || bufferCount == 0) {
+        write_log(LOGLEVEL_ERROR, "TCP Client - Invalid buffers to send");
+        return -1;
+    }
+
+    DWORD bytesSent = 0;
+    if (WSASend(serverSocket, buffers, bufferCount, &bytesSent, 0, NULL, NULL) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_ERROR, "TCP Client - Failed to send %lu frames. Error Code: %d", bufferCount, WSAGetLastError());
+        return -1;
+    }
+
+    write_log_format(LOGLEVEL_DEBUG, "TCP Client - Sent %lu frames, %lu bytes to server", bufferCount, bytesSent);
+    return (int)bytesSent;
+}
+
+/**
+ * Writes the FRAME_HEADER_SIZE byte wire header of a report.
+ */
+static void write_frame_header(const hid_report* report, uint8_t* out) {
+    wire_put_u16(out, (uint16_t)(FRAME_HEADER_SIZE + report->length - FRAME_LENGTH_FIELD_SIZE));
+    wire_put_u16(out + 2, report->device_id);
+    wire_put_u32(out + 4, report->sequence);
+    wire_put_u64(out + 8, report->timestamp);
+}
+
+/**
+ * Encodes a report as a binary wire frame (see wire_format.h).
+ *
+ * @param report The report to encode.
+ * @param buffer The output buffer; FRAME_MAX_SIZE bytes is always enough.
+ * @param bufferSize The size of the output buffer.
+ * @return The number of bytes written, or -1 if the buffer is too small.
+ */
+int encode_report_frame(const hid_report* report, char* buffer, int bufferSize) {
+    int frameSize = FRAME_HEADER_SIZE + report->length;
+    if (frameSize > bufferSize) {
+        write_log_format(LOGLEVEL_ERROR, "TCP Client - Frame of %d bytes does not fit in %d byte buffer", frameSize, bufferSize);
+        return -1;
+    }
+
+    uint8_t* out = (uint8_t*)buffer;
+    write_frame_header(report, out);
+    memcpy(out + FRAME_HEADER_SIZE, report->data, report->length);
+
+    return frameSize;
+}
+
+/**
+ * Turns a pooled report into a binary wire frame where it lies, by writing the header
+ * into the headroom in front of its data. The report bytes are not moved.
+ *
+ * @param report The report; its data must start at least REPORT_HEADROOM bytes into buffer.
+ * @param frame Receives the start of the frame, inside report->buffer.
+ * @return The number of bytes in the frame.
+ */
+int encode_report_frame_in_place(hid_report* report, char** frame) {
+    uint8_t* out = report->data - FRAME_HEADER_SIZE;
+    write_frame_header(report, out);
+    *frame = (char*)out;
+    return FRAME_HEADER_SIZE + report->length;
+}
+
+/**
+ * Encodes the first three bytes of a report in the legacy "AA BB CC" text format.
+ *
+ * @param report The report to encode.
+ * @param buffer The output buffer; HEX_MESSAGE_SIZE bytes is always enough.
+ * @param bufferSize The size of the output buffer.
+ * @return The number of characters written, excluding the null terminator.
+ */
+int encode_report_hex(const hid_report* report, char* buffer, int bufferSize) {
+    return (int)hex_encode(report->data, 3, buffer, bufferSize, true);
+}
+
 /**
  * Cleans up the client by closing the socket and cleaning up WinSock resources.
  *
@@ -4,9 +4,20 @@
 #include <stdint.h>
 #include <winsock2.h>
 #include "logger.h"
+#include "report.h"
+#include "wire_format.h"
 
 #define MESSAGE_SIZE_BYTES 32
 
+// Size of a legacy hex message: "AA BB CC" plus the null terminator
+#define HEX_MESSAGE_SIZE (3 * 3 + 1)
+
+// Encoding used for reports sent to the server
+typedef enum {
+	WIRE_FORMAT_BINARY = 0,  // Length-prefixed frames, see wire_format.h
+	WIRE_FORMAT_HEX          // Legacy: first three report bytes as "AA BB CC", no delimiter
+} wire_format_mode;
+
 // Structure to hold information required for TCP socket connection
 typedef struct {
 	const char* ip;  // IP address of the server
@@ -17,5 +28,9 @@ typedef struct {
 int read_message_from_server(SOCKET socket, char* buffer);
 SOCKET init_client(tcp_socket_info* server_info);
 int send_to_server(SOCKET serverSocket, const char* data, int dataLength);
+int send_frames_to_server(SOCKET serverSocket, WSABUF* buffers, DWORD bufferCount);
+int encode_report_frame(const hid_report* report, char* buffer, int bufferSize);
+int encode_report_frame_in_place(hid_report* report, char** frame);
+int encode_report_hex(const hid_report* report, char* buffer, int bufferSize);
 void cleanup_client(SOCKET serverSocket);
 
@@ -0,0 +1,65 @@
+#include "timing.h"
+
+// Cached QueryPerformanceFrequency result; constant for the life of the process.
+static LONG64 qpcFrequency = 0;
+
+/**
+ * Reads the monotonic high-resolution clock.
+ *
+ * @return Nanoseconds since an arbitrary fixed point (system boot). Never goes backwards.
+ */
+uint64_t monotonic_ns(void) {
+    LARGE_INTEGER counter;
+    LONG64 frequency = ReadNoFence64(&qpcFrequency);
+
+    if (frequency == 0) {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        frequency = freq.QuadPart;
+        WriteNoFence64(&qpcFrequency, frequency);
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    // Split the conversion so ticks * 1e9 cannot overflow
+    uint64_t ticks = (uint64_t)counter.QuadPart;
+    uint64_t seconds = ticks / (uint64_t)frequency;
+    uint64_t remainder = ticks % (uint64_t)frequency;
+    return seconds * 1000000000ULL + remainder * 1000000000ULL / (uint64_t)frequency;
+}
+
+/**
+ * Creates an auto-reset waitable timer for waking shortly before a deadline. Prefers a
+ * high-resolution timer, which is not bound to the scheduler tick; older systems get a
+ * plain one.
+ *
+ * @return The timer handle, or NULL on failure.
+ */
+HANDLE create_deadline_timer(void) {
+    HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (timer == NULL) {
+        timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+    }
+    return timer;
+}
+
+/**
+ * Arms a deadline timer to fire DEADLINE_SPIN_NS before a deadline, so the caller can wait
+ * on it and spin only for what is left.
+ *
+ * @param timer A timer from create_deadline_timer.
+ * @param deadlineNs The deadline, in monotonic_ns() time.
+ * @return true if the timer was armed, false if the deadline is too close to wait for
+ *         or the timer could not be set.
+ */
+bool arm_deadline_timer(HANDLE timer, uint64_t deadlineNs) {
+    uint64_t now = monotonic_ns();
+    if (deadlineNs <= now || deadlineNs - now <= DEADLINE_SPIN_NS) {
+        return false;
+    }
+
+    // Negative due times are relative, in 100 ns units
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG)((deadlineNs - now - DEADLINE_SPIN_NS) / 100);
+    return SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE) != FALSE;
+}
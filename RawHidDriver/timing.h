@@ -0,0 +1,19 @@
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Older SDKs lack the flag; Windows 10 1803 and later accept it
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// The last stretch before a deadline that is spun instead of waited out, covering how
+// late a high-resolution timer may fire
+#define DEADLINE_SPIN_NS 50000
+
+// Function prototypes
+uint64_t monotonic_ns(void);
+HANDLE create_deadline_timer(void);
+bool arm_deadline_timer(HANDLE timer, uint64_t deadlineNs);
@@ -0,0 +1,193 @@
+#include "udp_client.h"
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+#include <string.h>
+#include "timing.h"
+
+/**
+ * @return true if addr is an IPv4 multicast group, 224.0.0.0/4.
+ */
+static bool is_multicast(const struct in_addr* addr) {
+    return (ntohl(addr->s_addr) & 0xF0000000UL) == 0xE0000000UL;
+}
+
+/**
+ * Creates a UDP socket with WinSock started for it, so cleanup_client can close it like
+ * a TCP one.
+ *
+ * @param side "UDP Client" or "UDP Receiver", for the log.
+ * @param info The address the socket will use, for the log.
+ * @param addr Receives the address in binary.
+ * @return The socket, or INVALID_SOCKET on failure.
+ */
+static SOCKET create_udp_socket(const char* side, tcp_socket_info* info, struct sockaddr_in* addr) {
+    WSADATA wsaData;  // WinSock Data
+
+    // Initialize WinSock
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        write_log_format(LOGLEVEL_ERROR, "%s - Failed to initialize WinSock. Error Code: %d", side, WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+
+    // Check for null address info
+    if (!info) {
+        write_log_format(LOGLEVEL_ERROR, "%s - Address information is NULL", side);
+        WSACleanup();
+        return INVALID_SOCKET;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(info->port);
+    if (inet_pton(AF_INET, info->ip, &addr->sin_addr) <= 0) {
+        write_log_format(LOGLEVEL_ERROR, "%s - Invalid IP address or error in inet_pton. Error Code: %d; IP: %s, Port: %d",
+            side, WSAGetLastError(), info->ip, info->port);
+        WSACleanup();
+        return INVALID_SOCKET;
+    }
+
+    SOCKET udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udpSocket == INVALID_SOCKET) {
+        write_log_format(LOGLEVEL_ERROR, "%s - Failed to create socket. Error Code: %d; IP: %s, Port: %d",
+            side, WSAGetLastError(), info->ip, info->port);
+        WSACleanup();
+        return INVALID_SOCKET;
+    }
+    return udpSocket;
+}
+
+/**
+ * Opens a UDP socket that sends to the server. The socket is connected, so datagrams go
+ * out with send/WSASend and need no address each time; nothing is exchanged with the
+ * server, so this succeeds whether or not anything is listening.
+ *
+ * @param server_info The server, or a multicast group, to send to.
+ * @param multicastTtl Routers a multicast datagram may cross; 1 keeps it on the local
+ *                     network. Ignored for a unicast server.
+ * @return The socket, or INVALID_SOCKET on failure.
+ */
+SOCKET init_udp_client(tcp_socket_info* server_info, int multicastTtl) {
+    struct sockaddr_in serverAddr;  // Server address
+
+    SOCKET clientSocket = create_udp_socket("UDP Client", server_info, &serverAddr);
+    if (clientSocket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    // An ICMP port unreachable for an earlier datagram would otherwise fail the next send
+    // with WSAECONNRESET; with no server listening the datagrams are simply lost
+    BOOL reportReset = FALSE;
+    DWORD returned = 0;
+    if (WSAIoctl(clientSocket, SIO_UDP_CONNRESET, &reportReset, sizeof(reportReset), NULL, 0, &returned, NULL, NULL) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_WARN, "UDP Client - Failed to disable SIO_UDP_CONNRESET. Error Code: %d", WSAGetLastError());
+    }
+
+    if (is_multicast(&serverAddr.sin_addr)) {
+        // Loop back to receivers on this machine too, so the group can be tested locally
+        DWORD ttl = (DWORD)multicastTtl;
+        DWORD loop = 1;
+        if (setsockopt(clientSocket, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl)) == SOCKET_ERROR ||
+            setsockopt(clientSocket, IPPROTO_IP, IP_MULTICAST_LOOP, (const char*)&loop, sizeof(loop)) == SOCKET_ERROR) {
+            write_log_format(LOGLEVEL_WARN, "UDP Client - Failed to set multicast options. Error Code: %d", WSAGetLastError());
+        }
+    }
+
+    if (connect(clientSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_ERROR, "UDP Client - Connect failed. Error Code: %d; Server IP: %s, Port: %d",
+            WSAGetLastError(), server_info->ip, server_info->port);
+        cleanup_client(clientSocket);
+        return INVALID_SOCKET;
+    }
+
+    write_log_format(LOGLEVEL_INFO, "UDP Client - Sending datagrams to %s:%d", server_info->ip, server_info->port);
+    return clientSocket;
+}
+
+/**
+ * Opens a UDP socket that receives datagrams, for a consumer of the stream or a test.
+ *
+ * @param local_info Address and port to bind; port 0 picks a free one (see getsockname).
+ *                   To receive a multicast group, bind INADDR_ANY ("0.0.0.0") and the group's port.
+ * @param multicastGroup Group to join, e.g. "239.255.0.1", or NULL for unicast.
+ * @return The bound socket, or INVALID_SOCKET on failure. Close it with cleanup_client.
+ */
+SOCKET init_udp_receiver(tcp_socket_info* local_info, const char* multicastGroup) {
+    struct sockaddr_in localAddr;  // Local address
+
+    SOCKET receiverSocket = create_udp_socket("UDP Receiver", local_info, &localAddr);
+    if (receiverSocket == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    // Several receivers on one machine may share a multicast port
+    BOOL reuse = multicastGroup != NULL;
+    setsockopt(receiverSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    if (bind(receiverSocket, (struct sockaddr*)&localAddr, sizeof(localAddr)) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_ERROR, "UDP Receiver - Bind failed. Error Code: %d; IP: %s, Port: %d",
+            WSAGetLastError(), local_info->ip, local_info->port);
+        cleanup_client(receiverSocket);
+        return INVALID_SOCKET;
+    }
+
+    if (multicastGroup) {
+        struct ip_mreq membership;
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (inet_pton(AF_INET, multicastGroup, &membership.imr_multiaddr) <= 0 || !is_multicast(&membership.imr_multiaddr) ||
+            setsockopt(receiverSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&membership, sizeof(membership)) == SOCKET_ERROR) {
+            write_log_format(LOGLEVEL_ERROR, "UDP Receiver - Failed to join multicast group %s. Error Code: %d",
+                multicastGroup, WSAGetLastError());
+            cleanup_client(receiverSocket);
+            return INVALID_SOCKET;
+        }
+    }
+    return receiverSocket;
+}
+
+/**
+ * Sends frames to the server as one datagram, behind a datagram header carrying the
+ * session, the sequence number and the send time. The frames must fit in DATAGRAM_MAX_SIZE.
+ *
+ * @param serverSocket A socket from init_udp_client.
+ * @param session Identifies this run of the sender, so receivers resync when it restarts.
+ * @param sequence The datagram's sequence number, one more than the previous datagram's.
+ * @param frames The encoded frames, in order.
+ * @param frameCount The number of frames, at most DATAGRAM_MAX_FRAMES.
+ * @return The number of bytes sent, header included, or -1 on error.
+ */
+int send_datagram_to_server(SOCKET serverSocket, uint32_t session, uint32_t sequence, WSABUF* frames, DWORD frameCount) {
+    WSABUF buffers[DATAGRAM_MAX_FRAMES + 1];
+    uint8_t header[DATAGRAM_HEADER_SIZE];
+
+    // Check for null buffers or a count that cannot fit
+    if (!frames || frameCount == 0 || frameCount > DATAGRAM_MAX_FRAMES) {
+        write_log(LOGLEVEL_ERROR, "UDP Client - Invalid frames to send");
+        return -1;
+    }
+
+    buffers[0].buf = (char*)header;
+    buffers[0].len = DATAGRAM_HEADER_SIZE;
+    ULONG length = DATAGRAM_HEADER_SIZE;
+    for (DWORD i = 0; i < frameCount; i++) {
+        buffers[i + 1] = frames[i];
+        length += frames[i].len;
+    }
+    if (length > DATAGRAM_MAX_SIZE) {
+        write_log_format(LOGLEVEL_ERROR, "UDP Client - Datagram of %lu bytes would be fragmented", length);
+        return -1;
+    }
+
+    // Stamped last, as close to the send as it gets
+    wire_put_u32(header, sequence);
+    wire_put_u32(header + 4, session);
+    wire_put_u64(header + 8, monotonic_ns());
+
+    DWORD bytesSent = 0;
+    if (WSASend(serverSocket, buffers, frameCount + 1, &bytesSent, 0, NULL, NULL) == SOCKET_ERROR) {
+        write_log_format(LOGLEVEL_ERROR, "UDP Client - Failed to send a datagram of %lu frames. Error Code: %d", frameCount, WSAGetLastError());
+        return -1;
+    }
+
+    write_log_format(LOGLEVEL_DEBUG, "UDP Client - Sent datagram %lu, %lu frames, %lu bytes", (unsigned long)sequence, frameCount, bytesSent);
+    return (int)bytesSent;
+}
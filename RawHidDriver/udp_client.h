@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <winsock2.h>
+#include "logger.h"
+#include "tcp_client.h"
+
+// UDP counterpart of tcp_client: datagrams that each carry a header (see wire_format.h)
+// and as many whole frames as fit. Nothing is resent, so a lost datagram never holds up
+// the ones after it; each report carries the device's full state anyway. The addresses
+// are given as tcp_socket_info like the TCP ones. A multicast group address sends to
+// every receiver that joined the group.
+
+// Most frames a single datagram can carry
+#define DATAGRAM_MAX_FRAMES ((DATAGRAM_MAX_SIZE - DATAGRAM_HEADER_SIZE) / FRAME_HEADER_SIZE)
+
+// Function prototypes
+SOCKET init_udp_client(tcp_socket_info* server_info, int multicastTtl);
+SOCKET init_udp_receiver(tcp_socket_info* local_info, const char* multicastGroup);
+int send_datagram_to_server(SOCKET serverSocket, uint32_t session, uint32_t sequence, WSABUF* frames, DWORD frameCount);
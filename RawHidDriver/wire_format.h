@@ -0,0 +1,81 @@
+#pragma once
+
+// Binary wire format shared by the driver and anything that consumes its stream.
+// This header has no platform dependencies so a server can compile it as-is.
+//
+// Every frame is length-prefixed; all integers are big-endian (network byte order).
+//
+//   offset  size  field
+//   0       2     length        bytes that follow this field (FRAME_HEADER_SIZE - 2 + payload)
+//   2       2     device_id     stable id of the device the report came from
+//   4       4     sequence      per-device report counter; gaps mean reports were dropped
+//   8       8     timestamp_ns  monotonic clock when the report was read from the device
+//   16      n     payload       raw report bytes, n = length - 14
+//
+// Over UDP each datagram starts with a header of its own, followed by one or more
+// frames laid out as above. Datagrams are never fragmented or resent; a receiver
+// finds lost and reordered ones from the datagram sequence.
+//
+//   offset  size  field
+//   0       4     sequence      per-sender datagram counter, +1 for every datagram sent
+//   4       4     session       chosen when the sender starts; a new one restarts the sequence
+//   8       8     sent_ns       monotonic clock when the datagram was sent
+//   16      n     frames        n <= DATAGRAM_MAX_SIZE - 16
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_LENGTH_FIELD_SIZE 2
+#define FRAME_HEADER_SIZE 16
+#define FRAME_MAX_PAYLOAD 64
+#define FRAME_MAX_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD)
+
+#define DATAGRAM_HEADER_SIZE 16
+
+// A 1500-byte Ethernet MTU less the IPv4 and UDP headers
+#define DATAGRAM_MAX_SIZE 1472
+
+// A decoded frame. payload points into the buffer the frame was decoded from.
+typedef struct {
+    uint16_t device_id;
+    uint32_t sequence;
+    uint64_t timestamp_ns;
+    uint16_t payload_length;
+    const uint8_t* payload;
+} wire_frame;
+
+// A decoded datagram header
+typedef struct {
+    uint32_t sequence;
+    uint32_t session;
+    uint64_t sent_ns;
+} wire_datagram;
+
+static inline void wire_put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void wire_put_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline void wire_put_u64(uint8_t* p, uint64_t v) {
+    wire_put_u32(p, (uint32_t)(v >> 32));
+    wire_put_u32(p + 4, (uint32_t)v);
+}
+
+static inline uint16_t wire_get_u16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t wire_get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t wire_get_u64(const uint8_t* p) {
+    return ((uint64_t)wire_get_u32(p) << 32) | wire_get_u32(p + 4);
+}
@@ -0,0 +1,215 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_binary.h"
+#include "hex_encode.h"
+
+// Converts binary logs written by RawHidDriver (LOG_BINARY) into the text format of
+// the regular log. Usage: RawHidLogDecoder <file.rhlog> [output.log]
+//
+// The file is decoded in a single pass; format definitions are kept per session, so
+// files that were appended to by several runs decode correctly.
+
+#define MAX_FORMAT_ID 65536
+#define MESSAGE_SIZE 4096
+
+// A format definition from the current session.
+typedef struct {
+    char* format;
+    logbin_descriptor descriptor;
+} format_definition;
+
+// Decoder state for the current session.
+typedef struct {
+    format_definition formats[MAX_FORMAT_ID];
+    uint64_t sessionTimestamp;  // timestamp_ns of the session record
+    uint64_t sessionUnixNs;     // Wall clock at sessionTimestamp
+    long long records;
+    long long errors;
+} decoder_state;
+
+static decoder_state state;
+
+/**
+ * Returns the tag printed in front of messages of the given level, as the text logger does.
+ */
+static const char* level_string(uint8_t level) {
+    static const char* names[] = { "[?]", "[DEBUG]", "[INFO]", "[WARN]", "[ERROR]" };
+    return level < sizeof(names) / sizeof(names[0]) ? names[level] : "[?]";
+}
+
+/**
+ * Forgets every format definition; ids restart with each session.
+ */
+static void reset_formats(void) {
+    for (int i = 0; i < MAX_FORMAT_ID; i++) {
+        free(state.formats[i].format);
+        state.formats[i].format = NULL;
+    }
+}
+
+/**
+ * Writes the wall-clock time of a record, derived from the session's clock pair.
+ *
+ * @param out The output stream.
+ * @param timestamp The record's monotonic timestamp in nanoseconds.
+ */
+static void print_time(FILE* out, uint64_t timestamp) {
+    uint64_t unixNs = state.sessionUnixNs + (timestamp - state.sessionTimestamp);
+    time_t seconds = (time_t)(unixNs / 1000000000ULL);
+    struct tm local;
+    char text[32];
+
+    localtime_s(&local, &seconds);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    fprintf(out, "%s.%06llu ", text, (unsigned long long)(unixNs % 1000000000ULL / 1000));
+}
+
+/**
+ * Decodes one record and writes it to the output if it is a message.
+ *
+ * @param record The record, starting at its length field.
+ * @param length The total size of the record in bytes.
+ * @param out The output stream.
+ */
+static void decode_record(const uint8_t* record, size_t length, FILE* out) {
+    uint8_t type = record[2];
+    uint8_t level = record[3];
+    uint16_t formatId = logbin_get_u16(record + 4);
+    uint64_t timestamp = logbin_get_u64(record + 6);
+    const uint8_t* payload = record + LOGBIN_RECORD_HEADER_SIZE;
+    size_t payloadLength = length - LOGBIN_RECORD_HEADER_SIZE;
+    char message[MESSAGE_SIZE];
+
+    switch (type) {
+    case LOGBIN_RECORD_SESSION:
+        if (payloadLength < LOGBIN_MAGIC_SIZE + 12 || memcmp(payload, LOGBIN_MAGIC, LOGBIN_MAGIC_SIZE) != 0) {
+            fprintf(stderr, "Invalid session record\n");
+            state.errors++;
+            return;
+        }
+        if (logbin_get_u32(payload + LOGBIN_MAGIC_SIZE) != LOGBIN_VERSION) {
+            fprintf(stderr, "Unsupported log version %u\n", logbin_get_u32(payload + LOGBIN_MAGIC_SIZE));
+            exit(1);
+        }
+        reset_formats();
+        state.sessionTimestamp = timestamp;
+        state.sessionUnixNs = logbin_get_u64(payload + LOGBIN_MAGIC_SIZE + 4);
+        return;
+
+    case LOGBIN_RECORD_FORMAT: {
+        if (payloadLength < 1 || payloadLength < 1u + payload[0] + 1 || payload[0] > LOGBIN_MAX_ARGS ||
+            payload[payloadLength - 1] != '\0') {
+            fprintf(stderr, "Invalid format record for id %u\n", formatId);
+            state.errors++;
+            return;
+        }
+        format_definition* definition = &state.formats[formatId];
+        free(definition->format);
+        definition->descriptor.count = payload[0];
+        memcpy(definition->descriptor.types, payload + 1, payload[0]);
+        definition->format = _strdup((const char*)payload + 1 + payload[0]);
+        return;
+    }
+
+    case LOGBIN_RECORD_MESSAGE: {
+        const format_definition* definition = &state.formats[formatId];
+        if (!definition->format) {
+            snprintf(message, sizeof(message), "<unknown format id %u>", formatId);
+            state.errors++;
+        }
+        else {
+            logbin_format_message(definition->format, &definition->descriptor, payload, payloadLength, message, sizeof(message));
+        }
+        break;
+    }
+
+    case LOGBIN_RECORD_TEXT:
+        snprintf(message, sizeof(message), "%.*s", (int)payloadLength, (const char*)payload);
+        break;
+
+    case LOGBIN_RECORD_BYTES:
+        // Same rendering as write_log_byte_array in text mode
+        hex_encode(payload, payloadLength, message, sizeof(message), false);
+        break;
+
+    default:
+        // Unknown record types are skipped so newer writers stay readable
+        return;
+    }
+
+    print_time(out, timestamp);
+    fprintf(out, "%s %s\n", level_string(level), message);
+    state.records++;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file.rhlog> [output.log]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Unable to open %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (argc > 2) {
+        out = fopen(argv[2], "w");
+        if (!out) {
+            fprintf(stderr, "Unable to open %s\n", argv[2]);
+            fclose(in);
+            return 1;
+        }
+    }
+
+    // Records are at most 64 KiB; keep the unread tail of each chunk and read after it
+    static uint8_t buffer[1 << 20];
+    size_t filled = 0;
+    size_t read;
+
+    while ((read = fread(buffer + filled, 1, sizeof(buffer) - filled, in)) > 0 || filled > 0) {
+        filled += read;
+        size_t offset = 0;
+
+        while (filled - offset >= 2) {
+            size_t length = (size_t)logbin_get_u16(buffer + offset) + 2;
+            if (length < LOGBIN_RECORD_HEADER_SIZE) {
+                fprintf(stderr, "Corrupt record at a record boundary; stopping\n");
+                state.errors++;
+                filled = offset;
+                goto done;
+            }
+            if (filled - offset < length) {
+                break;
+            }
+            decode_record(buffer + offset, length, out);
+            offset += length;
+        }
+
+        if (read == 0) {
+            // End of file with a partial record, e.g. the writer was killed mid-batch
+            if (filled > offset) {
+                fprintf(stderr, "Ignoring %zu trailing bytes\n", filled - offset);
+            }
+            break;
+        }
+
+        memmove(buffer, buffer + offset, filled - offset);
+        filled -= offset;
+    }
+
+done:
+    fprintf(stderr, "%lld messages decoded, %lld errors\n", state.records, state.errors);
+
+    reset_formats();
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return state.errors > 0 ? 2 : 0;
+}